@@ -0,0 +1,571 @@
+#include "cli.h"
+#include "scanner.h"
+#include "snapshot.h"
+#include "diff.h"
+#include <SDL3/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define PATH_SEP '\\'
+#else
+#define PATH_SEP '/'
+#endif
+
+#define DEFAULT_TOP     20
+#define FLUSH_MS        100
+#define GENTLE_MAX_OPEN 2
+
+typedef enum { FORMAT_SUMMARY, FORMAT_NDJSON, FORMAT_CSV } Format;
+
+typedef struct {
+    char     *path;
+    uint64_t  size;
+    int64_t   files;        // a change in them for a diff
+} TopEntry;
+
+// Shared by the worker threads reporting directories. Memory stays bounded:
+// the scanner prunes reported subtrees and only the top entries are kept.
+typedef struct {
+    Format      format;
+    int         top;
+    SDL_Mutex  *lock;
+    TopEntry   *heap;       // min-heap by size of the largest directories
+    int         heap_count;
+    uint32_t    dirs;
+    uint32_t    skipped;
+    uint64_t    flushed_at;
+    const char *save;       // snapshot to write once done, NULL for none
+} CliState;
+
+static void usage(FILE *out)
+{
+    fprintf(out,
+        "usage: zoomfolder --scan PATH [options]\n"
+        "       zoomfolder --diff BEFORE.zfsnap AFTER.zfsnap [options]\n"
+        "  --format summary|ndjson|csv  output (default summary)\n"
+        "                               ndjson and csv stream one record per\n"
+        "                               directory as it completes\n"
+        "  --top N                      directories listed by summary (default %d)\n"
+        "                               with --diff, those that grew most;\n"
+        "                               ndjson and csv list every change\n"
+        "  --save FILE                  also write the scan as a snapshot to diff\n"
+        "  --memory-budget MB           with --save, collapse completed subtrees\n"
+        "                               to stay within MB; they are saved as\n"
+        "                               directories without subdirectories\n"
+        "  --top-files N                largest files listed by summary and ndjson\n"
+        "                               (default %d)\n"
+        "  --top-files-per-dir          also the largest files in each top-level\n"
+        "                               directory\n"
+        "  --threads N                  scanner threads (default one per core)\n"
+        "  --io-uring                   batch stat calls through io_uring\n"
+        "  --max-rate N                 list at most N entries per second\n"
+        "  --max-open N                 list at most N directories at once\n"
+        "  --low-priority               idle I/O class and lowest CPU priority\n"
+        "  --adaptive                   pause when filesystem latency spikes\n"
+        "  --gentle                     --low-priority --adaptive --max-open %d\n"
+        "  --one-file-system            don't descend into other mounted filesystems\n"
+        "  --exclude PATTERN            skip matching directories, repeatable:\n"
+        "                               /proc, node_modules, .git/objects, **/tmp/*\n",
+        DEFAULT_TOP, DEFAULT_TOP, GENTLE_MAX_OPEN);
+}
+
+// Any option means headless, so a mistyped one gets usage rather than a
+// window. Older macOS passes -psn_* to apps started from Finder.
+bool cli_requested(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-' && strncmp(argv[i], "-psn_", 5) != 0)
+            return true;
+    }
+    return false;
+}
+
+static const char *human_size(uint64_t bytes, char *buf, size_t cap)
+{
+    static const char *units[] = {"B", "KB", "MB", "GB", "TB", "PB"};
+    double v = (double)bytes;
+    int u = 0;
+    while (v >= 1024.0 && u < 5) {
+        v /= 1024.0;
+        u++;
+    }
+    if (u == 0) snprintf(buf, cap, "%llu B", (unsigned long long)bytes);
+    else snprintf(buf, cap, "%.1f %s", v, units[u]);
+    return buf;
+}
+
+// Length of the UTF-8 sequence at s, or 0 if it is not valid: overlong,
+// a surrogate, past U+10FFFF or cut short
+static int utf8_length(const unsigned char *s)
+{
+    if (s[0] < 0x80) return 1;
+    int len = (s[0] & 0xE0) == 0xC0 ? 2
+            : (s[0] & 0xF0) == 0xE0 ? 3
+            : (s[0] & 0xF8) == 0xF0 ? 4 : 0;
+    if (!len) return 0;
+    uint32_t cp = s[0] & (0x7F >> len);
+    for (int i = 1; i < len; i++) {
+        if ((s[i] & 0xC0) != 0x80) return 0;
+        cp = cp << 6 | (s[i] & 0x3F);
+    }
+    static const uint32_t min[] = {0, 0, 0x80, 0x800, 0x10000};
+    if (cp < min[len] || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+        return 0;
+    return len;
+}
+
+// Filesystems allow names that aren't UTF-8, which JSON can't carry: each
+// byte that isn't part of a valid sequence becomes U+FFFD.
+static void write_json_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    while (*s) {
+        unsigned char c = (unsigned char)*s;
+        int len = utf8_length((const unsigned char *)s);
+        if (len == 0) {
+            fputs("\\ufffd", out);
+            len = 1;
+        } else if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fwrite(s, 1, len, out);
+        }
+        s += len;
+    }
+    fputc('"', out);
+}
+
+static void write_csv_field(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"') fputc('"', out);
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static void heap_sift_down(TopEntry *heap, int count, int i)
+{
+    for (;;) {
+        int smallest = i, l = 2 * i + 1, r = l + 1;
+        if (l < count && heap[l].size < heap[smallest].size) smallest = l;
+        if (r < count && heap[r].size < heap[smallest].size) smallest = r;
+        if (smallest == i) return;
+        TopEntry tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+static void keep_top(CliState *st, uint64_t size, int64_t files, const char *path)
+{
+    if (st->top <= 0) return;
+    if (st->heap_count == st->top) {
+        if (size <= st->heap[0].size) return;
+        free(st->heap[0].path);
+        st->heap[0] = st->heap[--st->heap_count];
+        heap_sift_down(st->heap, st->heap_count, 0);
+    }
+    char *copy = strdup(path);
+    if (!copy) return;
+
+    int i = st->heap_count++;
+    st->heap[i] = (TopEntry){copy, size, files};
+    while (i > 0 && st->heap[(i - 1) / 2].size > st->heap[i].size) {
+        TopEntry tmp = st->heap[i];
+        st->heap[i] = st->heap[(i - 1) / 2];
+        st->heap[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+static void on_dir(void *user, const DirNode *node, const char *path, int depth)
+{
+    CliState *st = user;
+    DirSkip skip = node->skip;
+    SDL_LockMutex(st->lock);
+    st->dirs++;
+    if (skip != DIR_SCANNED) st->skipped++;
+
+    switch (st->format) {
+    case FORMAT_NDJSON:
+        fputs("{\"type\":\"dir\",\"path\":", stdout);
+        write_json_string(stdout, path);
+        printf(",\"size\":%llu,\"files\":%u,\"depth\":%d",
+               (unsigned long long)node->size, (unsigned)node->file_count, depth);
+        if (skip != DIR_SCANNED)
+            printf(",\"skipped\":\"%s\"", tree_skip_label(skip));
+        fputs("}\n", stdout);
+        break;
+    case FORMAT_CSV:
+        write_csv_field(stdout, path);
+        printf(",%llu,%u,%d,%s\n", (unsigned long long)node->size,
+               (unsigned)node->file_count, depth, tree_skip_label(skip));
+        break;
+    case FORMAT_SUMMARY:
+        if (depth > 0 && skip == DIR_SCANNED)
+            keep_top(st, node->size, node->file_count, path);
+        break;
+    }
+
+    // Followers of the stream see progress without a flush per line
+    uint64_t now = SDL_GetTicks();
+    if (st->format != FORMAT_SUMMARY && now - st->flushed_at >= FLUSH_MS) {
+        fflush(stdout);
+        st->flushed_at = now;
+    }
+    SDL_UnlockMutex(st->lock);
+}
+
+static int cmp_top_desc(const void *a, const void *b)
+{
+    const TopEntry *ea = a, *eb = b;
+    return (ea->size < eb->size) - (ea->size > eb->size);
+}
+
+static void print_top_files(const TopFiles *top)
+{
+    char buf[32];
+    if (top->dir) printf("\nLargest files in %s:\n", top->dir);
+    else printf("\nLargest files:\n");
+    for (uint32_t i = 0; i < top->count; i++)
+        printf("  %10s  %s\n", human_size(top->items[i].size, buf, sizeof(buf)),
+               top->items[i].path);
+}
+
+static void write_top_files_json(const TopFiles *top)
+{
+    for (uint32_t i = 0; i < top->count; i++) {
+        fputs("{\"type\":\"file\",\"path\":", stdout);
+        write_json_string(stdout, top->items[i].path);
+        printf(",\"size\":%llu,\"rank\":%u", (unsigned long long)top->items[i].size,
+               (unsigned)i + 1);
+        if (top->dir) {
+            fputs(",\"dir\":", stdout);
+            write_json_string(stdout, top->dir);
+        }
+        fputs("}\n", stdout);
+    }
+}
+
+static void print_summary(CliState *st, const ScanContext *ctx, const char *path,
+                          uint64_t size, uint32_t files, double seconds,
+                          double throttled)
+{
+    char buf[32];
+    printf("%s\n  %u files, %u directories, %s in %.1f s\n",
+           path, files, st->dirs, human_size(size, buf, sizeof(buf)), seconds);
+    if (st->skipped)
+        printf("  %u directories skipped\n", st->skipped);
+    if (throttled > 0)
+        printf("  workers held back for %.1f s in total\n", throttled);
+
+    if (st->heap_count > 0) {
+        qsort(st->heap, st->heap_count, sizeof(TopEntry), cmp_top_desc);
+        printf("\nLargest directories:\n");
+        for (int i = 0; i < st->heap_count; i++)
+            printf("  %10s  %9lld files  %s\n",
+                   human_size(st->heap[i].size, buf, sizeof(buf)),
+                   (long long)st->heap[i].files, st->heap[i].path);
+    }
+    if (ctx->top_files.count) print_top_files(&ctx->top_files);
+    for (uint32_t i = 0; i < ctx->dir_top_count; i++)
+        print_top_files(&ctx->dir_top_files[i]);
+}
+
+// Scans path and writes the result, the options already parsed
+static int run(const char *path, CliState *st, ScanOptions *opts)
+{
+    struct stat sb;
+    if (stat(path, &sb) != 0 || !S_ISDIR(sb.st_mode)) {
+        fprintf(stderr, "not a directory: %s\n", path);
+        return 1;
+    }
+
+    // "/data/" would otherwise come out as "/data//sub"
+    char root[4096];
+    snprintf(root, sizeof(root), "%s", path);
+    size_t len = strlen(root);
+    while (len > 1 && (root[len - 1] == '/' || root[len - 1] == '\\'))
+        root[--len] = '\0';
+
+    if (!SDL_Init(0)) {
+        fprintf(stderr, "SDL_Init: %s\n", SDL_GetError());
+        return 1;
+    }
+    st->lock = SDL_CreateMutex();
+    st->heap = st->top > 0 ? calloc(st->top, sizeof(TopEntry)) : NULL;
+    if (st->top > 0 && !st->heap) st->top = 0;
+
+    opts->on_dir = on_dir;
+    opts->user = st;
+    // A snapshot needs the whole tree
+    opts->prune = !st->save;
+    // The csv columns are a directory's
+    if (st->format == FORMAT_CSV) opts->top_files = 0;
+
+    if (st->format == FORMAT_CSV)
+        printf("path,size,files,depth,skipped\n");
+
+    int status = 0;
+    uint64_t started = SDL_GetTicksNS();
+    ScanContext *ctx = scanner_start_opts(root, opts);
+    if (!ctx) {
+        fprintf(stderr, "could not start scan\n");
+        status = 1;
+        goto done;
+    }
+    while (!atomic_load(&ctx->done))
+        SDL_Delay(20);
+    double seconds = (double)(SDL_GetTicksNS() - started) / 1e9;
+    uint64_t size = atomic_load(&ctx->total_size);
+    uint32_t files = atomic_load(&ctx->total_files);
+    double throttled = (double)atomic_load(&ctx->throttled_ns) / 1e9;
+    if (st->save && !snapshot_save(ctx, st->save)) {
+        fprintf(stderr, "could not save snapshot: %s\n", st->save);
+        status = 1;
+    }
+
+    if (st->format == FORMAT_NDJSON) {
+        write_top_files_json(&ctx->top_files);
+        for (uint32_t i = 0; i < ctx->dir_top_count; i++)
+            write_top_files_json(&ctx->dir_top_files[i]);
+        fputs("{\"type\":\"total\",\"path\":", stdout);
+        write_json_string(stdout, root);
+        printf(",\"size\":%llu,\"files\":%u,\"dirs\":%u,\"seconds\":%.3f,"
+               "\"throttled\":%.3f}\n",
+               (unsigned long long)size, files, st->dirs, seconds, throttled);
+    } else if (st->format == FORMAT_SUMMARY) {
+        print_summary(st, ctx, root, size, files, seconds, throttled);
+    }
+    scanner_free(ctx);
+
+done:
+    fflush(stdout);
+    for (int i = 0; i < st->heap_count; i++)
+        free(st->heap[i].path);
+    free(st->heap);
+    SDL_DestroyMutex(st->lock);
+    SDL_Quit();
+    return status;
+}
+
+// "+1.2 GB" or "-300 KB"
+static const char *human_delta(int64_t bytes, char *buf, size_t cap)
+{
+    char size[32];
+    uint64_t abs = bytes < 0 ? (uint64_t)-bytes : (uint64_t)bytes;
+    snprintf(buf, cap, "%c%s", bytes < 0 ? '-' : '+', human_size(abs, size, sizeof(size)));
+    return buf;
+}
+
+// Every changed directory below node; unchanged ones have no children
+static void report_changes(CliState *st, const DirNode *node, char *path,
+                           size_t len, size_t cap, int depth)
+{
+    uint32_t count = tree_child_count(node);
+    DirNode *children = tree_children(node);
+    // A root of "/" or "C:\" already ends in a separator
+    size_t at = len > 0 && path[len - 1] == PATH_SEP ? len : len + 1;
+    for (uint32_t i = 0; i < count; i++) {
+        const DirNode *child = &children[i];
+        if (!child->size_delta && !child->files_delta) continue;
+        size_t name_len = strlen(child->name);
+        if (at + name_len >= cap) continue;
+        path[len] = PATH_SEP;
+        memcpy(path + at, child->name, name_len + 1);
+
+        switch (st->format) {
+        case FORMAT_NDJSON:
+            fputs("{\"type\":\"diff\",\"path\":", stdout);
+            write_json_string(stdout, path);
+            printf(",\"size_delta\":%lld,\"files_delta\":%d,\"depth\":%d}\n",
+                   (long long)child->size_delta, (int)child->files_delta, depth);
+            break;
+        case FORMAT_CSV:
+            write_csv_field(stdout, path);
+            printf(",%lld,%d,%d\n", (long long)child->size_delta,
+                   (int)child->files_delta, depth);
+            break;
+        case FORMAT_SUMMARY:
+            if (child->size_delta > 0)
+                keep_top(st, (uint64_t)child->size_delta, child->files_delta, path);
+            break;
+        }
+        report_changes(st, child, path, at + name_len, cap, depth + 1);
+    }
+    path[len] = '\0';
+}
+
+// Compares two saved scans of the same place
+static int run_diff(const char *before_path, const char *after_path, CliState *st)
+{
+    if (!SDL_Init(0)) {
+        fprintf(stderr, "SDL_Init: %s\n", SDL_GetError());
+        return 1;
+    }
+    ScanContext *before = snapshot_open(before_path);
+    ScanContext *after = before ? snapshot_open(after_path) : NULL;
+    if (!after) {
+        fprintf(stderr, "not a readable snapshot: %s\n", before ? after_path : before_path);
+        scanner_free(before);
+        SDL_Quit();
+        return 1;
+    }
+
+    uint64_t started = SDL_GetTicksNS();
+    DirNode *diff = diff_trees(before->root, after->root);
+    double seconds = (double)(SDL_GetTicksNS() - started) / 1e9;
+    uint64_t old_size = before->root->size, new_size = after->root->size;
+    scanner_free(before);
+    scanner_free(after);
+    if (!diff) {
+        fprintf(stderr, "out of memory\n");
+        SDL_Quit();
+        return 1;
+    }
+
+    st->heap = st->top > 0 ? calloc(st->top, sizeof(TopEntry)) : NULL;
+    if (st->top > 0 && !st->heap) st->top = 0;
+    if (st->format == FORMAT_CSV)
+        printf("path,size_delta,files_delta,depth\n");
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s", diff->name);
+    report_changes(st, diff, path, strlen(path), sizeof(path), 0);
+
+    char buf[32], buf2[32];
+    if (st->format == FORMAT_NDJSON) {
+        fputs("{\"type\":\"total\",\"path\":", stdout);
+        write_json_string(stdout, diff->name);
+        printf(",\"size_delta\":%lld,\"files_delta\":%d,\"seconds\":%.3f}\n",
+               (long long)diff->size_delta, (int)diff->files_delta, seconds);
+    } else if (st->format == FORMAT_SUMMARY) {
+        printf("%s\n  %s -> %s (%s, %+d files), compared in %.1f s\n", diff->name,
+               human_size(old_size, buf, sizeof(buf)),
+               human_size(new_size, buf2, sizeof(buf2)),
+               human_delta(diff->size_delta, path, sizeof(path)),
+               (int)diff->files_delta, seconds);
+        qsort(st->heap, st->heap_count, sizeof(TopEntry), cmp_top_desc);
+        if (st->heap_count) printf("\nGrew most:\n");
+        for (int i = 0; i < st->heap_count; i++)
+            printf("  %10s  %+9lld files  %s\n",
+                   human_delta((int64_t)st->heap[i].size, buf, sizeof(buf)),
+                   (long long)st->heap[i].files, st->heap[i].path);
+    }
+    fflush(stdout);
+
+    for (int i = 0; i < st->heap_count; i++)
+        free(st->heap[i].path);
+    free(st->heap);
+    tree_free(diff);
+    SDL_Quit();
+    return 0;
+}
+
+int cli_main(int argc, char *argv[])
+{
+    const char *path = NULL, *before = NULL, *after = NULL;
+    CliState st = {.format = FORMAT_SUMMARY, .top = DEFAULT_TOP};
+    ScanOptions opts = {.top_files = DEFAULT_TOP};
+    ScanExclude *exclude = NULL;
+    int status = 2;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) {
+            usage(stdout);
+            status = 0;
+            goto out;
+        } else if (strcmp(arg, "--scan") == 0 && val) {
+            path = val;
+            i++;
+        } else if (strcmp(arg, "--diff") == 0 && val && i + 2 < argc) {
+            before = val;
+            after = argv[i + 2];
+            i += 2;
+        } else if (strcmp(arg, "--save") == 0 && val) {
+            st.save = val;
+            i++;
+        } else if (strcmp(arg, "--memory-budget") == 0 && val) {
+            opts.memory_budget = (size_t)strtoull(val, NULL, 10) << 20;
+            i++;
+        } else if (strcmp(arg, "--format") == 0 && val) {
+            if (strcmp(val, "summary") == 0) st.format = FORMAT_SUMMARY;
+            else if (strcmp(val, "ndjson") == 0) st.format = FORMAT_NDJSON;
+            else if (strcmp(val, "csv") == 0) st.format = FORMAT_CSV;
+            else {
+                fprintf(stderr, "unknown format: %s\n", val);
+                goto out;
+            }
+            i++;
+        } else if (strcmp(arg, "--top") == 0 && val) {
+            st.top = atoi(val);
+            i++;
+        } else if (strcmp(arg, "--top-files") == 0 && val) {
+            opts.top_files = (uint32_t)strtoul(val, NULL, 10);
+            i++;
+        } else if (strcmp(arg, "--top-files-per-dir") == 0) {
+            opts.top_files_per_dir = true;
+        } else if (strcmp(arg, "--threads") == 0 && val) {
+            opts.threads = atoi(val);
+            i++;
+        } else if (strcmp(arg, "--io-uring") == 0) {
+            opts.io_uring = true;
+        } else if (strcmp(arg, "--max-rate") == 0 && val) {
+            opts.max_stat_rate = (uint32_t)strtoul(val, NULL, 10);
+            i++;
+        } else if (strcmp(arg, "--max-open") == 0 && val) {
+            opts.max_open_dirs = atoi(val);
+            i++;
+        } else if (strcmp(arg, "--low-priority") == 0) {
+            opts.low_priority = true;
+        } else if (strcmp(arg, "--adaptive") == 0) {
+            opts.adaptive = true;
+        } else if (strcmp(arg, "--gentle") == 0) {
+            opts.low_priority = true;
+            opts.adaptive = true;
+            opts.max_open_dirs = GENTLE_MAX_OPEN;
+        } else if (strcmp(arg, "--one-file-system") == 0) {
+            opts.one_filesystem = true;
+        } else if (strcmp(arg, "--exclude") == 0 && val) {
+            if (!exclude) exclude = exclude_create();
+            if (!exclude || !exclude_add(exclude, val)) {
+                fprintf(stderr, "bad or too many exclude patterns: %s\n", val);
+                goto out;
+            }
+            i++;
+        } else {
+            usage(stderr);
+            goto out;
+        }
+    }
+    // A run either scans or compares two snapshots, never both
+    if (before && path) {
+        fprintf(stderr, "--scan and --diff can't be combined\n");
+        usage(stderr);
+        goto out;
+    }
+    if (before) {
+        status = run_diff(before, after, &st);
+        goto out;
+    }
+    if (!path) {
+        usage(stderr);
+        goto out;
+    }
+    opts.exclude = exclude;
+    status = run(path, &st, &opts);
+
+out:
+    exclude_free(exclude);
+    return status;
+}
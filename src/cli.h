@@ -0,0 +1,7 @@
+#pragma once
+#include <stdbool.h>
+
+// Headless mode: `zoomfolder --scan PATH [options]` runs the scanner without
+// a window or file dialog and writes the result to stdout.
+bool cli_requested(int argc, char *argv[]);
+int  cli_main(int argc, char *argv[]);
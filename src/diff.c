@@ -0,0 +1,121 @@
+#include "diff.h"
+#include "snapshot.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    DirNode *before, *after;
+} DiffPair;
+
+static uint64_t size_of(const DirNode *node)
+{
+    return node ? (uint64_t)node->size : 0;
+}
+
+static uint32_t files_of(const DirNode *node)
+{
+    return node ? (uint32_t)node->file_count : 0;
+}
+
+static void fill(DirNode *out, const DirNode *before, const DirNode *after)
+{
+    uint64_t old_size = size_of(before), new_size = size_of(after);
+    out->kind = NODE_DIFFED;
+    out->size = old_size > new_size ? old_size : new_size;
+    atomic_init(&out->display_size, (float)out->size);
+    out->file_count = files_of(after);
+    out->size_delta = (int64_t)new_size - (int64_t)old_size;
+    out->files_delta = (int32_t)files_of(after) - (int32_t)files_of(before);
+    out->skip = (after ? after : before)->skip;
+    out->complete = true;
+}
+
+// Pairs the children of before and after by name: after's in their order,
+// then those only before had. Names are looked up through before's block
+// index where it has one.
+static DiffPair *pair_children(DirNode *before, DirNode *after, uint32_t *count,
+                               size_t *name_bytes)
+{
+    uint32_t old_count = before ? tree_child_count(before) : 0;
+    uint32_t new_count = after ? tree_child_count(after) : 0;
+    DiffPair *pairs = malloc(((size_t)old_count + new_count + 1) * sizeof(DiffPair));
+    bool *matched = old_count ? calloc(old_count, sizeof(bool)) : NULL;
+    if (!pairs || (old_count && !matched)) {
+        free(pairs);
+        free(matched);
+        return NULL;
+    }
+
+    uint32_t n = 0;
+    size_t bytes = 0;
+    DirNode *old_children = old_count ? tree_children(before) : NULL;
+    DirNode *new_children = new_count ? tree_children(after) : NULL;
+    for (uint32_t i = 0; i < new_count; i++) {
+        DirNode *old = old_count ? tree_find_child(before, new_children[i].name) : NULL;
+        if (old) matched[old - old_children] = true;
+        pairs[n++] = (DiffPair){old, &new_children[i]};
+        bytes += strlen(new_children[i].name) + 1;
+    }
+    for (uint32_t i = 0; i < old_count; i++) {
+        if (matched[i]) continue;
+        pairs[n++] = (DiffPair){&old_children[i], NULL};
+        bytes += strlen(old_children[i].name) + 1;
+    }
+    free(matched);
+    *count = n;
+    *name_bytes = bytes;
+    return pairs;
+}
+
+// Children go in first and are descended into after, since adding one may
+// move its siblings
+static bool diff_into(DirNode *out, DirNode *before, DirNode *after)
+{
+    fill(out, before, after);
+    if (before && after && before->size == after->size &&
+        before->file_count == after->file_count)
+        return true;
+
+    if (before) snapshot_ensure(before);
+    if (after) snapshot_ensure(after);
+    uint32_t count;
+    size_t name_bytes;
+    DiffPair *pairs = pair_children(before, after, &count, &name_bytes);
+    if (!pairs) return false;
+    if (count) tree_reserve_children(out, count, name_bytes);
+
+    bool ok = true;
+    for (uint32_t i = 0; i < count && ok; i++) {
+        DiffPair *p = &pairs[i];
+        ok = tree_add_child(out, (p->after ? p->after : p->before)->name) != NULL;
+    }
+
+    // Removed directories can make the children outgrow either side's total
+    uint64_t children_size = 0;
+    DirNode *children = tree_children(out);
+    for (uint32_t i = 0; i < count && ok; i++) {
+        ok = diff_into(&children[i], pairs[i].before, pairs[i].after);
+        children_size += children[i].size;
+        if (children[i].skip != DIR_SCANNED) out->placeholders++;
+    }
+    free(pairs);
+    if (children_size > out->size) {
+        out->size = children_size;
+        atomic_init(&out->display_size, (float)children_size);
+    }
+    tree_sort_children(out);
+    return ok;
+}
+
+DirNode *diff_trees(DirNode *before, DirNode *after)
+{
+    if (!before || !after) return NULL;
+    DirNode *root = tree_create(after->name);
+    if (!root) return NULL;
+    if (!diff_into(root, before, after)) {
+        tree_free(root);
+        return NULL;
+    }
+    tree_repack(root);
+    return root;
+}
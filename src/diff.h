@@ -0,0 +1,15 @@
+#pragma once
+#include "tree.h"
+
+// What changed between two scans of the same place, as a tree of its own.
+// Directories are paired by name level by level. Each node of the result
+// is NODE_DIFFED and holds after-minus-before deltas; its size is the
+// larger of the two, so removed directories keep their width, and its file
+// count is the one from after.
+//
+// A pair with the same size and file count is taken as unchanged and not
+// descended into, so the result's size follows what changed rather than
+// the trees. Levels of a tree opened from a snapshot are only expanded
+// where that isn't the case. Both trees must be finished and have no other
+// writer; the result shares nothing with them.
+DirNode *diff_trees(DirNode *before, DirNode *after);
@@ -0,0 +1,153 @@
+#include "exclude.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Each pattern takes one state per component plus one past its end. A
+// state is set when everything before its component has matched.
+struct ScanExclude {
+    int       count;
+    char     *glob[EXCLUDE_MAX_STATES];   // NULL for ** and past the end
+    uint64_t  any_depth;                    // states whose component is **
+    uint64_t  accept;                       // states past the end
+    uint64_t  start;                        // first state of every pattern
+};
+
+static bool is_sep(char c)
+{
+#ifdef _WIN32
+    return c == '/' || c == '\\';
+#else
+    return c == '/';
+#endif
+}
+
+// `*` and `?` only; a name never contains a separator
+static bool glob_match(const char *p, const char *s)
+{
+    const char *star = NULL, *resume = NULL;
+    while (*s) {
+        if (*p == '*') {
+            star = p++;
+            resume = s;
+        } else if (*p == '?' || *p == *s) {
+            p++;
+            s++;
+        } else if (star) {
+            p = star + 1;
+            s = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (*p == '*') p++;
+    return *p == '\0';
+}
+
+// ** may also match nothing, so the state after it is set along with it
+static uint64_t closure(const ScanExclude *ex, uint64_t state)
+{
+    for (int k = 0; k < ex->count - 1; k++) {
+        if ((state >> k & 1) && (ex->any_depth >> k & 1))
+            state |= 1ULL << (k + 1);
+    }
+    return state;
+}
+
+ScanExclude *exclude_create(void)
+{
+    return calloc(1, sizeof(ScanExclude));
+}
+
+bool exclude_add(ScanExclude *ex, const char *pattern)
+{
+    bool anchored = is_sep(pattern[0]);
+    bool leading_any = !anchored &&
+        !(strncmp(pattern, "**", 2) == 0 && (!pattern[2] || is_sep(pattern[2])));
+
+    // Added whole or not at all
+    int k = ex->count;
+    uint64_t any_depth = 0;
+    if (leading_any) {
+        if (k + 2 >= EXCLUDE_MAX_STATES) return false;
+        any_depth |= 1ULL << k++;
+    }
+    for (const char *p = pattern; *p;) {
+        while (is_sep(*p)) p++;
+        if (!*p) break;
+        const char *end = p;
+        while (*end && !is_sep(*end)) end++;
+        size_t len = (size_t)(end - p);
+        p = end;
+
+        if (k + 1 >= EXCLUDE_MAX_STATES) goto fail;
+        if (len == 2 && end[-2] == '*' && end[-1] == '*') {
+            any_depth |= 1ULL << k++;
+            continue;
+        }
+        char *glob = malloc(len + 1);
+        if (!glob) goto fail;
+        memcpy(glob, end - len, len);
+        glob[len] = '\0';
+        ex->glob[k++] = glob;
+    }
+    if (k == ex->count + (leading_any ? 1 : 0)) goto fail;
+
+    ex->start |= 1ULL << ex->count;
+    ex->any_depth |= any_depth;
+    ex->accept |= 1ULL << k;
+    ex->count = k + 1;
+    return true;
+
+fail:
+    for (int i = ex->count; i < k; i++) {
+        free(ex->glob[i]);
+        ex->glob[i] = NULL;
+    }
+    return false;
+}
+
+void exclude_free(ScanExclude *ex)
+{
+    if (!ex) return;
+    for (int i = 0; i < ex->count; i++)
+        free(ex->glob[i]);
+    free(ex);
+}
+
+uint64_t exclude_start(const ScanExclude *ex, const char *path)
+{
+    if (!ex) return 0;
+    uint64_t state = closure(ex, ex->start);
+    char name[256];
+    for (const char *p = path; *p && state;) {
+        while (is_sep(*p)) p++;
+        if (!*p) break;
+        size_t len = 0;
+        while (p[len] && !is_sep(p[len])) len++;
+        if (len >= sizeof(name)) len = sizeof(name) - 1;
+        memcpy(name, p, len);
+        name[len] = '\0';
+        state = exclude_step(ex, state, name);
+        while (*p && !is_sep(*p)) p++;
+    }
+    // Scanning inside an excluded directory on purpose scans all of it
+    return state & ~ex->accept;
+}
+
+uint64_t exclude_step(const ScanExclude *ex, uint64_t state, const char *name)
+{
+    uint64_t next = 0;
+    for (int k = 0; k < ex->count && state >> k; k++) {
+        if (!(state >> k & 1) || (ex->accept >> k & 1)) continue;
+        if (ex->any_depth >> k & 1)
+            next |= 1ULL << k;
+        else if (glob_match(ex->glob[k], name))
+            next |= 1ULL << (k + 1);
+    }
+    return closure(ex, next);
+}
+
+bool exclude_matched(const ScanExclude *ex, uint64_t state)
+{
+    return (state & ex->accept) != 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Directories the scanner leaves out, given as glob patterns over path
+// components: `*` and `?` match within a name, `**` matches any number of
+// whole components. A pattern starting with `/` is anchored at the
+// filesystem root (`/proc`); any other is matched at every depth
+// (`node_modules`, `**/node_modules` and `.git/objects` all are).
+//
+// Patterns compile to a small NFA whose state fits in 64 bits, so every
+// directory carries its parent's state and a name is checked by one step
+// without allocating.
+
+typedef struct ScanExclude ScanExclude;
+
+#define EXCLUDE_MAX_STATES 64
+
+ScanExclude *exclude_create(void);
+// False if the pattern is empty or the states would exceed EXCLUDE_MAX_STATES
+bool         exclude_add(ScanExclude *ex, const char *pattern);
+void         exclude_free(ScanExclude *ex);
+
+// State of the scan root, found by stepping through each component of path
+uint64_t     exclude_start(const ScanExclude *ex, const char *path);
+uint64_t     exclude_step(const ScanExclude *ex, uint64_t state, const char *name);
+bool         exclude_matched(const ScanExclude *ex, uint64_t state);
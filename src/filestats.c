@@ -0,0 +1,100 @@
+#include "filestats.h"
+#include <string.h>
+
+int filestats_bin(uint64_t size)
+{
+    int bin = 0;
+    while (size && bin < FILESTATS_BINS - 1) {
+        size >>= 1;
+        bin++;
+    }
+    return bin;
+}
+
+uint64_t filestats_bin_floor(int bin)
+{
+    return bin > 0 ? (uint64_t)1 << (bin - 1) : 0;
+}
+
+// Hidden files and names ending in a dot have none
+static void ext_of(const char *name, char out[FILESTATS_EXT_LEN])
+{
+    out[0] = '\0';
+    const char *dot = strrchr(name, '.');
+    if (!dot || dot == name || !dot[1]) return;
+    size_t len = strlen(dot + 1);
+    if (len >= FILESTATS_EXT_LEN) return;
+    for (size_t i = 0; i <= len; i++) {
+        char c = dot[1 + i];
+        out[i] = c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+    }
+}
+
+// Moves exts[i] up past the entries with fewer bytes
+static void raise_ext(FileStats *stats, int i)
+{
+    while (i > 0 && stats->exts[i - 1].bytes < stats->exts[i].bytes) {
+        FileExt tmp = stats->exts[i - 1];
+        stats->exts[i - 1] = stats->exts[i];
+        stats->exts[i] = tmp;
+        i--;
+    }
+}
+
+static void add_ext(FileStats *stats, const char *name, uint32_t files, uint64_t bytes)
+{
+    int i = 0;
+    while (i < FILESTATS_EXTS && stats->exts[i].files &&
+           strcmp(stats->exts[i].name, name) != 0)
+        i++;
+
+    if (i == FILESTATS_EXTS) {
+        FileExt *last = &stats->exts[FILESTATS_EXTS - 1];
+        if (bytes <= last->bytes) {
+            stats->other_bytes += bytes;
+            stats->other_files += files;
+            return;
+        }
+        stats->other_bytes += last->bytes;
+        stats->other_files += last->files;
+        memset(last, 0, sizeof(*last));
+        i = FILESTATS_EXTS - 1;
+    }
+    FileExt *ext = &stats->exts[i];
+    if (!ext->files) memcpy(ext->name, name, FILESTATS_EXT_LEN);
+    ext->files += files;
+    ext->bytes += bytes;
+    raise_ext(stats, i);
+}
+
+void filestats_add(FileStats *stats, const char *name, uint64_t size)
+{
+    char ext[FILESTATS_EXT_LEN];
+    ext_of(name, ext);
+    add_ext(stats, ext, 1, size);
+    stats->bins[filestats_bin(size)]++;
+}
+
+void filestats_merge(FileStats *dst, const FileStats *src)
+{
+    for (int i = 0; i < FILESTATS_EXTS && src->exts[i].files; i++)
+        add_ext(dst, src->exts[i].name, src->exts[i].files, src->exts[i].bytes);
+    dst->other_bytes += src->other_bytes;
+    dst->other_files += src->other_files;
+    for (int i = 0; i < FILESTATS_BINS; i++)
+        dst->bins[i] += src->bins[i];
+}
+
+bool filestats_equal(const FileStats *a, const FileStats *b)
+{
+    if (a->other_bytes != b->other_bytes || a->other_files != b->other_files ||
+        memcmp(a->bins, b->bins, sizeof(a->bins)) != 0)
+        return false;
+    for (int i = 0; i < FILESTATS_EXTS; i++) {
+        const FileExt *x = &a->exts[i], *y = &b->exts[i];
+        if (x->files != y->files || x->bytes != y->bytes ||
+            (x->files && strcmp(x->name, y->name) != 0))
+            return false;
+    }
+    return true;
+}
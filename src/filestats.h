@@ -0,0 +1,40 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// What a directory's files are, in a fixed size: the extensions taking the
+// most bytes and a count of files per power-of-two size. The scanner fills
+// one per directory as it lists it and merges each into its parent's as it
+// completes, the way sizes are totalled.
+//
+// Extensions that don't fit are lumped together. A newcomer only takes the
+// place of the smallest listed one if it has more bytes itself, so the list
+// is exact for extensions that dominate and approximate below them.
+
+#define FILESTATS_EXTS     6
+#define FILESTATS_EXT_LEN  12       // terminator included; longer ones count as none
+#define FILESTATS_BINS     32
+
+typedef struct {
+    char     name[FILESTATS_EXT_LEN];   // lowercase, without the dot; "" for none
+    uint32_t files;                     // 0 for an unused entry
+    uint64_t bytes;
+} FileExt;
+
+typedef struct FileStats {
+    FileExt  exts[FILESTATS_EXTS];      // most bytes first
+    uint64_t other_bytes;               // in extensions not listed
+    uint32_t other_files;
+    // Bin 0 counts empty files, bin n those of [2^(n-1), 2^n) bytes and the
+    // last one everything larger too
+    uint32_t bins[FILESTATS_BINS];
+} FileStats;
+
+void     filestats_add(FileStats *stats, const char *name, uint64_t size);
+void     filestats_merge(FileStats *dst, const FileStats *src);
+// Same counts in the same places. Merged in another order, equal stats may
+// list extensions differently and compare unequal.
+bool     filestats_equal(const FileStats *a, const FileStats *b);
+int      filestats_bin(uint64_t size);
+// Smallest size in a bin, for labels
+uint64_t filestats_bin_floor(int bin);
@@ -1,4 +1,6 @@
 #include "font_cache.h"
+#include "geometry.h"
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,11 +12,38 @@ typedef struct CacheEntry {
     uint32_t     last_used;
 } CacheEntry;
 
+// Glyphs are packed into the atlas in shelves, rows as tall as their
+// tallest glyph, with a pixel between them so filtering doesn't bleed. When
+// it or the table fills up, both start over.
+#define ATLAS_SIZE   1024
+#define ATLAS_PAD    1
+#define GLYPH_BITS   12
+#define GLYPH_SLOTS  (1u << GLYPH_BITS)     // kept at most 3/4 full
+#define LABEL_GLYPHS 512        // of one text; the rest is cut off
+#define ELLIPSIS     0x2026     // or three periods in a font without one
+
+typedef struct {
+    uint32_t codepoint;         // 0 for an empty slot
+    SDL_FRect uv;               // in the atlas, 0 to 1
+    float     w, h;
+    float     offset_x;         // from the pen to the glyph's left edge
+    float     advance;
+} Glyph;
+
 struct FontCache {
     CacheEntry *entries;
     int         capacity;
     int         count;
     uint32_t    tick;
+
+    SDL_Texture  *atlas;
+    TTF_Font     *atlas_font;
+    Glyph        *glyphs;       // open addressing by codepoint
+    uint32_t      glyph_count;
+    int           shelf_x, shelf_y, shelf_h;
+    GeometryBatch text;
+    FontFlushFn   before_flush;
+    void         *flush_user;
 };
 
 FontCache *font_cache_create(int capacity)
@@ -108,10 +137,233 @@ void font_cache_clear(FontCache *cache)
     cache->tick = 0;
 }
 
+static void atlas_reset(FontCache *c)
+{
+    if (c->glyphs) memset(c->glyphs, 0, GLYPH_SLOTS * sizeof(Glyph));
+    c->glyph_count = 0;
+    c->shelf_x = c->shelf_y = c->shelf_h = 0;
+}
+
+// Room for a w by h glyph, false if the atlas is full
+static bool atlas_place(FontCache *c, int w, int h, int *x, int *y)
+{
+    if (c->shelf_x + w > ATLAS_SIZE) {
+        c->shelf_y += c->shelf_h + ATLAS_PAD;
+        c->shelf_x = 0;
+        c->shelf_h = 0;
+    }
+    if (w > ATLAS_SIZE || c->shelf_y + h > ATLAS_SIZE) return false;
+    *x = c->shelf_x;
+    *y = c->shelf_y;
+    c->shelf_x += w + ATLAS_PAD;
+    if (h > c->shelf_h) c->shelf_h = h;
+    return true;
+}
+
+static uint32_t glyph_hash(uint32_t cp)
+{
+    return (cp * 0x9E3779B1u) >> (32 - GLYPH_BITS);
+}
+
+// Renders a glyph white into the atlas; vertex colors tint it. NULL if it
+// couldn't be, with full set if that was for lack of room. Blank ones take
+// no room and only advance the pen.
+static Glyph *glyph_add(FontCache *c, TTF_Font *font, Glyph *slot, uint32_t cp,
+                        bool *full)
+{
+    int minx, maxx, miny, maxy, advance;
+    if (!TTF_GetGlyphMetrics(font, cp, &minx, &maxx, &miny, &maxy, &advance))
+        return NULL;
+    // A glyph reaching left of the pen is rendered shifted right by as much
+    *slot = (Glyph){
+        .codepoint = cp,
+        .offset_x = minx < 0 ? (float)minx : 0,
+        .advance = (float)advance,
+    };
+
+    SDL_Surface *surf = TTF_RenderGlyph_Blended(font, cp, (SDL_Color){255, 255, 255, 255});
+    if (surf && surf->format != SDL_PIXELFORMAT_ARGB8888) {
+        SDL_Surface *conv = SDL_ConvertSurface(surf, SDL_PIXELFORMAT_ARGB8888);
+        SDL_DestroySurface(surf);
+        surf = conv;
+    }
+    if (surf && surf->w > 0 && surf->h > 0) {
+        int x, y;
+        if (!atlas_place(c, surf->w, surf->h, &x, &y)) {
+            SDL_DestroySurface(surf);
+            *slot = (Glyph){0};
+            *full = true;
+            return NULL;
+        }
+        SDL_Rect dst = {x, y, surf->w, surf->h};
+        SDL_UpdateTexture(c->atlas, &dst, surf->pixels, surf->pitch);
+        slot->uv = (SDL_FRect){(float)x / ATLAS_SIZE, (float)y / ATLAS_SIZE,
+                               (float)surf->w / ATLAS_SIZE, (float)surf->h / ATLAS_SIZE};
+        slot->w = (float)surf->w;
+        slot->h = (float)surf->h;
+    }
+    SDL_DestroySurface(surf);
+    c->glyph_count++;
+    return slot;
+}
+
+static Glyph *glyph_get(FontCache *c, TTF_Font *font, uint32_t cp, bool *full)
+{
+    uint32_t i = glyph_hash(cp);
+    while (c->glyphs[i].codepoint) {
+        if (c->glyphs[i].codepoint == cp) return &c->glyphs[i];
+        i = (i + 1) & (GLYPH_SLOTS - 1);
+    }
+    if (c->glyph_count >= GLYPH_SLOTS / 4 * 3) {
+        *full = true;
+        return NULL;
+    }
+    return glyph_add(c, font, &c->glyphs[i], cp, full);
+}
+
+// Next code point of UTF-8 text, U+FFFD for a malformed sequence
+static uint32_t next_codepoint(const char **text)
+{
+    const unsigned char *s = (const unsigned char *)*text;
+    uint32_t cp;
+    int extra;
+    if (s[0] < 0x80) { cp = s[0]; extra = 0; }
+    else if ((s[0] & 0xE0) == 0xC0) { cp = s[0] & 0x1F; extra = 1; }
+    else if ((s[0] & 0xF0) == 0xE0) { cp = s[0] & 0x0F; extra = 2; }
+    else if ((s[0] & 0xF8) == 0xF0) { cp = s[0] & 0x07; extra = 3; }
+    else { *text += 1; return 0xFFFD; }
+    for (int i = 1; i <= extra; i++) {
+        if ((s[i] & 0xC0) != 0x80) {
+            *text += i;
+            return 0xFFFD;
+        }
+        cp = cp << 6 | (s[i] & 0x3F);
+    }
+    *text += 1 + extra;
+    return cp;
+}
+
+typedef struct {
+    const Glyph *glyph;
+    float        pen;
+} PlacedGlyph;
+
+// Lays text out from pen 0, returning how many glyphs it took and the width
+// in end; false if the atlas filled up on the way
+static bool layout_text(FontCache *c, TTF_Font *font, const char *text,
+                        PlacedGlyph *out, int *count, float *end)
+{
+    float pen = 0;
+    uint32_t prev = 0;
+    int n = 0;
+    bool full = false;
+    while (*text && n < LABEL_GLYPHS) {
+        uint32_t cp = next_codepoint(&text);
+        const Glyph *g = glyph_get(c, font, cp, &full);
+        if (full) return false;
+        if (!g) continue;
+        int kerning = 0;
+        if (prev && TTF_GetGlyphKerning(font, prev, cp, &kerning)) pen += (float)kerning;
+        out[n++] = (PlacedGlyph){g, pen};
+        pen += g->advance;
+        prev = cp;
+    }
+    *count = n;
+    *end = pen;
+    return true;
+}
+
+static bool atlas_ready(FontCache *c, SDL_Renderer *r, TTF_Font *font)
+{
+    if (!c->glyphs) {
+        c->glyphs = calloc(GLYPH_SLOTS, sizeof(Glyph));
+        if (!c->glyphs) return false;
+    }
+    if (!c->atlas) {
+        c->atlas = SDL_CreateTexture(r, SDL_PIXELFORMAT_ARGB8888,
+                                     SDL_TEXTUREACCESS_STATIC, ATLAS_SIZE, ATLAS_SIZE);
+        if (!c->atlas) return false;
+        SDL_SetTextureBlendMode(c->atlas, SDL_BLENDMODE_BLEND);
+        atlas_reset(c);
+    }
+    if (font != c->atlas_font) {
+        atlas_reset(c);
+        c->atlas_font = font;
+    }
+    return true;
+}
+
+void font_cache_queue_text(FontCache *cache, SDL_Renderer *r, TTF_Font *font,
+                           const char *text, SDL_Color color, float x, float y,
+                           float max_w)
+{
+    if (!cache || !font || !text || !*text || max_w <= 0) return;
+    if (!atlas_ready(cache, r, font)) return;
+
+    // A full atlas starts over once what already uses it is drawn
+    PlacedGlyph placed[LABEL_GLYPHS + 3];
+    int count;
+    float width;
+    if (!layout_text(cache, font, text, placed, &count, &width)) {
+        font_cache_flush_text(cache, r);
+        atlas_reset(cache);
+        if (!layout_text(cache, font, text, placed, &count, &width)) return;
+    }
+
+    // Too wide, as many glyphs as fit with the ellipsis after them
+    if (width > max_w) {
+        bool full = false;
+        bool single = TTF_FontHasGlyph(font, ELLIPSIS);
+        const Glyph *dot = glyph_get(cache, font, single ? ELLIPSIS : '.', &full);
+        if (!dot) return;
+        int dots = single ? 1 : 3;
+        float dots_w = dot->advance * (float)dots;
+        while (count > 0 &&
+               (placed[count - 1].pen + placed[count - 1].glyph->advance + dots_w > max_w ||
+                placed[count - 1].glyph->codepoint == ' '))
+            count--;
+        if (count == 0 && dots_w > max_w) return;
+        float pen = count ? placed[count - 1].pen + placed[count - 1].glyph->advance : 0;
+        for (int i = 0; i < dots; i++)
+            placed[count++] = (PlacedGlyph){dot, pen + dot->advance * (float)i};
+    }
+
+    // Whole pixels, so glyphs are sampled texel for texel
+    x = floorf(x + 0.5f);
+    y = floorf(y + 0.5f);
+    for (int i = 0; i < count; i++) {
+        const Glyph *g = placed[i].glyph;
+        if (g->w == 0) continue;
+        SDL_FRect dst = {x + placed[i].pen + g->offset_x, y, g->w, g->h};
+        if (!geometry_quad(&cache->text, &dst, &g->uv, color)) {
+            font_cache_flush_text(cache, r);
+            geometry_quad(&cache->text, &dst, &g->uv, color);
+        }
+    }
+}
+
+void font_cache_flush_text(FontCache *cache, SDL_Renderer *r)
+{
+    if (!cache) return;
+    if (cache->before_flush && cache->text.index_count)
+        cache->before_flush(r, cache->flush_user);
+    geometry_flush(&cache->text, r, cache->atlas);
+}
+
+void font_cache_set_flush_hook(FontCache *cache, FontFlushFn fn, void *user)
+{
+    if (!cache) return;
+    cache->before_flush = fn;
+    cache->flush_user = user;
+}
+
 void font_cache_free(FontCache *cache)
 {
     if (!cache) return;
     font_cache_clear(cache);
     free(cache->entries);
+    if (cache->atlas) SDL_DestroyTexture(cache->atlas);
+    free(cache->glyphs);
+    geometry_free(&cache->text);
     free(cache);
 }
@@ -9,4 +9,17 @@ SDL_Texture *font_cache_get(FontCache *cache, SDL_Renderer *r,
                             TTF_Font *font, const char *text,
                             SDL_Color color, int *w, int *h);
 void         font_cache_clear(FontCache *cache);
+
+// Labels that change as sizes do are drawn from a glyph atlas instead: each
+// glyph is rendered once into a shared texture, and a text is a run of
+// quads queued until font_cache_flush_text draws them all in one call. Text
+// wider than max_w is cut short with an ellipsis.
+void         font_cache_queue_text(FontCache *cache, SDL_Renderer *r,
+                                   TTF_Font *font, const char *text,
+                                   SDL_Color color, float x, float y, float max_w);
+void         font_cache_flush_text(FontCache *cache, SDL_Renderer *r);
+// Called before any queued text is drawn, including when a full atlas or
+// batch makes it go out mid-frame, to draw first what belongs beneath it
+typedef void (*FontFlushFn)(SDL_Renderer *r, void *user);
+void         font_cache_set_flush_hook(FontCache *cache, FontFlushFn fn, void *user);
 void         font_cache_free(FontCache *cache);
@@ -0,0 +1,63 @@
+#include "geometry.h"
+#include <stdlib.h>
+
+static bool reserve(GeometryBatch *b, int verts, int indices)
+{
+    if (b->vert_count + verts > b->vert_cap) {
+        int cap = b->vert_cap ? b->vert_cap * 2 : 4096;
+        SDL_Vertex *v = realloc(b->verts, (size_t)cap * sizeof(SDL_Vertex));
+        if (!v) return false;
+        b->verts = v;
+        b->vert_cap = cap;
+    }
+    if (b->index_count + indices > b->index_cap) {
+        int cap = b->index_cap ? b->index_cap * 2 : 6144;
+        int *idx = realloc(b->indices, (size_t)cap * sizeof(int));
+        if (!idx) return false;
+        b->indices = idx;
+        b->index_cap = cap;
+    }
+    return true;
+}
+
+bool geometry_quad(GeometryBatch *b, const SDL_FRect *dst, const SDL_FRect *uv,
+                   SDL_Color color)
+{
+    if (!reserve(b, 4, 6)) return false;
+    SDL_FColor c = {color.r / 255.0f, color.g / 255.0f, color.b / 255.0f,
+                    color.a / 255.0f};
+    SDL_FRect t = uv ? *uv : (SDL_FRect){0, 0, 0, 0};
+    SDL_Vertex *v = &b->verts[b->vert_count];
+    v[0] = (SDL_Vertex){{dst->x, dst->y}, c, {t.x, t.y}};
+    v[1] = (SDL_Vertex){{dst->x + dst->w, dst->y}, c, {t.x + t.w, t.y}};
+    v[2] = (SDL_Vertex){{dst->x + dst->w, dst->y + dst->h}, c, {t.x + t.w, t.y + t.h}};
+    v[3] = (SDL_Vertex){{dst->x, dst->y + dst->h}, c, {t.x, t.y + t.h}};
+
+    // Two triangles sharing the diagonal
+    int *i = &b->indices[b->index_count];
+    int base = b->vert_count;
+    i[0] = base;
+    i[1] = base + 1;
+    i[2] = base + 2;
+    i[3] = base;
+    i[4] = base + 2;
+    i[5] = base + 3;
+    b->vert_count += 4;
+    b->index_count += 6;
+    return true;
+}
+
+void geometry_flush(GeometryBatch *b, SDL_Renderer *r, SDL_Texture *texture)
+{
+    if (b->index_count)
+        SDL_RenderGeometry(r, texture, b->verts, b->vert_count,
+                           b->indices, b->index_count);
+    b->vert_count = b->index_count = 0;
+}
+
+void geometry_free(GeometryBatch *b)
+{
+    free(b->verts);
+    free(b->indices);
+    *b = (GeometryBatch){0};
+}
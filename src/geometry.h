@@ -0,0 +1,19 @@
+#pragma once
+#include <SDL3/SDL.h>
+
+// Quads queued for a single SDL_RenderGeometry call, each with its own
+// color and, when drawn from a texture, coordinates in it. The buffers grow
+// as needed and are kept from one flush to the next.
+typedef struct {
+    SDL_Vertex *verts;
+    int        *indices;
+    int         vert_count, vert_cap;
+    int         index_count, index_cap;
+} GeometryBatch;
+
+// uv is the part of the texture, from 0 to 1, or NULL for none. False if
+// the buffers couldn't grow.
+bool geometry_quad(GeometryBatch *b, const SDL_FRect *dst, const SDL_FRect *uv,
+                   SDL_Color color);
+void geometry_flush(GeometryBatch *b, SDL_Renderer *r, SDL_Texture *texture);
+void geometry_free(GeometryBatch *b);
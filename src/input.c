@@ -3,6 +3,7 @@
 #define ZOOM_SPEED 0.1f
 #define ZOOM_MIN 1.0f
 #define ZOOM_MAX 100.0f
+#define FOCUS_MARGIN 48.0f     // pixels left above a focused row
 
 static bool dragging = false;
 
@@ -56,3 +57,14 @@ void input_handle(SDL_Event *event, Camera *cam, int window_w, int window_h)
         break;
     }
 }
+
+void input_focus(Camera *cam, float x, float y, float w, int window_w)
+{
+    float zoom = w > 0 ? (float)window_w / w : ZOOM_MAX;
+    if (zoom < ZOOM_MIN) zoom = ZOOM_MIN;
+    if (zoom > ZOOM_MAX) zoom = ZOOM_MAX;
+    cam->target_zoom = zoom;
+    cam->target_offset_x = ((float)window_w / zoom - w) / 2 - x;
+    cam->target_offset_y = FOCUS_MARGIN / zoom - y;
+    clamp_camera(cam, window_w);
+}
@@ -3,3 +3,5 @@
 #include "renderer.h"
 
 void input_handle(SDL_Event *event, Camera *cam, int window_w, int window_h);
+// Zooms to fit the span x..x+w of the unzoomed layout, row y near the top
+void input_focus(Camera *cam, float x, float y, float w, int window_w);
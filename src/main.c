@@ -3,22 +3,157 @@
 #include <SDL3_ttf/SDL_ttf.h>
 #include <nfd.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "tree.h"
 #include "scanner.h"
+#include "watcher.h"
+#include "snapshot.h"
+#include "diff.h"
 #include "renderer.h"
 #include "input.h"
 #include "font_cache.h"
+#include "cli.h"
+
+#define TOP_FILES 100
+#define SEARCH_RESULTS 1024     // matches kept to jump between
+#define MEMORY_SHARE 4          // scans keep to this fraction of system memory
+#define EXPAND_MIN_SHARE 0.25f  // of the window a collapsed directory takes to be listed again
 
 typedef enum { STATE_WELCOME, STATE_SCANNING, STATE_VIEWING } AppState;
 
-static void open_folder(ScanContext **scan, Camera *cam, AppState *state,
+typedef struct {
+    bool     active;
+    char     query[128];
+    uint32_t results[SEARCH_RESULTS];
+    uint32_t count, total;
+    uint32_t current;           // 1-based, 0 before the first jump
+} SearchState;
+
+typedef struct {
+    ScanContext *ctx;           // a collapsed directory being listed again
+    uint32_t     started_in;    // the scan generation it was started for
+    uint32_t     generation;    // bumped each time the view's scan is replaced
+} Expansion;
+
+// The view's scan is about to be replaced, and what was being listed
+// again for it goes first
+static void expansion_drop(Expansion *expansion)
+{
+    scanner_free(expansion->ctx);
+    expansion->ctx = NULL;
+    expansion->generation++;
+}
+
+static void search_close(SearchState *search, SDL_Window *window)
+{
+    search->active = false;
+    search->query[0] = '\0';
+    search->count = search->total = search->current = 0;
+    renderer_set_highlight(NULL);
+    SDL_StopTextInput(window);
+}
+
+static void search_update(SearchState *search, ScanContext *scan)
+{
+    search->count = search_find(scan->search, search->query, search->results,
+                                SEARCH_RESULTS, &search->total);
+    search->current = 0;
+    renderer_set_highlight(search->query);
+}
+
+// Moves on to the next match that still exists
+static void search_jump(SearchState *search, ScanContext *scan, Camera *cam,
+                        int window_w)
+{
+    tree_read_begin();
+    for (uint32_t tries = 0; tries < search->count; tries++) {
+        uint32_t i = search->current % search->count;
+        search->current = i + 1;
+        DirNode *node = search_resolve(scan->search, scan->root, search->results[i]);
+        float x, y, w;
+        if (node && renderer_locate(scan->root, node, window_w, &x, &y, &w)) {
+            input_focus(cam, x, y, w, window_w);
+            break;
+        }
+    }
+    tree_read_end();
+}
+
+// Takes the keyboard while the search bar is open
+static bool search_event(SearchState *search, ScanContext *scan, Camera *cam,
+                         SDL_Window *window, const SDL_Event *event, int window_w)
+{
+    if (event->type == SDL_EVENT_TEXT_INPUT) {
+        size_t len = strlen(search->query);
+        snprintf(search->query + len, sizeof(search->query) - len, "%s",
+                 event->text.text);
+        search_update(search, scan);
+        return true;
+    }
+    if (event->type != SDL_EVENT_KEY_DOWN) return false;
+
+    switch (event->key.key) {
+    case SDLK_ESCAPE:
+        search_close(search, window);
+        break;
+    case SDLK_BACKSPACE: {
+        // Back over a whole UTF-8 sequence
+        size_t len = strlen(search->query);
+        while (len > 0 && ((uint8_t)search->query[--len] & 0xC0) == 0x80)
+            ;
+        search->query[len] = '\0';
+        search_update(search, scan);
+        break;
+    }
+    case SDLK_RETURN:
+    case SDLK_KP_ENTER:
+        // The index keeps growing while the scan runs
+        if (!atomic_load(&scan->done)) {
+            uint32_t current = search->current;
+            search_update(search, scan);
+            search->current = current;
+        }
+        if (search->count) search_jump(search, scan, cam, window_w);
+        break;
+    }
+    return true;
+}
+
+// Past it, the scan collapses subtrees it has finished
+static size_t memory_budget(void)
+{
+    int mb = SDL_GetSystemRAM();
+    return mb > 0 ? ((size_t)mb << 20) / MEMORY_SHARE : 0;
+}
+
+// Lists the widest collapsed directory on screen again, if it is wide
+// enough to be what the user zoomed in on
+static ScanContext *expand_widest(ScanContext *scan, const ScanHints *hints,
+                                  int window_w)
+{
+    const ScanHint *widest = NULL;
+    for (int i = 0; i < hints->count; i++) {
+        if (!widest || hints->items[i].weight > widest->weight)
+            widest = &hints->items[i];
+    }
+    if (!widest || widest->weight < window_w * EXPAND_MIN_SHARE) return NULL;
+    return scanner_expand(scan, widest->node);
+}
+
+static void open_folder(ScanContext **scan, Watcher **watcher,
+                        Expansion *expansion, Camera *cam, AppState *state,
                         FontCache *cache)
 {
     nfdchar_t *path = NULL;
     if (NFD_PickFolder(&path, NULL) == NFD_OKAY) {
+        watcher_stop(*watcher);
+        *watcher = NULL;
+        expansion_drop(expansion);
         if (*scan) scanner_free(*scan);
-        *scan = scanner_start(path);
+        ScanOptions opts = {.top_files = TOP_FILES, .name_index = true,
+                            .memory_budget = memory_budget()};
+        *scan = scanner_start_opts(path, &opts);
         *cam = (Camera){.zoom = 1.0f, .target_zoom = 1.0f};
         *state = STATE_SCANNING;
         font_cache_clear(cache);
@@ -26,9 +161,77 @@ static void open_folder(ScanContext **scan, Camera *cam, AppState *state,
     }
 }
 
+static const nfdfilteritem_t SNAPSHOT_FILTER = {"Zoomfolder snapshot", "zfsnap"};
+
+static void open_snapshot(ScanContext **scan, Watcher **watcher,
+                          Expansion *expansion, Camera *cam, AppState *state,
+                          FontCache *cache)
+{
+    nfdchar_t *path = NULL;
+    if (NFD_OpenDialog(&path, &SNAPSHOT_FILTER, 1, NULL) != NFD_OKAY)
+        return;
+
+    ScanContext *opened = snapshot_open(path);
+    if (opened) {
+        watcher_stop(*watcher);
+        *watcher = NULL;
+        expansion_drop(expansion);
+        if (*scan) scanner_free(*scan);
+        *scan = opened;
+        *cam = (Camera){.zoom = 1.0f, .target_zoom = 1.0f};
+        *state = STATE_VIEWING;
+        font_cache_clear(cache);
+    } else {
+        fprintf(stderr, "Not a readable snapshot: %s\n", path);
+    }
+    NFD_FreePath(path);
+}
+
+// Replaces the view with what changed since an older snapshot of it
+static void diff_snapshot(ScanContext **scan, Watcher **watcher,
+                          Expansion *expansion, Camera *cam, FontCache *cache)
+{
+    nfdchar_t *path = NULL;
+    if (NFD_OpenDialog(&path, &SNAPSHOT_FILTER, 1, NULL) != NFD_OKAY)
+        return;
+
+    // The watcher edits the tree the diff walks, and the diff replaces it
+    bool watching = *watcher != NULL;
+    watcher_stop(*watcher);
+    *watcher = NULL;
+
+    ScanContext *before = snapshot_open(path);
+    DirNode *diff = before ? diff_trees(before->root, (*scan)->root) : NULL;
+    scanner_free(before);
+    ScanContext *ctx = diff ? scanner_adopt(diff) : NULL;
+    if (ctx) {
+        expansion_drop(expansion);
+        scanner_free(*scan);
+        *scan = ctx;
+        *cam = (Camera){.zoom = 1.0f, .target_zoom = 1.0f};
+        font_cache_clear(cache);
+    } else {
+        tree_free(diff);
+        fprintf(stderr, "Could not diff against snapshot: %s\n", path);
+        if (watching) *watcher = watcher_start(*scan);
+    }
+    NFD_FreePath(path);
+}
+
+static void save_snapshot(ScanContext *scan)
+{
+    nfdchar_t *path = NULL;
+    if (NFD_SaveDialog(&path, &SNAPSHOT_FILTER, 1, NULL, "scan.zfsnap") != NFD_OKAY)
+        return;
+    if (!snapshot_save(scan, path))
+        fprintf(stderr, "Could not save snapshot: %s\n", path);
+    NFD_FreePath(path);
+}
+
 int main(int argc, char *argv[])
 {
-    (void)argc; (void)argv;
+    if (cli_requested(argc, argv))
+        return cli_main(argc, argv);
 
     if (!SDL_Init(SDL_INIT_VIDEO)) {
         fprintf(stderr, "SDL_Init: %s\n", SDL_GetError());
@@ -68,7 +271,11 @@ int main(int argc, char *argv[])
 
     AppState state = STATE_WELCOME;
     ScanContext *scan = NULL;
+    Watcher *watcher = NULL;
+    Expansion expansion = {0};
     Camera cam = {.zoom = 1.0f, .target_zoom = 1.0f};
+    bool show_top_files = false;
+    SearchState search = {0};
     uint64_t last_tick = SDL_GetTicksNS();
 
     bool running = true;
@@ -79,13 +286,76 @@ int main(int argc, char *argv[])
                 running = false;
                 break;
             }
+            // Target textures may have lost what was drawn into them
+            if (event.type == SDL_EVENT_RENDER_TARGETS_RESET ||
+                event.type == SDL_EVENT_RENDER_DEVICE_RESET)
+                render_background_invalidate();
 
             int w, h;
             SDL_GetWindowSize(window, &w, &h);
 
+            if (search.active && search_event(&search, scan, &cam, window, &event, w))
+                continue;
+
+            // Ctrl+F (Cmd+F) finds directories by name in an indexed scan
+            if (event.type == SDL_EVENT_KEY_DOWN && event.key.key == SDLK_F &&
+                (event.key.mod & (SDL_KMOD_CTRL | SDL_KMOD_GUI)) &&
+                state != STATE_WELCOME && scan->search) {
+                search.active = true;
+                SDL_StartTextInput(window);
+                continue;
+            }
+
             if (event.type == SDL_EVENT_KEY_DOWN &&
                 event.key.key == SDLK_O) {
-                open_folder(&scan, &cam, &state, cache);
+                open_folder(&scan, &watcher, &expansion, &cam, &state, cache);
+            }
+
+            // L opens a saved snapshot, S saves the finished scan as one
+            if (event.type == SDL_EVENT_KEY_DOWN &&
+                event.key.key == SDLK_L) {
+                open_snapshot(&scan, &watcher, &expansion, &cam, &state, cache);
+            }
+            if (event.type == SDL_EVENT_KEY_DOWN &&
+                event.key.key == SDLK_S && state == STATE_VIEWING) {
+                save_snapshot(scan);
+            }
+
+            // D shows what changed since an older snapshot, by color
+            if (event.type == SDL_EVENT_KEY_DOWN &&
+                event.key.key == SDLK_D && state == STATE_VIEWING) {
+                diff_snapshot(&scan, &watcher, &expansion, &cam, cache);
+            }
+
+            // R rescans the same folder with the same options, keeping the
+            // subtrees that came out unchanged
+            if (event.type == SDL_EVENT_KEY_DOWN &&
+                event.key.key == SDLK_R && state == STATE_VIEWING) {
+                watcher_stop(watcher);
+                watcher = NULL;
+                expansion_drop(&expansion);
+                scan = scanner_rescan(scan);
+                state = scan ? STATE_SCANNING : STATE_WELCOME;
+            }
+
+            // W toggles live updates once the scan has finished
+            if (event.type == SDL_EVENT_KEY_DOWN &&
+                event.key.key == SDLK_W && state == STATE_VIEWING &&
+                scan->root->kind != NODE_DIFFED) {
+                if (watcher) {
+                    watcher_stop(watcher);
+                    watcher = NULL;
+                } else {
+                    watcher = watcher_start(scan);
+                    if (!watcher)
+                        fprintf(stderr, "Watching is not supported here\n");
+                }
+            }
+
+            // F shows the largest files of the finished scan
+            if (event.type == SDL_EVENT_KEY_DOWN &&
+                event.key.key == SDLK_F && state == STATE_VIEWING) {
+                show_top_files = !show_top_files;
             }
 
             if (state != STATE_WELCOME)
@@ -112,33 +382,65 @@ int main(int argc, char *argv[])
             float mx = 0, my = 0;
             SDL_GetMouseState(&mx, &my);
 
-            SDL_LockMutex(scan->mutex);
+            // A collapsed directory listed again goes in before the frame
+            if (expansion.ctx && expansion.started_in == expansion.generation &&
+                atomic_load(&expansion.ctx->done)) {
+                scanner_expand_finish(scan, expansion.ctx);
+                expansion.ctx = NULL;
+            }
+
+            bool done = atomic_load(&scan->done);
+            uint64_t total = atomic_load(&scan->total_size);
+            uint32_t files = atomic_load(&scan->total_files);
+
+            // The scanner keeps publishing while the frame reads the tree
+            tree_read_begin();
             renderer_animate(scan->root, dt);
             DirNode *hovered = renderer_hit_test(scan->root, &cam, w, mx, my);
+            // While scanning, whatever is on screen gets scanned first;
+            // afterwards, collapsed directories zoomed in on are listed again
+            ScanHints hints = {0};
             renderer_draw(renderer, font, cache, scan->root, &cam,
-                          hovered, w, h);
-            bool done = scan->done;
-            uint64_t total = scan->total_size;
-            uint32_t files = scan->total_files;
-            SDL_UnlockMutex(scan->mutex);
+                          hovered, &hints, w, h);
+            if (!done) {
+                scanner_set_hints(scan, &hints);
+            } else if (!expansion.ctx) {
+                expansion.ctx = expand_widest(scan, &hints, w);
+                expansion.started_in = expansion.generation;
+            }
 
             if (!done) {
                 render_scan_indicator(renderer, font, cache,
                                      files, total, w, h);
             } else if (state == STATE_SCANNING) {
                 state = STATE_VIEWING;
+            } else if (watcher) {
+                render_watch_indicator(renderer, font, cache,
+                                       watcher_backend(watcher),
+                                       files, total, w, h);
             }
 
+            // A snapshot keeps no files, so there is no panel for one
+            if (show_top_files && done && scan->top_files.cap)
+                render_top_files(renderer, font, cache, &scan->top_files, w, h);
+            if (search.active)
+                render_search_bar(renderer, font, cache, search.query,
+                                  search.current, search.total,
+                                  search_mem_used(scan->search), w, h);
             if (hovered)
                 render_tooltip(renderer, font, cache, hovered,
                                mx, my, w, h);
+            tree_read_end();
         }
 
         SDL_RenderPresent(renderer);
     }
 
+    watcher_stop(watcher);
+    expansion_drop(&expansion);
     if (scan) scanner_free(scan);
     font_cache_free(cache);
+    render_background_invalidate();
     if (font) TTF_CloseFont(font);
     NFD_Quit();
     TTF_Quit();
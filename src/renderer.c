@@ -1,4 +1,6 @@
 #include "renderer.h"
+#include "snapshot.h"
+#include "geometry.h"
 #include <string.h>
 #include <stdio.h>
 
@@ -25,9 +27,25 @@ static const SDL_Color PALETTE[] = {
 #define ROW_HEIGHT 28
 #define ROW_GAP 2
 #define LABEL_PAD 4
+#define HOVER_HINT 1e6f     // a hovered directory outranks anything on screen
+#define PLACEHOLDER_SHARE 0.02f     // of the parent's width, per skipped child
+#define MIN_CHILD_PX 0.5f           // narrower children are folded into one block
+#define MAX_LOCATE_DEPTH 512
+#define TOOLTIP_EXTS 3
+#define HIST_BAR_W 4
+#define HIST_HEIGHT 24
+#define TOP_FILES_SHOWN 20
+#define TOP_FILES_PATH 72          // characters of a path shown, its end kept
 
 static const SDL_Color COLOR_LABEL = {20, 20, 20, 255};
 static const SDL_Color COLOR_TEXT  = {180, 180, 180, 255};
+static const SDL_Color COLOR_PLACEHOLDER = {70, 70, 78, 255};
+static const SDL_Color COLOR_FOLDED = {96, 96, 108, 255};
+static const SDL_Color COLOR_MATCH = {255, 235, 59, 255};
+static const SDL_Color COLOR_HOVER_OUTLINE = {200, 200, 210, 255};
+static const SDL_Color COLOR_SAME   = {104, 104, 116, 255};    // diff colors
+static const SDL_Color COLOR_GREW   = {229, 57, 53, 255};
+static const SDL_Color COLOR_SHRANK = {67, 160, 71, 255};
 
 static uint32_t hash_name(const char *name)
 {
@@ -51,21 +69,82 @@ static const char *format_size(uint64_t bytes)
     return buf;
 }
 
-static void draw_cached_text(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
-                             const char *text, SDL_Color color,
-                             float x, float y, float max_w)
+// "+1.2 GB", "-300 KB"
+static const char *format_delta(int64_t bytes)
 {
-    int tw, th;
-    SDL_Texture *tex = font_cache_get(cache, r, font, text, color, &tw, &th);
-    if (!tex) return;
-    float w = (float)tw;
-    if (w > max_w) w = max_w;
-    SDL_FRect dst = {x, y, w, (float)th};
-    SDL_RenderTexture(r, tex, NULL, &dst);
+    static char buf[32];
+    uint64_t abs = bytes < 0 ? (uint64_t)-bytes : (uint64_t)bytes;
+    snprintf(buf, sizeof(buf), "%c%s", bytes < 0 ? '-' : '+', format_size(abs));
+    return buf;
+}
+
+// From gray toward red or green with the share of the directory that changed
+static SDL_Color delta_color(const DirNode *node)
+{
+    if (node->size_delta == 0 || node->size == 0) return COLOR_SAME;
+    SDL_Color to = node->size_delta > 0 ? COLOR_GREW : COLOR_SHRANK;
+    uint64_t abs = node->size_delta < 0 ? (uint64_t)-node->size_delta
+                                        : (uint64_t)node->size_delta;
+    float t = (float)abs / (float)node->size;
+    t = 0.35f + 0.65f * (t > 1.0f ? 1.0f : t);
+    return (SDL_Color){
+        (uint8_t)(COLOR_SAME.r + (to.r - COLOR_SAME.r) * t),
+        (uint8_t)(COLOR_SAME.g + (to.g - COLOR_SAME.g) * t),
+        (uint8_t)(COLOR_SAME.b + (to.b - COLOR_SAME.b) * t),
+        255,
+    };
 }
 
 static inline uint8_t clamp255(int v) { return v > 255 ? 255 : (uint8_t)v; }
 
+// The tree's boxes go out as triangles with a color per vertex, in one
+// SDL_RenderGeometry call per frame, and its labels after them in another
+// from the glyph atlas, so they land on top. A box is its outline color
+// with the fill inset over it.
+static GeometryBatch boxes;
+
+static void flush_boxes(SDL_Renderer *r, void *user)
+{
+    (void)user;
+    geometry_flush(&boxes, r, NULL);
+}
+
+static void batch_quad(SDL_Renderer *r, float x, float y, float w, float h, SDL_Color c)
+{
+    // Out of memory, what is batched so far goes now and the rest one by one
+    SDL_FRect dst = {x, y, w, h};
+    if (geometry_quad(&boxes, &dst, NULL, c)) return;
+    geometry_flush(&boxes, r, NULL);
+    if (geometry_quad(&boxes, &dst, NULL, c)) return;
+    SDL_SetRenderDrawColor(r, c.r, c.g, c.b, c.a);
+    SDL_RenderFillRect(r, &dst);
+}
+
+// A filled box with an outline border pixels wide
+static void batch_box(SDL_Renderer *r, const SDL_FRect *rect, SDL_Color fill,
+                      SDL_Color outline, float border)
+{
+    batch_quad(r, rect->x, rect->y, rect->w, rect->h, outline);
+    if (rect->w > 2 * border && rect->h > 2 * border)
+        batch_quad(r, rect->x + border, rect->y + border,
+                   rect->w - 2 * border, rect->h - 2 * border, fill);
+}
+
+// Skipped directories have no size of their own, so each is given a sliver
+// of the parent's width to stay visible and hoverable
+static float child_width(const DirNode *parent, const DirNode *child, float w)
+{
+    float parent_size = atomic_load_explicit(&parent->display_size,
+                                             memory_order_relaxed);
+    float total = parent_size *
+                  (1.0f + PLACEHOLDER_SHARE * (float)parent->placeholders);
+    if (total <= 0) return 0;
+    float weight = child->skip != DIR_SCANNED
+        ? parent_size * PLACEHOLDER_SHARE
+        : atomic_load_explicit(&child->display_size, memory_order_relaxed);
+    return w * (weight / total);
+}
+
 void camera_update(Camera *cam, float dt)
 {
     float t = 12.0f * dt;
@@ -75,26 +154,157 @@ void camera_update(Camera *cam, float dt)
     cam->offset_y += (cam->target_offset_y - cam->offset_y) * t;
 }
 
-static void animate_node(DirNode *node, float t)
+// This frame's step toward the real sizes, taken by each node as it is drawn
+static float anim_step;
+// Lowercase search text whose matches are outlined, "" for none
+static char highlight[256];
+
+void renderer_set_highlight(const char *query)
+{
+    size_t i = 0;
+    for (; query && query[i] && i + 1 < sizeof(highlight); i++) {
+        char c = query[i];
+        highlight[i] = c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+    }
+    highlight[i] = '\0';
+}
+
+static void animate_node(DirNode *node)
 {
-    node->display_size += ((float)node->size - node->display_size) * t;
-    for (uint32_t i = 0; i < node->child_count; i++)
-        animate_node(&node->children[i], t);
+    float shown = atomic_load_explicit(&node->display_size, memory_order_relaxed);
+    shown += ((float)node->size - shown) * anim_step;
+    atomic_store_explicit(&node->display_size, shown, memory_order_relaxed);
 }
 
+// Steps the root only; the rest step as they are drawn, so a frame costs
+// what is on screen and nodes out of view catch up when they come back
 void renderer_animate(DirNode *root, float dt)
 {
-    if (!root) return;
-    float t = 8.0f * dt;
-    if (t > 1.0f) t = 1.0f;
-    animate_node(root, t);
+    anim_step = 8.0f * dt;
+    if (anim_step > 1.0f) anim_step = 1.0f;
+    if (root) animate_node(root);
+}
+
+// A row of children as laid out. They are largest first, so past the first
+// one narrower than MIN_CHILD_PX on screen all the sized ones are: it is
+// found by bisection and they are drawn as one block, after the
+// placeholders, which come next in order and are drawn if wide enough.
+typedef struct {
+    DirNode                *children;
+    const _Atomic uint32_t *order;
+    uint32_t                shown;          // drawn one by one
+    uint32_t                sized;          // placeholders start here
+    uint32_t                placeholders;   // drawn one by one after those
+    uint32_t                folded;         // in the block
+    float                   folded_w;
+} RowLayout;
+
+static DirNode *row_child(const RowLayout *row, uint32_t i)
+{
+    if (i >= row->shown) i += row->sized - row->shown;
+    return tree_child_at(row->children, row->order, i);
+}
+
+static void layout_row(const DirNode *node, float w, float zoom, RowLayout *row)
+{
+    uint32_t count = tree_child_count(node);
+    row->children = tree_children(node);
+    row->order = tree_child_order(row->children);
+
+    // Folding goes by size: a folded child isn't animated, so its display
+    // size would never grow enough to bring it back
+    float total = (float)node->size *
+                  (1.0f + PLACEHOLDER_SHARE * (float)node->placeholders);
+    uint32_t lo = 0, hi = count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (tree_child_at(row->children, row->order, mid)->size > 0) lo = mid + 1;
+        else hi = mid;
+    }
+    row->sized = lo;
+
+    lo = 0;
+    hi = row->sized;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        DirNode *child = tree_child_at(row->children, row->order, mid);
+        if (w * ((float)child->size / total) * zoom >= MIN_CHILD_PX) lo = mid + 1;
+        else hi = mid;
+    }
+    row->shown = lo;
+
+    uint32_t placeholders = node->placeholders;
+    if (placeholders > count - row->sized) placeholders = count - row->sized;
+    float placeholder_w = placeholders
+        ? child_width(node, tree_child_at(row->children, row->order, row->sized), w)
+        : 0;
+    row->placeholders = placeholder_w * zoom >= MIN_CHILD_PX ? placeholders : 0;
+    row->folded = count - row->shown - row->placeholders;
+
+    uint64_t shown_size = 0;
+    for (uint32_t i = 0; i < row->shown; i++)
+        shown_size += tree_child_at(row->children, row->order, i)->size;
+    uint64_t children_size = tree_children_size(node);
+    uint64_t folded_size = children_size > shown_size ? children_size - shown_size : 0;
+    row->folded_w = total > 0 ? w * ((float)folded_size / total) : 0;
+    if (!row->placeholders) row->folded_w += placeholder_w * (float)placeholders;
+}
+
+static void draw_folded(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
+                        const RowLayout *row, Camera *cam, float x, float y,
+                        int window_w, int window_h)
+{
+    float sx = (x + cam->offset_x) * cam->zoom;
+    float sy = (y + cam->offset_y) * cam->zoom;
+    float sw = row->folded_w * cam->zoom;
+    float sh = ROW_HEIGHT * cam->zoom;
+    if (sw < 1.0f || sx + sw < 0 || sx > window_w || sy > window_h || sy + sh < 0)
+        return;
+
+    SDL_Color col = COLOR_FOLDED;
+    SDL_FRect rect = {sx, sy, sw, sh};
+    batch_box(r, &rect, col, (SDL_Color){col.r / 2, col.g / 2, col.b / 2, 255}, 1);
+
+    if (sw > 40 && font && cache) {
+        char label[64];
+        snprintf(label, sizeof(label), "%u smaller item%s", row->folded,
+                 row->folded == 1 ? "" : "s");
+        font_cache_queue_text(cache, r, font, label, COLOR_TEXT, sx + LABEL_PAD,
+                              sy + (sh - 14) / 2, sw - LABEL_PAD * 2);
+    }
+}
+
+static void draw_node_row(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
+                          DirNode *node, Camera *cam, DirNode *hovered,
+                          ScanHints *hints, float x, float y, float w,
+                          int depth, int window_w, int window_h);
+
+static void draw_children(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
+                          DirNode *node, Camera *cam, DirNode *hovered,
+                          ScanHints *hints, float x, float y, float w,
+                          int depth, int window_w, int window_h)
+{
+    RowLayout row;
+    layout_row(node, w, cam->zoom, &row);
+
+    float cx = x;
+    for (uint32_t i = 0; i < row.shown + row.placeholders; i++) {
+        DirNode *child = row_child(&row, i);
+        float cw = child_width(node, child, w);
+        draw_node_row(r, font, cache, child, cam, hovered, hints, cx, y, cw,
+                      depth, window_w, window_h);
+        cx += cw;
+    }
+    if (row.folded) draw_folded(r, font, cache, &row, cam, cx, y, window_w, window_h);
 }
 
 static void draw_node_row(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
                           DirNode *node, Camera *cam, DirNode *hovered,
-                          float x, float y, float w, int depth,
-                          int window_w, int window_h)
+                          ScanHints *hints, float x, float y, float w,
+                          int depth, int window_w, int window_h)
 {
+    animate_node(node);
+
     float sx = (x + cam->offset_x) * cam->zoom;
     float sy = (y + cam->offset_y) * cam->zoom;
     float sw = w * cam->zoom;
@@ -106,78 +316,157 @@ static void draw_node_row(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
 
     bool visible = !(sy + sh < 0);
     if (visible) {
-        SDL_Color col = PALETTE[hash_name(node->name) % PALETTE_SIZE];
+        DirSkip skip = node->skip;
+        uint8_t kind = node->kind;
+        SDL_Color col = skip != DIR_SCANNED ? COLOR_PLACEHOLDER
+                      : kind == NODE_DIFFED ? delta_color(node)
+                      : PALETTE[hash_name(node->name) % PALETTE_SIZE];
         bool is_hovered = (node == hovered);
 
+        // Collapsed directories are grayed; once the scan is done the widest
+        // one on screen is listed again
+        if (kind == NODE_COLLAPSED) {
+            col.r = (uint8_t)((col.r + COLOR_FOLDED.r) / 2);
+            col.g = (uint8_t)((col.g + COLOR_FOLDED.g) / 2);
+            col.b = (uint8_t)((col.b + COLOR_FOLDED.b) / 2);
+        }
+
+        if (hints && (!node->complete || kind == NODE_COLLAPSED))
+            scan_hints_add(hints, node, is_hovered ? sw + HOVER_HINT : sw);
+
         if (is_hovered) {
             col.r = clamp255(col.r + 30);
             col.g = clamp255(col.g + 30);
             col.b = clamp255(col.b + 30);
         }
 
-        SDL_SetRenderDrawColor(r, col.r, col.g, col.b, col.a);
+        // Search matches get a ring two pixels wide instead
         SDL_FRect rect = {sx, sy, sw, sh};
-        SDL_RenderFillRect(r, &rect);
-
-        if (is_hovered) {
-            SDL_SetRenderDrawColor(r, 200, 200, 210, 255);
-        } else {
-            SDL_SetRenderDrawColor(r, col.r / 2, col.g / 2, col.b / 2, 255);
-        }
-        SDL_RenderRect(r, &rect);
+        bool match = highlight[0] && search_name_matches(node->name, highlight);
+        SDL_Color outline = match ? COLOR_MATCH
+                          : is_hovered ? COLOR_HOVER_OUTLINE
+                          : (SDL_Color){col.r / 2, col.g / 2, col.b / 2, 255};
+        batch_box(r, &rect, col, outline, match ? 2 : 1);
 
         if (sw > 40 && font && cache) {
             char label[320];
-            if (sw > 120)
+            if (skip != DIR_SCANNED)
+                snprintf(label, sizeof(label), "%s (%s)", node->name,
+                         tree_skip_label(skip));
+            else if (sw > 120)
                 snprintf(label, sizeof(label), "%s %s", node->name,
-                         format_size(node->size));
+                         kind == NODE_DIFFED ? format_delta(node->size_delta)
+                                             : format_size(node->size));
             else
                 snprintf(label, sizeof(label), "%s", node->name);
 
-            draw_cached_text(r, font, cache, label, COLOR_LABEL,
-                             sx + LABEL_PAD, sy + (sh - 14) / 2,
-                             sw - LABEL_PAD * 2);
+            font_cache_queue_text(cache, r, font, label,
+                                  skip != DIR_SCANNED ? COLOR_TEXT : COLOR_LABEL,
+                                  sx + LABEL_PAD, sy + (sh - 14) / 2,
+                                  sw - LABEL_PAD * 2);
         }
     }
 
-    float cx = x;
-    for (uint32_t i = 0; i < node->child_count; i++) {
-        DirNode *child = &node->children[i];
-        float cw = (node->display_size > 0)
-            ? w * (child->display_size / node->display_size)
-            : 0;
-        if (cw < 0.5f) continue;
-
-        draw_node_row(r, font, cache, child, cam, hovered, cx,
-                      y + ROW_HEIGHT + ROW_GAP, cw,
-                      depth + 1, window_w, window_h);
-        cx += cw;
-    }
+    // Levels of an opened snapshot materialize as they come into view
+    snapshot_ensure(node);
+    draw_children(r, font, cache, node, cam, hovered, hints, x,
+                  y + ROW_HEIGHT + ROW_GAP, w, depth + 1, window_w, window_h);
 }
 
 void renderer_draw(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
                    DirNode *root, Camera *cam, DirNode *hovered,
-                   int window_w, int window_h)
+                   ScanHints *hints, int window_w, int window_h)
 {
-    if (!root || root->child_count == 0) return;
+    if (!root) return;
+    // Text the atlas flushes mid-frame still goes over the boxes before it
+    font_cache_set_flush_hook(cache, flush_boxes, NULL);
+    draw_children(r, font, cache, root, cam, hovered, hints, 0, 0,
+                  (float)window_w, 0, window_w, window_h);
+    geometry_flush(&boxes, r, NULL);
+    font_cache_flush_text(cache, r);
+}
 
-    float total_w = (float)window_w;
+// Laid out by real sizes, where the animation is headed
+bool renderer_locate(DirNode *root, const DirNode *node, int window_w,
+                     float *x, float *y, float *w)
+{
+    const DirNode *path[MAX_LOCATE_DEPTH];
+    int depth = 0;
+    for (const DirNode *n = node; n && n->slot != TREE_NO_SLOT; n = tree_parent(n)) {
+        if (depth == MAX_LOCATE_DEPTH) return false;
+        path[depth++] = n;
+    }
+    if (depth == 0) return false;
+
+    float cx = 0, cw = (float)window_w;
+    DirNode *parent = root;
+    for (int level = depth - 1; level >= 0; level--) {
+        uint32_t count = tree_child_count(parent);
+        DirNode *children = tree_children(parent);
+        const _Atomic uint32_t *order = tree_child_order(children);
+        float total = (float)parent->size *
+                      (1.0f + PLACEHOLDER_SHARE * (float)parent->placeholders);
+        if (total <= 0) return false;
+
+        DirNode *found = NULL;
+        float child_w = 0;
+        for (uint32_t i = 0; i < count && !found; i++) {
+            DirNode *child = tree_child_at(children, order, i);
+            float weight = child->skip != DIR_SCANNED
+                ? (float)parent->size * PLACEHOLDER_SHARE
+                : (float)child->size;
+            child_w = cw * (weight / total);
+            if ((uint32_t)(child - children) == path[level]->slot) found = child;
+            else cx += child_w;
+        }
+        if (!found) return false;
+        cw = child_w;
+        parent = found;
+    }
+    *x = cx;
+    *y = (float)(depth - 1) * (ROW_HEIGHT + ROW_GAP);
+    *w = cw;
+    return true;
+}
 
-    float x = 0;
-    for (uint32_t i = 0; i < root->child_count; i++) {
-        DirNode *child = &root->children[i];
-        float w = (root->display_size > 0)
-            ? total_w * (child->display_size / root->display_size)
-            : 0;
-        if (w < 0.5f) continue;
+void render_search_bar(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
+                       const char *query, uint32_t current, uint32_t total,
+                       size_t index_bytes, int w, int h)
+{
+    if (!font || !cache) return;
+    (void)h;
 
-        draw_node_row(r, font, cache, child, cam, hovered, x, 0, w,
-                      0, window_w, window_h);
-        x += w;
-    }
+    char text[512];
+    int len = snprintf(text, sizeof(text), "Find: %s_", query);
+    if (query[0] && total && current)
+        len += snprintf(text + len, sizeof(text) - len, "   %u of %u", current, total);
+    else if (query[0])
+        len += snprintf(text + len, sizeof(text) - len, "   %u match%s", total,
+                        total == 1 ? "" : "es");
+    snprintf(text + len, sizeof(text) - len, "   index %s", format_size(index_bytes));
+
+    int tw, th;
+    SDL_Texture *tex = font_cache_get(cache, r, font, text, COLOR_TEXT, &tw, &th);
+    if (!tex) return;
+    int pad = 6;
+    SDL_FRect bg = {8, 8, (float)(tw + pad * 2), (float)(th + pad * 2)};
+    if (bg.w > w - 16) bg.w = (float)(w - 16);
+    SDL_SetRenderDrawColor(r, 32, 32, 38, 255);
+    SDL_RenderFillRect(r, &bg);
+    SDL_SetRenderDrawColor(r, 60, 60, 70, 255);
+    SDL_RenderRect(r, &bg);
+    SDL_FRect dst = {8.0f + pad, 8.0f + pad, (float)tw, (float)th};
+    SDL_RenderTexture(r, tex, NULL, &dst);
 }
 
-void render_background(SDL_Renderer *r, int w, int h)
+// Drawn once into a texture at the output's pixel size, and again only
+// when that changes or the renderer loses its targets
+static SDL_Texture *background;
+static int background_w, background_h;
+
+// scale is output pixels per window unit, so the grid and the vignette keep
+// their size on a high-density display
+static void draw_background(SDL_Renderer *r, int w, int h, float scale)
 {
     for (int y = 0; y < h; y++) {
         float t = (float)y / (float)(h > 1 ? h - 1 : 1);
@@ -190,7 +479,7 @@ void render_background(SDL_Renderer *r, int w, int h)
 
     SDL_SetRenderDrawBlendMode(r, SDL_BLENDMODE_BLEND);
 
-    int depth = 100;
+    int depth = (int)(100 * scale);
     for (int i = 0; i < depth; i++) {
         float t = 1.0f - (float)i / (float)depth;
         uint8_t a = (uint8_t)(35.0f * t * t);
@@ -206,7 +495,8 @@ void render_background(SDL_Renderer *r, int w, int h)
         SDL_RenderFillRect(r, &rgt);
     }
 
-    int spacing = 24;
+    int spacing = (int)(24 * scale);
+    if (spacing < 1) spacing = 1;
     SDL_SetRenderDrawColor(r, 255, 255, 255, 28);
     for (int gy = spacing; gy < h; gy += spacing)
         for (int gx = spacing; gx < w; gx += spacing)
@@ -215,13 +505,49 @@ void render_background(SDL_Renderer *r, int w, int h)
     SDL_SetRenderDrawBlendMode(r, SDL_BLENDMODE_NONE);
 }
 
+void render_background(SDL_Renderer *r, int w, int h)
+{
+    int pw = w, ph = h;
+    SDL_GetRenderOutputSize(r, &pw, &ph);
+    if (background_w != pw || background_h != ph) {
+        render_background_invalidate();
+        background = SDL_CreateTexture(r, SDL_PIXELFORMAT_ARGB8888,
+                                       SDL_TEXTUREACCESS_TARGET, pw, ph);
+        if (background) {
+            SDL_SetTextureBlendMode(background, SDL_BLENDMODE_NONE);
+            SDL_Texture *target = SDL_GetRenderTarget(r);
+            SDL_SetRenderTarget(r, background);
+            draw_background(r, pw, ph, w > 0 ? (float)pw / (float)w : 1.0f);
+            SDL_SetRenderTarget(r, target);
+        }
+        background_w = pw;
+        background_h = ph;
+    }
+
+    // Without render targets it is drawn every frame as before, and not
+    // tried again until the size changes
+    if (!background) {
+        draw_background(r, w, h, 1.0f);
+        return;
+    }
+    SDL_FRect dst = {0, 0, (float)w, (float)h};
+    SDL_RenderTexture(r, background, NULL, &dst);
+}
+
+void render_background_invalidate(void)
+{
+    if (background) SDL_DestroyTexture(background);
+    background = NULL;
+    background_w = background_h = 0;
+}
+
 void render_welcome(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
                     int w, int h)
 {
     if (!font || !cache) return;
     int tw, th;
     SDL_Texture *tex = font_cache_get(cache, r, font,
-                                      "Press O to select a folder",
+                                      "Press O to select a folder or L to open a snapshot",
                                       COLOR_TEXT, &tw, &th);
     if (!tex) return;
     SDL_FRect dst = {
@@ -252,6 +578,48 @@ void render_scan_indicator(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
     SDL_RenderTexture(r, tex, NULL, &dst);
 }
 
+void render_watch_indicator(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
+                            const char *backend, uint32_t files, uint64_t size,
+                            int w, int h)
+{
+    if (!font || !cache) return;
+    (void)w;
+
+    char text[128];
+    snprintf(text, sizeof(text), "Watching for changes (%s)  %u files  %s",
+             backend, files, format_size(size));
+
+    int tw, th;
+    SDL_Texture *tex = font_cache_get(cache, r, font, text, COLOR_TEXT,
+                                      &tw, &th);
+    if (!tex) return;
+    SDL_FRect dst = {8, h - th - 8.0f, (float)tw, (float)th};
+    SDL_RenderTexture(r, tex, NULL, &dst);
+}
+
+static DirNode *hit_test_row(DirNode *node, Camera *cam,
+                             float x, float y, float w,
+                             float mx, float my, int window_w);
+
+// The folded block isn't a directory, so it is never hit
+static DirNode *hit_test_children(DirNode *node, Camera *cam,
+                                  float x, float y, float w,
+                                  float mx, float my, int window_w)
+{
+    RowLayout row;
+    layout_row(node, w, cam->zoom, &row);
+
+    float cx = x;
+    for (uint32_t i = 0; i < row.shown + row.placeholders; i++) {
+        DirNode *child = row_child(&row, i);
+        float cw = child_width(node, child, w);
+        DirNode *hit = hit_test_row(child, cam, cx, y, cw, mx, my, window_w);
+        if (hit) return hit;
+        cx += cw;
+    }
+    return NULL;
+}
+
 static DirNode *hit_test_row(DirNode *node, Camera *cam,
                              float x, float y, float w,
                              float mx, float my, int window_w)
@@ -267,44 +635,46 @@ static DirNode *hit_test_row(DirNode *node, Camera *cam,
     if (my >= sy && my < sy + sh)
         return node;
 
-    float cx = x;
-    for (uint32_t i = 0; i < node->child_count; i++) {
-        DirNode *child = &node->children[i];
-        float cw = (node->display_size > 0)
-            ? w * (child->display_size / node->display_size)
-            : 0;
-        if (cw < 0.5f) continue;
-
-        DirNode *hit = hit_test_row(child, cam, cx,
-                                    y + ROW_HEIGHT + ROW_GAP, cw,
-                                    mx, my, window_w);
-        if (hit) return hit;
-        cx += cw;
-    }
-
-    return NULL;
+    snapshot_ensure(node);
+    return hit_test_children(node, cam, x, y + ROW_HEIGHT + ROW_GAP, w,
+                             mx, my, window_w);
 }
 
 DirNode *renderer_hit_test(DirNode *root, Camera *cam,
                            int window_w, float mx, float my)
 {
-    if (!root || root->child_count == 0) return NULL;
+    if (!root) return NULL;
+    return hit_test_children(root, cam, 0, 0, (float)window_w, mx, my, window_w);
+}
 
-    float total_w = (float)window_w;
-    float x = 0;
-    for (uint32_t i = 0; i < root->child_count; i++) {
-        DirNode *child = &root->children[i];
-        float w = (root->display_size > 0)
-            ? total_w * (child->display_size / root->display_size)
-            : 0;
-        if (w < 0.5f) continue;
+// "mp4 3.1 GB, log 200 MB, no extension 12 KB" for the largest few
+static void format_exts(const FileStats *stats, char *buf, size_t cap)
+{
+    size_t len = 0;
+    buf[0] = '\0';
+    for (int i = 0; i < TOOLTIP_EXTS && stats->exts[i].files; i++) {
+        const FileExt *ext = &stats->exts[i];
+        int n = snprintf(buf + len, cap - len, "%s%s %s", i ? ", " : "",
+                         ext->name[0] ? ext->name : "no extension",
+                         format_size(ext->bytes));
+        if (n < 0 || (size_t)n >= cap - len) break;
+        len += (size_t)n;
+    }
+}
 
-        DirNode *hit = hit_test_row(child, cam, x, 0, w,
-                                    mx, my, window_w);
-        if (hit) return hit;
-        x += w;
+// Files per size bin as bars, scaled to the most common one
+static void draw_histogram(SDL_Renderer *r, const FileStats *stats, int peak_bin,
+                           float x, float y)
+{
+    float peak = (float)stats->bins[peak_bin];
+    SDL_SetRenderDrawColor(r, COLOR_TEXT.r, COLOR_TEXT.g, COLOR_TEXT.b, 255);
+    for (int i = 0; i < FILESTATS_BINS; i++) {
+        if (!stats->bins[i]) continue;
+        float h = HIST_HEIGHT * (float)stats->bins[i] / peak;
+        if (h < 1) h = 1;
+        SDL_FRect bar = {x + i * HIST_BAR_W, y + HIST_HEIGHT - h, HIST_BAR_W - 1, h};
+        SDL_RenderFillRect(r, &bar);
     }
-    return NULL;
 }
 
 void render_tooltip(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
@@ -313,20 +683,60 @@ void render_tooltip(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
 {
     if (!node || !font || !cache) return;
 
-    char line1[320], line2[128];
+    char line1[320], line2[128], line3[160] = "", line4[64] = "";
     snprintf(line1, sizeof(line1), "%s", node->name);
-    snprintf(line2, sizeof(line2), "%s  %u files",
-             format_size(node->size), node->file_count);
+    if (node->skip != DIR_SCANNED)
+        snprintf(line2, sizeof(line2), "Not scanned: %s",
+                 tree_skip_label(node->skip));
+    else if (node->kind == NODE_DIFFED)
+        snprintf(line2, sizeof(line2), "%s  %+d files",
+                 format_delta(node->size_delta), (int)node->files_delta);
+    else if (node->kind == NODE_COLLAPSED)
+        snprintf(line2, sizeof(line2), "%s  %u files  %u folders %u deep, collapsed",
+                 format_size(node->size), node->file_count,
+                 node->collapsed_dirs, node->collapsed_depth);
+    else
+        snprintf(line2, sizeof(line2), "%s  %u files",
+                 format_size(node->size), node->file_count);
+
+    // What the files are, for directories large enough to have kept it
+    const FileStats *stats = node->skip == DIR_SCANNED ? tree_file_stats(node) : NULL;
+    int peak_bin = -1;
+    if (stats) {
+        format_exts(stats, line3, sizeof(line3));
+        for (int i = 0; i < FILESTATS_BINS; i++) {
+            if (peak_bin < 0 || stats->bins[i] > stats->bins[peak_bin]) peak_bin = i;
+        }
+        if (stats->bins[peak_bin]) {
+            char low[32];
+            snprintf(low, sizeof(low), "%s", format_size(filestats_bin_floor(peak_bin)));
+            snprintf(line4, sizeof(line4), "Most files %s - %s", low,
+                     format_size(filestats_bin_floor(peak_bin + 1)));
+        }
+    }
 
-    int tw1, th1, tw2, th2;
+    int tw1, th1, tw2, th2, tw3 = 0, th3 = 0, tw4 = 0, th4 = 0;
     SDL_Texture *tex1 = font_cache_get(cache, r, font, line1, COLOR_TEXT,
                                        &tw1, &th1);
     SDL_Texture *tex2 = font_cache_get(cache, r, font, line2, COLOR_TEXT,
                                        &tw2, &th2);
+    SDL_Texture *tex3 = line3[0] ? font_cache_get(cache, r, font, line3, COLOR_TEXT,
+                                                  &tw3, &th3) : NULL;
+    SDL_Texture *tex4 = line4[0] ? font_cache_get(cache, r, font, line4, COLOR_TEXT,
+                                                  &tw4, &th4) : NULL;
+    if (!tex3) tw3 = th3 = 0;
+    if (!tex4) tw4 = th4 = 0;
 
     int pad = 8;
-    int box_w = (tw1 > tw2 ? tw1 : tw2) + pad * 2;
+    int hist_w = tex4 ? FILESTATS_BINS * HIST_BAR_W : 0;
+    int box_w = tw1 > tw2 ? tw1 : tw2;
+    if (tw3 > box_w) box_w = tw3;
+    if (tw4 > box_w) box_w = tw4;
+    if (hist_w > box_w) box_w = hist_w;
+    box_w += pad * 2;
     int box_h = th1 + th2 + pad * 3;
+    if (tex3) box_h += th3 + pad;
+    if (tex4) box_h += th4 + HIST_HEIGHT + pad * 2;
 
     float tx = mx + 16;
     float ty = my + 16;
@@ -345,12 +755,76 @@ void render_tooltip(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
     SDL_SetRenderDrawColor(r, 44, 44, 52, 240);
     SDL_RenderFillRect(r, &inner);
 
+    float y = ty + pad;
     if (tex1) {
-        SDL_FRect d1 = {tx + pad, ty + pad, (float)tw1, (float)th1};
+        SDL_FRect d1 = {tx + pad, y, (float)tw1, (float)th1};
         SDL_RenderTexture(r, tex1, NULL, &d1);
     }
+    y += th1 + pad;
     if (tex2) {
-        SDL_FRect d2 = {tx + pad, ty + pad + th1 + pad, (float)tw2, (float)th2};
+        SDL_FRect d2 = {tx + pad, y, (float)tw2, (float)th2};
         SDL_RenderTexture(r, tex2, NULL, &d2);
     }
+    y += th2 + pad;
+    if (tex3) {
+        SDL_FRect d3 = {tx + pad, y, (float)tw3, (float)th3};
+        SDL_RenderTexture(r, tex3, NULL, &d3);
+        y += th3 + pad;
+    }
+    if (tex4) {
+        draw_histogram(r, stats, peak_bin, tx + pad, y);
+        y += HIST_HEIGHT + pad;
+        SDL_FRect d4 = {tx + pad, y, (float)tw4, (float)th4};
+        SDL_RenderTexture(r, tex4, NULL, &d4);
+    }
+}
+
+void render_top_files(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
+                      const TopFiles *top, int w, int h)
+{
+    if (!top || !font || !cache) return;
+
+    int pad = 8, line_h = 0, box_w = 0;
+    uint32_t shown = top->count < TOP_FILES_SHOWN ? top->count : TOP_FILES_SHOWN;
+    SDL_Texture *tex[TOP_FILES_SHOWN + 1];
+    int tw[TOP_FILES_SHOWN + 1], th[TOP_FILES_SHOWN + 1];
+
+    tex[0] = font_cache_get(cache, r, font, top->count ? "Largest files" :
+                            "No files found", COLOR_TEXT, &tw[0], &th[0]);
+    for (uint32_t i = 0; i < shown; i++) {
+        const char *path = top->items[i].path;
+        size_t len = strlen(path);
+        char line[160];
+        snprintf(line, sizeof(line), "%10s  %s%s", format_size(top->items[i].size),
+                 len > TOP_FILES_PATH ? "..." : "",
+                 len > TOP_FILES_PATH ? path + len - TOP_FILES_PATH : path);
+        tex[i + 1] = font_cache_get(cache, r, font, line, COLOR_TEXT,
+                                    &tw[i + 1], &th[i + 1]);
+    }
+    for (uint32_t i = 0; i <= shown; i++) {
+        if (!tex[i]) continue;
+        if (tw[i] > box_w) box_w = tw[i];
+        if (th[i] > line_h) line_h = th[i];
+    }
+    if (!line_h) return;
+    box_w += pad * 2;
+    int box_h = (int)(shown + 1) * line_h + pad * 3;
+    if (box_h > h - 16) box_h = h - 16;
+
+    float tx = (float)(w - box_w - 8), ty = 8;
+    SDL_FRect outer = {tx - 1, ty - 1, (float)box_w + 2, (float)box_h + 2};
+    SDL_SetRenderDrawColor(r, 60, 60, 70, 255);
+    SDL_RenderFillRect(r, &outer);
+    SDL_FRect bg = {tx, ty, (float)box_w, (float)box_h};
+    SDL_SetRenderDrawColor(r, 32, 32, 38, 240);
+    SDL_RenderFillRect(r, &bg);
+
+    float y = ty + pad;
+    for (uint32_t i = 0; i <= shown && y + line_h <= ty + box_h; i++) {
+        if (tex[i]) {
+            SDL_FRect d = {tx + pad, y, (float)tw[i], (float)th[i]};
+            SDL_RenderTexture(r, tex[i], NULL, &d);
+        }
+        y += line_h + (i == 0 ? pad : 0);
+    }
 }
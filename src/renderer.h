@@ -2,6 +2,7 @@
 #include <SDL3/SDL.h>
 #include <SDL3_ttf/SDL_ttf.h>
 #include "tree.h"
+#include "scanner.h"
 #include "font_cache.h"
 
 typedef struct {
@@ -14,14 +15,35 @@ void camera_update(Camera *cam, float dt);
 void renderer_animate(DirNode *root, float dt);
 void renderer_draw(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
                    DirNode *root, Camera *cam, DirNode *hovered,
-                   int window_w, int window_h);
+                   ScanHints *hints, int window_w, int window_h);
+// Outlines directories whose names contain query, ignoring case; NULL for none
+void renderer_set_highlight(const char *query);
+// Where node sits once sizes settle, in the unzoomed layout; false if it
+// isn't under root
+bool renderer_locate(DirNode *root, const DirNode *node, int window_w,
+                     float *x, float *y, float *w);
+// Drawn into a cached texture the first time and after the window's pixel
+// size changes
 void render_background(SDL_Renderer *r, int w, int h);
+// Drops the cached background; for when the renderer's targets are reset and
+// before it is destroyed
+void render_background_invalidate(void);
 void render_welcome(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
                     int w, int h);
 void render_scan_indicator(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
                            uint32_t files, uint64_t size, int w, int h);
+// current is 1-based, 0 before the first jump
+void render_search_bar(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
+                       const char *query, uint32_t current, uint32_t total,
+                       size_t index_bytes, int w, int h);
+void render_watch_indicator(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
+                            const char *backend, uint32_t files, uint64_t size,
+                            int w, int h);
 
 DirNode *renderer_hit_test(DirNode *root, Camera *cam,
                            int window_w, float mx, float my);
 void render_tooltip(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
                     DirNode *node, float mx, float my, int window_w, int window_h);
+// Panel of the scan's largest files, top right
+void render_top_files(SDL_Renderer *r, TTF_Font *font, FontCache *cache,
+                      const TopFiles *top, int w, int h);
@@ -0,0 +1,1202 @@
+#include "scanner_backend.h"
+#include "snapshot.h"
+#include <SDL3/SDL_cpuinfo.h>
+#include <SDL3/SDL_timer.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#define PATH_SEP '\\'
+#else
+#define PATH_SEP '/'
+#endif
+
+#define DEQUE_INITIAL 64
+
+// Huge directories are published every PUBLISH_ENTRIES entries or
+// PUBLISH_MS milliseconds, whichever comes first; the clock is only read
+// every PUBLISH_CLOCK_EVERY entries.
+#define PUBLISH_ENTRIES     4096
+#define PUBLISH_MS          50
+#define PUBLISH_CLOCK_EVERY 256
+
+// Hints are taken from the renderer at most this often, so a zoom animation
+// doesn't make the workers re-sort their queues every frame
+#define HINT_INTERVAL_MS 100
+
+// A hint change re-ranks at most this many of a worker's queued jobs, from
+// the thief end: the oldest sit closest to the root and carry the most work
+#define HINT_RERANK_MAX 256
+
+// Rate-limited workers take slots of up to RATE_BATCH_MAX entries, about
+// RATE_BATCHES_PER_S of them a second, so the shared schedule isn't touched
+// per entry. Waits are slept in THROTTLE_SLICE_NS pieces to notice cancel.
+#define RATE_BATCH_MAX     64
+#define RATE_BATCHES_PER_S 100
+#define THROTTLE_SLICE_NS  (50 * 1000000ULL)
+
+// A timed syscall is a spike when it is both slower than SPIKE_MIN_NS and
+// SPIKE_FACTOR times the worker's average; the worker then sleeps
+// SPIKE_PAUSE_FACTOR times as long, at most SPIKE_PAUSE_MAX_NS.
+#define SPIKE_MIN_NS       1000000ULL
+#define SPIKE_FACTOR       8
+#define SPIKE_PAUSE_FACTOR 4
+#define SPIKE_PAUSE_MAX_NS (500 * 1000000ULL)
+
+// Subtrees smaller than this stay in their pooled blocks until an ancestor
+// is repacked
+#define REPACK_MIN 256
+
+// Under a memory budget, completed subtrees start collapsing once the trees
+// and name index take COLLAPSE_START_PCT percent of it: those under
+// 1/COLLAPSE_SHARE of their parent's size, or COLLAPSE_DEPTH levels or more
+// below the root. Past the budget every directory collapses as it completes.
+#define COLLAPSE_START_PCT 75
+#define COLLAPSE_SHARE     32
+#define COLLAPSE_DEPTH     6
+
+// Directories at least this large keep what their files are once complete,
+// as does the root; smaller ones only add theirs to their parent's
+#define STATS_KEEP_MIN ((uint64_t)64 << 20)
+
+static void deque_init(ScanDeque *d)
+{
+    d->lock = SDL_CreateMutex();
+    d->items = malloc(DEQUE_INITIAL * sizeof(ScanJob *));
+    d->cap = d->items ? DEQUE_INITIAL : 0;
+    d->head = d->tail = 0;
+}
+
+static void deque_destroy(ScanDeque *d)
+{
+    free(d->items);
+    SDL_DestroyMutex(d->lock);
+}
+
+static bool deque_push(ScanDeque *d, ScanJob *job)
+{
+    SDL_LockMutex(d->lock);
+    if (d->tail - d->head == d->cap) {
+        uint32_t new_cap = d->cap ? d->cap * 2 : DEQUE_INITIAL;
+        ScanJob **buf = malloc(new_cap * sizeof(ScanJob *));
+        if (!buf) {
+            SDL_UnlockMutex(d->lock);
+            return false;
+        }
+        for (uint32_t i = 0; i < d->tail - d->head; i++)
+            buf[i] = d->items[(d->head + i) % d->cap];
+        free(d->items);
+        d->items = buf;
+        d->tail -= d->head;
+        d->head = 0;
+        d->cap = new_cap;
+    }
+    d->items[d->tail++ % d->cap] = job;
+    SDL_UnlockMutex(d->lock);
+    return true;
+}
+
+// Owner end: newest first, keeps a worker's own walk depth-first
+static ScanJob *deque_pop(ScanDeque *d)
+{
+    ScanJob *job = NULL;
+    SDL_LockMutex(d->lock);
+    if (d->tail != d->head)
+        job = d->items[--d->tail % d->cap];
+    SDL_UnlockMutex(d->lock);
+    return job;
+}
+
+// Thief end: oldest first, those sit closest to the root and carry the most work
+static ScanJob *deque_steal(ScanDeque *d)
+{
+    ScanJob *job = NULL;
+    SDL_LockMutex(d->lock);
+    if (d->tail != d->head)
+        job = d->items[d->head++ % d->cap];
+    SDL_UnlockMutex(d->lock);
+    return job;
+}
+
+static ScanHeap *heap_create(void)
+{
+    ScanHeap *h = calloc(1, sizeof(ScanHeap));
+    if (!h) return NULL;
+    h->lock = SDL_CreateMutex();
+    return h;
+}
+
+static void heap_destroy(ScanHeap *h)
+{
+    if (!h) return;
+    free(h->items);
+    SDL_DestroyMutex(h->lock);
+    free(h);
+}
+
+static void heap_sift_up(ScanHeap *h, uint32_t i)
+{
+    ScanHeapEntry e = h->items[i];
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (h->items[parent].priority >= e.priority) break;
+        h->items[i] = h->items[parent];
+        i = parent;
+    }
+    h->items[i] = e;
+}
+
+static void heap_sift_down(ScanHeap *h, uint32_t i)
+{
+    ScanHeapEntry e = h->items[i];
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= h->count) break;
+        if (child + 1 < h->count &&
+            h->items[child + 1].priority > h->items[child].priority)
+            child++;
+        if (h->items[child].priority <= e.priority) break;
+        h->items[i] = h->items[child];
+        i = child;
+    }
+    h->items[i] = e;
+}
+
+static bool heap_push(ScanHeap *h, ScanJob *job, float priority)
+{
+    SDL_LockMutex(h->lock);
+    if (h->count == h->cap) {
+        uint32_t new_cap = h->cap ? h->cap * 2 : DEQUE_INITIAL;
+        ScanHeapEntry *buf = realloc(h->items, new_cap * sizeof(ScanHeapEntry));
+        if (!buf) {
+            SDL_UnlockMutex(h->lock);
+            return false;
+        }
+        h->items = buf;
+        h->cap = new_cap;
+    }
+    h->items[h->count] = (ScanHeapEntry){job, priority};
+    heap_sift_up(h, h->count++);
+    atomic_store_explicit(&h->size, h->count, memory_order_relaxed);
+    SDL_UnlockMutex(h->lock);
+    return true;
+}
+
+static ScanJob *heap_pop(ScanHeap *h)
+{
+    ScanJob *job = NULL;
+    SDL_LockMutex(h->lock);
+    if (h->count > 0) {
+        job = h->items[0].job;
+        h->items[0] = h->items[--h->count];
+        if (h->count > 0) heap_sift_down(h, 0);
+        atomic_store_explicit(&h->size, h->count, memory_order_relaxed);
+    }
+    SDL_UnlockMutex(h->lock);
+    return job;
+}
+
+bool scan_job_path(const ScanJob *job, char *buf, size_t cap)
+{
+    if (!job->parent) {
+        size_t len = strlen(job->node->name);
+        if (len >= cap) return false;
+        memcpy(buf, job->node->name, len + 1);
+        return true;
+    }
+    if (!scan_job_path(job->parent, buf, cap)) return false;
+
+    // A root of "/" or "C:\" already ends in a separator
+    size_t len = strlen(buf);
+    size_t name_len = strlen(job->node->name);
+    if (len + 1 + name_len >= cap) return false;
+    if (len == 0 || buf[len - 1] != PATH_SEP) buf[len++] = PATH_SEP;
+    memcpy(buf + len, job->node->name, name_len + 1);
+    return true;
+}
+
+// Hands the entries accumulated so far to the tree. The job's subdirectory
+// jobs are only created after its listing ends, so the child array may
+// still be grown here.
+static void publish(ScanWorker *w)
+{
+    ScanContext *ctx = w->ctx;
+    DirNode *node = w->job->node;
+
+    if (w->files || w->dir_count) {
+        SDL_LockMutex(ctx->mutex);
+        tree_add_size(w->job->parent ? w->job->parent->node : NULL, node, w->size);
+        node->file_count += w->files;
+        // Names are stored after a skip byte each
+        tree_reserve_children(node, w->dir_count, w->names_len - w->dir_count);
+        const char *name = w->names;
+        for (uint32_t i = 0; i < w->dir_count; i++) {
+            DirSkip skip = (DirSkip)*name++;
+            DirNode *child = tree_add_child(node, name);
+            if (child && skip != DIR_SCANNED) tree_mark_skipped(node, child, skip);
+            name += strlen(name) + 1;
+        }
+        SDL_UnlockMutex(ctx->mutex);
+
+        atomic_fetch_add_explicit(&ctx->total_size, w->size, memory_order_relaxed);
+        atomic_fetch_add_explicit(&ctx->total_files, w->files, memory_order_relaxed);
+    }
+
+    w->size = 0;
+    w->files = 0;
+    w->names_len = 0;
+    w->dir_count = 0;
+    w->unpublished = 0;
+    w->published_at = SDL_GetTicks();
+}
+
+static void entry_added(ScanWorker *w)
+{
+    w->unpublished++;
+    if (w->unpublished >= PUBLISH_ENTRIES ||
+        (w->unpublished % PUBLISH_CLOCK_EVERY == 0 &&
+         SDL_GetTicks() - w->published_at >= PUBLISH_MS))
+        publish(w);
+}
+
+static void throttle_sleep(ScanWorker *w, uint64_t ns)
+{
+    ScanContext *ctx = w->ctx;
+    atomic_fetch_add_explicit(&ctx->throttled_ns, ns, memory_order_relaxed);
+    while (ns > 0 && !scan_cancelled(w)) {
+        uint64_t slice = ns < THROTTLE_SLICE_NS ? ns : THROTTLE_SLICE_NS;
+        SDL_DelayNS(slice);
+        ns -= slice;
+    }
+}
+
+// Books the next batch on the schedule shared by all workers and waits for
+// its turn. A schedule that fell behind restarts from now, so idle time
+// isn't saved up for a burst.
+static void rate_wait(ScanWorker *w)
+{
+    ScanContext *ctx = w->ctx;
+    uint32_t rate = ctx->opts.max_stat_rate;
+    uint32_t batch = rate / RATE_BATCHES_PER_S;
+    if (batch < 1) batch = 1;
+    if (batch > RATE_BATCH_MAX) batch = RATE_BATCH_MAX;
+    uint64_t interval = 1000000000ULL * batch / rate;
+
+    uint64_t now = SDL_GetTicksNS();
+    uint64_t next = atomic_load(&ctx->rate_next), slot;
+    do {
+        slot = next > now ? next : now;
+    } while (!atomic_compare_exchange_weak(&ctx->rate_next, &next, slot + interval));
+
+    w->rate_credit = batch;
+    if (slot > now) throttle_sleep(w, slot - now);
+}
+
+static void entry_listed(ScanWorker *w)
+{
+    if (w->ctx->opts.max_stat_rate == 0) return;
+    if (w->rate_credit == 0) rate_wait(w);
+    w->rate_credit--;
+}
+
+void scan_syscall_done(ScanWorker *w, uint64_t started)
+{
+    scan_syscalls_done(w, started, 1);
+}
+
+void scan_syscalls_done(ScanWorker *w, uint64_t started, unsigned count)
+{
+    if (started == 0 || count == 0) return;
+    uint64_t took = (SDL_GetTicksNS() - started) / count;
+    uint64_t avg = w->latency_avg;
+    w->latency_avg = avg ? avg - avg / 16 + took / 16 : took;
+
+    if (avg && took > SPIKE_MIN_NS && took > avg * SPIKE_FACTOR) {
+        uint64_t pause = took * SPIKE_PAUSE_FACTOR;
+        throttle_sleep(w, pause < SPIKE_PAUSE_MAX_NS ? pause : SPIKE_PAUSE_MAX_NS);
+    }
+}
+
+// The label of a subdirectory's list is the root child the job is under
+static TopFiles *dir_tops(ScanWorker *w, const ScanJob *job)
+{
+    uint32_t top = job->top;
+    if (top >= w->dir_top_count) {
+        uint32_t count = top + 1;
+        if (count < w->dir_top_count * 2) count = w->dir_top_count * 2;
+        TopFiles *grown = realloc(w->dir_tops, count * sizeof(TopFiles));
+        if (!grown) return NULL;
+        memset(grown + w->dir_top_count, 0,
+               (count - w->dir_top_count) * sizeof(TopFiles));
+        w->dir_tops = grown;
+        w->dir_top_count = count;
+    }
+
+    TopFiles *tops = &w->dir_tops[top];
+    if (!tops->cap) {
+        while (job->parent->parent) job = job->parent;
+        if (!topfiles_init(tops, w->ctx->opts.top_files)) return NULL;
+        tops->dir = strdup(job->node->name);
+    }
+    return tops;
+}
+
+// One comparison for a file too small for either list; the path is only
+// built for the few that aren't
+static void offer_top(ScanWorker *w, const char *name, uint64_t size)
+{
+    const ScanJob *job = w->job;
+    TopFiles *tops = NULL;
+    if (w->ctx->opts.top_files_per_dir && job->top != SCAN_NO_TOP)
+        tops = dir_tops(w, job);
+    bool global = topfiles_wants(&w->top, size);
+    bool local = tops && topfiles_wants(tops, size);
+    if (!global && !local) return;
+
+    char path[4096];
+    if (!scan_job_path(job, path, sizeof(path))) return;
+    size_t len = strlen(path), name_len = strlen(name);
+    if (len + 1 + name_len >= sizeof(path)) return;
+    if (len == 0 || path[len - 1] != PATH_SEP) path[len++] = PATH_SEP;
+    memcpy(path + len, name, name_len + 1);
+
+    if (global) topfiles_push(&w->top, size, path);
+    if (local) topfiles_push(tops, size, path);
+}
+
+void scan_add_file(ScanWorker *w, const char *name, uint64_t size)
+{
+    entry_listed(w);
+    w->size += size;
+    w->files++;
+    ScanJob *job = w->job;
+    if (!job->stats) job->stats = calloc(1, sizeof(FileStats));
+    if (job->stats) filestats_add(job->stats, name, size);
+    if (w->top.cap) offer_top(w, name, size);
+    entry_added(w);
+}
+
+// Each name is stored after a DirSkip byte
+static void add_dir_name(ScanWorker *w, const char *name)
+{
+    const ScanExclude *ex = w->ctx->opts.exclude;
+    uint8_t skip = DIR_SCANNED;
+    if (ex && w->job->exclude_state &&
+        exclude_matched(ex, exclude_step(ex, w->job->exclude_state, name)))
+        skip = DIR_EXCLUDED;
+
+    size_t len = strlen(name) + 1;
+    if (w->names_len + len + 1 > w->names_cap) {
+        size_t new_cap = w->names_cap ? w->names_cap * 2 : 4096;
+        while (new_cap < w->names_len + len + 1) new_cap *= 2;
+        char *buf = realloc(w->names, new_cap);
+        if (!buf) return;
+        w->names = buf;
+        w->names_cap = new_cap;
+    }
+    w->names[w->names_len++] = (char)skip;
+    memcpy(w->names + w->names_len, name, len);
+    w->names_len += len;
+    w->dir_count++;
+    entry_added(w);
+}
+
+void scan_add_dir(ScanWorker *w, const char *name)
+{
+    entry_listed(w);
+    add_dir_name(w, name);
+}
+
+bool scan_check_device(ScanWorker *w, uint64_t dev)
+{
+    ScanContext *ctx = w->ctx;
+    ScanJob *job = w->job;
+    if (!ctx->opts.one_filesystem) return true;
+
+    // Other jobs are only created once the root's listing is done
+    if (!job->parent) {
+        ctx->root_dev = dev;
+        return true;
+    }
+    if (dev == ctx->root_dev) return true;
+    // Siblings publishing into the same parent reorder it under the lock
+    SDL_LockMutex(ctx->mutex);
+    tree_mark_skipped(job->parent->node, job->node, DIR_OTHER_FS);
+    SDL_UnlockMutex(ctx->mutex);
+    return false;
+}
+
+static ScanJob *job_create(DirNode *node, ScanJob *parent)
+{
+    ScanJob *job = calloc(1, sizeof(ScanJob));
+    if (!job) return NULL;
+    job->node = node;
+    job->parent = parent;
+    job->dirfd = -1;
+    job->top = SCAN_NO_TOP;
+    atomic_init(&job->pending, 1);
+    atomic_init(&job->dir_refs, 1);
+    return job;
+}
+
+static void job_release_dir(ScanJob *job)
+{
+    if (job && atomic_fetch_sub(&job->dir_refs, 1) == 1)
+        scan_backend_close(job);
+}
+
+static void wake_all(ScanContext *ctx)
+{
+    SDL_LockMutex(ctx->idle_mutex);
+    SDL_BroadcastCondition(ctx->idle_cond);
+    SDL_UnlockMutex(ctx->idle_mutex);
+}
+
+// Hands a finished directory and its full path to the on_dir callback. An
+// excluded child has no job and goes through its parent's.
+static void report_dir(ScanContext *ctx, const ScanJob *job, const DirNode *excluded)
+{
+    size_t len = excluded ? strlen(excluded->name) + 1 : 0;
+    int depth = excluded ? 0 : -1;
+    for (const ScanJob *j = job; j; j = j->parent, depth++)
+        len += strlen(j->node->name) + 1;
+
+    char *path = malloc(len);
+    if (path && scan_job_path(job, path, len)) {
+        if (excluded) {
+            size_t end = strlen(path);
+            if (end == 0 || path[end - 1] != PATH_SEP) path[end++] = PATH_SEP;
+            strcpy(path + end, excluded->name);
+        }
+        ctx->opts.on_dir(ctx->opts.user, excluded ? excluded : job->node, path, depth);
+    }
+    free(path);
+}
+
+static int cmp_largest_first(const void *a, const void *b)
+{
+    const TopFiles *ta = a, *tb = b;
+    uint64_t sa = ta->items[0].size, sb = tb->items[0].size;
+    return (sa < sb) - (sa > sb);
+}
+
+// Once the root completes every listing has, so the workers' lists are
+// final even though their threads are still running
+static void collect_top_files(ScanContext *ctx)
+{
+    if (!ctx->opts.top_files || !topfiles_init(&ctx->top_files, ctx->opts.top_files))
+        return;
+
+    uint32_t dirs = 0;
+    for (int i = 0; i < ctx->worker_count; i++) {
+        ScanWorker *w = &ctx->workers[i];
+        topfiles_merge(&ctx->top_files, &w->top);
+        if (w->dir_top_count > dirs) dirs = w->dir_top_count;
+    }
+    topfiles_sort(&ctx->top_files);
+    if (!dirs) return;
+
+    TopFiles *tops = calloc(dirs, sizeof(TopFiles));
+    if (!tops) return;
+    uint32_t count = 0;
+    for (uint32_t d = 0; d < dirs; d++) {
+        TopFiles *merged = &tops[count];
+        for (int i = 0; i < ctx->worker_count; i++) {
+            ScanWorker *w = &ctx->workers[i];
+            if (d >= w->dir_top_count || !w->dir_tops[d].count) continue;
+            if (!merged->cap && !topfiles_init(merged, ctx->opts.top_files)) break;
+            topfiles_merge(merged, &w->dir_tops[d]);
+        }
+        if (merged->count) {
+            topfiles_sort(merged);
+            count++;
+        } else {
+            topfiles_free(merged);
+        }
+    }
+    qsort(tops, count, sizeof(TopFiles), cmp_largest_first);
+    ctx->dir_top_files = tops;
+    ctx->dir_top_count = count;
+}
+
+// This scan's own tree and index, so other trees in the process and the
+// tree an expansion goes into don't count against its budget
+static size_t memory_in_use(ScanContext *ctx)
+{
+    int64_t tree = atomic_load_explicit(&ctx->tree_bytes, memory_order_relaxed);
+    return (tree > 0 ? (size_t)tree : 0) +
+           (ctx->search ? search_mem_used(ctx->search) : 0);
+}
+
+// Collapses a directory that just completed, or the smaller and deeper of
+// its subdirectories, as memory gets short. Returns how many nodes went.
+static uint32_t collapse_completed(ScanContext *ctx, const ScanJob *job)
+{
+    size_t used = memory_in_use(ctx), budget = ctx->opts.memory_budget;
+    if (used < budget / 100 * COLLAPSE_START_PCT) return 0;
+    if (used >= budget && job->parent) return tree_collapse(job->node);
+
+    uint32_t depth = 1;
+    for (const ScanJob *j = job->parent; j; j = j->parent)
+        depth++;
+    bool all = used >= budget || depth >= COLLAPSE_DEPTH;
+
+    DirNode *node = job->node;
+    uint32_t count = tree_child_count(node), dropped = 0;
+    DirNode *children = tree_children(node);
+    for (uint32_t i = 0; i < count; i++) {
+        if (all || children[i].size < node->size / COLLAPSE_SHARE)
+            dropped += tree_collapse(&children[i]);
+    }
+    return dropped;
+}
+
+// Compares a directory that just completed with its counterpart in the
+// rescanned tree. If anything differs, the unchanged subdirectories recorded
+// so far take their old subtrees, which count as packed, and the parent is
+// told; otherwise it is recorded with the parent in turn, so only the
+// topmost unchanged ones move. Returns whether it was unchanged.
+static bool reuse_previous(ScanContext *ctx, ScanJob *job)
+{
+    ScanJob *parent = job->parent;
+    const FileStats *had = job->prev ? tree_file_stats(job->prev) : NULL;
+    if (had && (!job->stats || !filestats_equal(had, job->stats)))
+        job->changed = true;
+
+    if (job->changed) {
+        for (uint32_t i = 0; i < job->reuse_count; i++) {
+            ScanReuse *r = &job->reuse[i];
+            tree_take_children(r->node, r->prev);
+            atomic_fetch_add_explicit(&ctx->reused_dirs, r->nodes, memory_order_relaxed);
+        }
+        if (parent) parent->changed = true;
+        return false;
+    }
+    if (!parent) {
+        uint32_t nodes = job->nodes + tree_child_count(job->node);
+        tree_take_children(job->node, job->prev);
+        atomic_fetch_add_explicit(&ctx->reused_dirs, nodes, memory_order_relaxed);
+    }
+    return true;
+}
+
+// Drops one pending unit; whoever drops the last one completes the directory
+// and hands its totals to the parent, which may complete in turn.
+static void job_finish(ScanContext *ctx, ScanJob *job)
+{
+    while (job && atomic_fetch_sub(&job->pending, 1) == 1) {
+        ScanJob *parent = job->parent;
+        DirNode *node = job->node;
+
+        // Before done is set, so the last report lands before anyone sees it
+        if (ctx->opts.on_dir) report_dir(ctx, job, NULL);
+
+        SDL_LockMutex(ctx->mutex);
+        if (ctx->opts.prune) tree_clear_children(node);
+        node->complete = true;
+        bool reused = ctx->previous && reuse_previous(ctx, job);
+        if (parent) tree_sort_children(node);
+        if (ctx->opts.memory_budget && !ctx->opts.prune) {
+            uint32_t dropped = collapse_completed(ctx, job);
+            job->nodes -= dropped;
+            if (job->loose > job->nodes) job->loose = job->nodes;
+        }
+
+        // Repacking whenever most of a subtree is still loose copies each
+        // directory only a logarithmic number of times; the root always is,
+        // so the finished tree is one pack. A rescan's root only when most
+        // of it is new, as the packs it kept stay whole until they empty.
+        uint32_t count = tree_child_count(node);
+        job->nodes += count;
+        job->loose += reused ? 0 : count;
+        bool most = job->loose >= job->nodes / 2;
+        bool repack = !ctx->opts.prune && !reused &&
+                      (parent ? job->nodes >= REPACK_MIN && most
+                              : !ctx->previous || most);
+        if (repack) tree_repack(node);
+        if (reused && parent && job->nodes) {
+            if (!parent->reuse)
+                parent->reuse = malloc(tree_child_count(parent->node) * sizeof(ScanReuse));
+            if (parent->reuse)
+                parent->reuse[parent->reuse_count++] = (ScanReuse){node, job->prev, job->nodes};
+        }
+
+        FileStats *stats = job->stats;
+        if (stats && (!parent || node->size >= STATS_KEEP_MIN))
+            tree_set_file_stats(node, stats);
+        if (parent && stats && !parent->stats) {
+            parent->stats = stats;
+            stats = NULL;
+        } else if (parent && stats) {
+            filestats_merge(parent->stats, stats);
+        }
+        free(stats);
+
+        if (parent) {
+            parent->nodes += job->nodes;
+            parent->loose += repack ? 0 : job->loose;
+            tree_add_size(parent->parent ? parent->parent->node : NULL,
+                          parent->node, node->size);
+            parent->node->file_count += node->file_count;
+        } else {
+            tree_free(ctx->previous);
+            ctx->previous = NULL;
+            collect_top_files(ctx);
+            atomic_store(&ctx->total_size, node->size);
+            atomic_store(&ctx->done, true);
+        }
+        SDL_UnlockMutex(ctx->mutex);
+
+        if (!parent) wake_all(ctx);
+        free(job->reuse);
+        free(job);
+        job = parent;
+    }
+}
+
+void scan_hints_add(ScanHints *hints, const DirNode *node, float weight)
+{
+    if (hints->count < SCAN_HINT_MAX) {
+        hints->items[hints->count++] = (ScanHint){node, weight};
+        return;
+    }
+    int lightest = 0;
+    for (int i = 1; i < hints->count; i++) {
+        if (hints->items[i].weight < hints->items[lightest].weight)
+            lightest = i;
+    }
+    if (weight > hints->items[lightest].weight)
+        hints->items[lightest] = (ScanHint){node, weight};
+}
+
+void scanner_set_hints(ScanContext *ctx, const ScanHints *hints)
+{
+    if (!ctx || !ctx->hot || atomic_load(&ctx->done)) return;
+
+    uint64_t now = SDL_GetTicks();
+    if (ctx->hints_at && now - ctx->hints_at < HINT_INTERVAL_MS) return;
+    ctx->hints_at = now;
+
+    // Only this thread writes ctx->hints, so comparing needs no lock
+    bool same = hints->count == ctx->hints.count;
+    for (int i = 0; same && i < hints->count; i++)
+        same = hints->items[i].node == ctx->hints.items[i].node;
+    if (same) return;
+
+    SDL_LockMutex(ctx->hint_mutex);
+    ctx->hints = *hints;
+    atomic_fetch_add(&ctx->hint_gen, 1);
+    SDL_UnlockMutex(ctx->hint_mutex);
+}
+
+static uint32_t hint_slot(const DirNode *node)
+{
+    // Nodes are a cache line each, so the low bits carry nothing
+    uint32_t key = (uint32_t)((uintptr_t)node >> 6);
+    return (key * 2654435761u) >> (32 - SCAN_HINT_BITS);
+}
+
+static void index_hints(ScanWorker *w)
+{
+    memset(w->hint_slots, -1, sizeof(w->hint_slots));
+    for (int i = 0; i < w->hints.count; i++) {
+        uint32_t s = hint_slot(w->hints.items[i].node);
+        while (w->hint_slots[s] >= 0) s = (s + 1) & (SCAN_HINT_SLOTS - 1);
+        w->hint_slots[s] = (int8_t)i;
+    }
+}
+
+static const ScanHint *find_hint(const ScanWorker *w, const DirNode *node)
+{
+    for (uint32_t s = hint_slot(node);; s = (s + 1) & (SCAN_HINT_SLOTS - 1)) {
+        int i = w->hint_slots[s];
+        if (i < 0) return NULL;
+        if (w->hints.items[i].node == node) return &w->hints.items[i];
+    }
+}
+
+// Priority from the nearest hinted ancestor, 0 if there is none. Closer
+// descendants go first so the visible levels fill in top-down. Hinted nodes
+// are only compared by address, never dereferenced.
+static float job_priority(const ScanWorker *w, const ScanJob *job)
+{
+    if (w->hints.count == 0) return 0;
+    float distance = 1;
+    for (const ScanJob *j = job; j; j = j->parent, distance++) {
+        const ScanHint *hint = find_hint(w, j->node);
+        if (hint) return hint->weight / distance;
+    }
+    return 0;
+}
+
+// Takes the new hints, then moves newly hot jobs from this worker's deque
+// to the shared heap and, if no one has yet, re-ranks the heap, handing
+// jobs that went cold back to this deque.
+static void refresh_hints(ScanWorker *w)
+{
+    ScanContext *ctx = w->ctx;
+    SDL_LockMutex(ctx->hint_mutex);
+    w->hints = ctx->hints;
+    w->hint_gen = atomic_load(&ctx->hint_gen);
+    SDL_UnlockMutex(ctx->hint_mutex);
+    index_hints(w);
+
+    // Hot jobs leave from the thief end; the rest close up behind them
+    ScanHeapEntry moved[HINT_RERANK_MAX];
+    uint32_t moved_count = 0;
+    ScanDeque *d = &w->deque;
+    SDL_LockMutex(d->lock);
+    uint32_t n = d->tail - d->head;
+    if (n > HINT_RERANK_MAX) n = HINT_RERANK_MAX;
+    if (w->hints.count) {
+        uint32_t kept = n;
+        for (uint32_t i = n; i-- > 0;) {
+            ScanJob *job = d->items[(d->head + i) % d->cap];
+            float priority = job_priority(w, job);
+            if (priority > 0)
+                moved[moved_count++] = (ScanHeapEntry){job, priority};
+            else
+                d->items[(d->head + --kept) % d->cap] = job;
+        }
+        d->head += moved_count;
+    }
+    SDL_UnlockMutex(d->lock);
+
+    for (uint32_t i = 0; i < moved_count; i++) {
+        if (!heap_push(ctx->hot, moved[i].job, moved[i].priority))
+            deque_push(d, moved[i].job);
+    }
+
+    ScanHeap *h = ctx->hot;
+    ScanJob **cold = NULL;
+    uint32_t cold_count = 0;
+    SDL_LockMutex(h->lock);
+    if ((int)(w->hint_gen - h->gen) > 0) {
+        h->gen = w->hint_gen;
+        cold = h->count ? malloc(h->count * sizeof(ScanJob *)) : NULL;
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < h->count; i++) {
+            float priority = job_priority(w, h->items[i].job);
+            if (priority > 0 || !cold)
+                h->items[kept++] = (ScanHeapEntry){h->items[i].job,
+                                                   priority > 0 ? priority : 0};
+            else
+                cold[cold_count++] = h->items[i].job;
+        }
+        h->count = kept;
+        for (uint32_t i = kept / 2; i-- > 0;)
+            heap_sift_down(h, i);
+        atomic_store_explicit(&h->size, h->count, memory_order_relaxed);
+    }
+    SDL_UnlockMutex(h->lock);
+
+    for (uint32_t i = 0; i < cold_count; i++) {
+        if (!deque_push(d, cold[i]))
+            heap_push(h, cold[i], 0);
+    }
+    free(cold);
+}
+
+static void wake_idle(ScanContext *ctx)
+{
+    if (atomic_load(&ctx->sleeping) == 0) return;
+    wake_all(ctx);
+}
+
+static void push_job(ScanWorker *w, ScanJob *job)
+{
+    ScanContext *ctx = w->ctx;
+    float priority = job_priority(w, job);
+    if (!(priority > 0 && heap_push(ctx->hot, job, priority)) &&
+        !deque_push(&w->deque, job)) {
+        job_release_dir(job->parent);
+        job_finish(ctx, job);
+        return;
+    }
+    atomic_fetch_add(&ctx->queued, 1);
+    wake_idle(ctx);
+}
+
+// Whether a directory just listed differs from its counterpart in the
+// rescanned tree: in the files directly in it, or in its subdirectories
+static bool listing_changed(const DirNode *node, const DirNode *prev)
+{
+    if (!prev || atomic_load(&prev->kind) != NODE_SCANNED || !prev->complete)
+        return true;
+    uint32_t count = tree_child_count(node);
+    if (count != tree_child_count(prev)) return true;
+
+    uint64_t size = prev->size;
+    uint32_t files = prev->file_count;
+    DirNode *children = tree_children(node), *prev_children = tree_children(prev);
+    for (uint32_t i = 0; i < count; i++) {
+        size -= prev_children[i].size;
+        files -= prev_children[i].file_count;
+    }
+    if (node->size != size || node->file_count != files) return true;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const DirNode *match = tree_find_child(prev, children[i].name);
+        if (!match || match->skip != children[i].skip) return true;
+    }
+    return false;
+}
+
+static void process_job(ScanWorker *w, ScanJob *job)
+{
+    ScanContext *ctx = w->ctx;
+    DirNode *node = job->node;
+    uint32_t first = node->child_count;
+
+    w->job = job;
+    w->size = 0;
+    w->files = 0;
+    w->names_len = 0;
+    w->dir_count = 0;
+    w->unpublished = 0;
+    w->published_at = SDL_GetTicks();
+
+    if (!atomic_load_explicit(&ctx->cancel, memory_order_relaxed)) {
+        if (ctx->open_slots) {
+            uint64_t started = SDL_GetTicksNS();
+            SDL_WaitSemaphore(ctx->open_slots);
+            atomic_fetch_add_explicit(&ctx->throttled_ns, SDL_GetTicksNS() - started,
+                                      memory_order_relaxed);
+        }
+        scan_backend_list(w, job);
+        if (ctx->open_slots) SDL_SignalSemaphore(ctx->open_slots);
+    }
+    job_release_dir(job->parent);
+
+    publish(w);
+    w->job = NULL;
+    // Set before any subdirectory is queued, which may then set it too
+    job->changed = first || atomic_load(&ctx->cancel) || listing_changed(node, job->prev);
+
+    // Excluded children were completed as they were added
+    uint32_t added = node->child_count - first, jobs = 0;
+    DirNode *children = tree_children(node);
+    uint32_t records = ctx->search && added
+        ? search_add_dirs(ctx->search, job->search_id, &children[first], added)
+        : SEARCH_NONE;
+    for (uint32_t i = 0; i < added; i++)
+        jobs += children[first + i].skip == DIR_SCANNED;
+    atomic_fetch_add(&job->pending, jobs);
+    for (uint32_t i = 0; i < added; i++) {
+        DirNode *child_node = &children[first + i];
+        if (child_node->skip != DIR_SCANNED) {
+            if (ctx->opts.on_dir) report_dir(ctx, job, child_node);
+            continue;
+        }
+        ScanJob *child = job_create(child_node, job);
+        if (!child) {
+            job_finish(ctx, job);
+            continue;
+        }
+        child->top = job->parent ? job->top : first + i;
+        child->search_id = records == SEARCH_NONE ? SEARCH_NONE : records + i;
+        if (job->prev) child->prev = tree_find_child(job->prev, child_node->name);
+        if (ctx->opts.exclude)
+            child->exclude_state = exclude_step(ctx->opts.exclude, job->exclude_state,
+                                                child_node->name);
+        atomic_fetch_add(&job->dir_refs, 1);
+        push_job(w, child);
+    }
+
+    job_release_dir(job);
+    job_finish(ctx, job);
+}
+
+static ScanJob *find_job(ScanWorker *w)
+{
+    ScanContext *ctx = w->ctx;
+    if (atomic_load_explicit(&ctx->hint_gen, memory_order_relaxed) != w->hint_gen)
+        refresh_hints(w);
+
+    ScanJob *job = NULL;
+    if (atomic_load_explicit(&ctx->hot->size, memory_order_relaxed) > 0) {
+        job = heap_pop(ctx->hot);
+        if (job) atomic_fetch_add_explicit(&ctx->hinted_dirs, 1, memory_order_relaxed);
+    }
+    if (!job) job = deque_pop(&w->deque);
+    for (int i = 1; !job && i < ctx->worker_count; i++)
+        job = deque_steal(&ctx->workers[(w->index + i) % ctx->worker_count].deque);
+    if (job) atomic_fetch_sub(&ctx->queued, 1);
+    return job;
+}
+
+static int worker_fn(void *data)
+{
+    ScanWorker *w = data;
+    ScanContext *ctx = w->ctx;
+
+    scan_backend_worker_init(w);
+    tree_mem_account(&ctx->tree_bytes);
+    for (;;) {
+        ScanJob *job = find_job(w);
+        if (job) {
+            process_job(w, job);
+            continue;
+        }
+
+        SDL_LockMutex(ctx->idle_mutex);
+        atomic_fetch_add(&ctx->sleeping, 1);
+        bool finished = atomic_load(&ctx->done) || atomic_load(&ctx->cancel);
+        if (!finished && atomic_load(&ctx->queued) == 0)
+            SDL_WaitCondition(ctx->idle_cond, ctx->idle_mutex);
+        atomic_fetch_sub(&ctx->sleeping, 1);
+        SDL_UnlockMutex(ctx->idle_mutex);
+
+        // Cancelled workers keep draining their deque so every job completes
+        if (finished && atomic_load(&ctx->queued) == 0) break;
+    }
+    tree_mem_account(NULL);
+    scan_backend_worker_free(w);
+    return 0;
+}
+
+ScanContext *scanner_start(const char *path)
+{
+    return scanner_start_opts(path, NULL);
+}
+
+static ScanContext *start(const char *path, const ScanOptions *opts,
+                          DirNode *previous)
+{
+    ScanContext *ctx = calloc(1, sizeof(ScanContext));
+    if (!ctx) return NULL;
+
+    if (opts) ctx->opts = *opts;
+    int threads = ctx->opts.threads;
+    if (threads <= 0) threads = SDL_GetNumLogicalCPUCores();
+    if (threads <= 0) threads = 1;
+
+    ctx->mutex = SDL_CreateMutex();
+    ctx->idle_mutex = SDL_CreateMutex();
+    ctx->idle_cond = SDL_CreateCondition();
+    ctx->hint_mutex = SDL_CreateMutex();
+    ctx->hot = heap_create();
+    if (ctx->opts.max_open_dirs > 0)
+        ctx->open_slots = SDL_CreateSemaphore((Uint32)ctx->opts.max_open_dirs);
+    ctx->root = tree_create(path);
+    ctx->workers = calloc(threads, sizeof(ScanWorker));
+    if (ctx->opts.name_index) ctx->search = search_create();
+    if (!ctx->root || !ctx->workers || !ctx->hot ||
+        (ctx->opts.name_index && !ctx->search)) {
+        tree_free(ctx->root);
+        search_free(ctx->search);
+        free(ctx->workers);
+        heap_destroy(ctx->hot);
+        SDL_DestroySemaphore(ctx->open_slots);
+        SDL_DestroyMutex(ctx->hint_mutex);
+        SDL_DestroyCondition(ctx->idle_cond);
+        SDL_DestroyMutex(ctx->idle_mutex);
+        SDL_DestroyMutex(ctx->mutex);
+        free(ctx);
+        return NULL;
+    }
+    ctx->worker_count = threads;
+    ctx->previous = previous;
+
+    for (int i = 0; i < threads; i++) {
+        ctx->workers[i].ctx = ctx;
+        ctx->workers[i].index = i;
+        deque_init(&ctx->workers[i].deque);
+        topfiles_init(&ctx->workers[i].top, ctx->opts.top_files);
+    }
+
+    ScanJob *root = job_create(ctx->root, NULL);
+    if (root) {
+        root->search_id = SEARCH_ROOT;
+        root->prev = previous;
+        root->exclude_state = exclude_start(ctx->opts.exclude, path);
+        deque_push(&ctx->workers[0].deque, root);
+        atomic_store(&ctx->queued, 1);
+    } else {
+        ctx->root->complete = true;
+        atomic_store(&ctx->done, true);
+    }
+
+    for (int i = 0; i < threads; i++)
+        ctx->workers[i].thread = SDL_CreateThread(worker_fn, "scanner",
+                                                  &ctx->workers[i]);
+    return ctx;
+}
+
+ScanContext *scanner_start_opts(const char *path, const ScanOptions *opts)
+{
+    return start(path, opts, NULL);
+}
+
+ScanContext *scanner_rescan(ScanContext *prev)
+{
+    if (!prev) return NULL;
+
+    char *path = strdup(prev->root->name);
+    if (!path) {
+        scanner_free(prev);
+        return NULL;
+    }
+    ScanOptions opts = prev->opts;
+
+    // A cancelled scan has directories marked complete that weren't listed.
+    // Pruned trees have nothing to keep, and a budgeted scan would count
+    // against its budget only what it took, not the whole previous tree.
+    DirNode *previous = NULL;
+    if (atomic_load(&prev->done) && !atomic_load(&prev->cancel) && !prev->snapshot &&
+        !opts.prune && !opts.memory_budget &&
+        atomic_load(&prev->root->kind) == NODE_SCANNED) {
+        previous = prev->root;
+        prev->root = NULL;
+    }
+    scanner_free(prev);
+
+    ScanContext *ctx = start(path, &opts, previous);
+    if (!ctx) tree_free(previous);
+    free(path);
+    return ctx;
+}
+
+ScanContext *scanner_adopt(DirNode *root)
+{
+    ScanContext *ctx = calloc(1, sizeof(ScanContext));
+    if (!ctx) return NULL;
+    ctx->mutex = SDL_CreateMutex();
+    ctx->root = root;
+    root->complete = true;
+    atomic_store(&ctx->total_size, root->size);
+    atomic_store(&ctx->total_files, root->file_count);
+    atomic_store(&ctx->done, true);
+    return ctx;
+}
+
+ScanOptions scanner_sub_options(const ScanContext *ctx)
+{
+    // Only the tree comes back, so nothing else is collected
+    ScanOptions opts = ctx->opts;
+    opts.on_dir = NULL;
+    opts.user = NULL;
+    opts.top_files = 0;
+    opts.top_files_per_dir = false;
+    opts.name_index = false;
+    return opts;
+}
+
+ScanContext *scanner_expand(ScanContext *ctx, const DirNode *node)
+{
+    // A snapshot's summaries stay as saved; the disk may have moved on
+    char path[4096];
+    if (!atomic_load(&ctx->done) || ctx->snapshot ||
+        node->kind != NODE_COLLAPSED || !tree_path(node, path, sizeof(path)))
+        return NULL;
+
+    ScanOptions opts = scanner_sub_options(ctx);
+    return scanner_start_opts(path, &opts);
+}
+
+// The directory at path, which starts with the root's name
+static DirNode *find_path(DirNode *root, const char *path)
+{
+    size_t len = strlen(root->name);
+    if (strncmp(path, root->name, len) != 0) return NULL;
+    char *rest = strdup(path + len);
+    if (!rest) return NULL;
+
+    DirNode *node = root;
+    for (char *at = rest; node && *at;) {
+        char *end = strchr(at, PATH_SEP);
+        if (end) *end = '\0';
+        if (*at) node = tree_find_child(node, at);
+        at = end ? end + 1 : at + strlen(at);
+    }
+    free(rest);
+    return node;
+}
+
+bool scanner_expand_finish(ScanContext *ctx, ScanContext *sub)
+{
+    if (!sub) return false;
+    DirNode *graft = atomic_load(&sub->done) && !atomic_load(&sub->cancel)
+                   ? sub->root : NULL;
+
+    SDL_LockMutex(ctx->mutex);
+    DirNode *node = graft ? find_path(ctx->root, graft->name) : NULL;
+    bool ok = node && node->kind == NODE_COLLAPSED;
+    if (ok) {
+        int64_t dsize = (int64_t)graft->size - (int64_t)node->size;
+        int64_t dfiles = (int64_t)graft->file_count - (int64_t)node->file_count;
+        sub->root = NULL;
+        tree_graft(node, graft);
+
+        // Whatever changed since the first listing reaches every ancestor
+        for (DirNode *n = tree_parent(node); n; n = tree_parent(n)) {
+            atomic_fetch_add(&n->size, (uint64_t)dsize);
+            atomic_fetch_add(&n->file_count, (uint32_t)dfiles);
+        }
+        atomic_fetch_add(&ctx->total_size, (uint64_t)dsize);
+        atomic_fetch_add(&ctx->total_files, (uint32_t)dfiles);
+
+        // Deepest first: sorting a level moves the node below it, which is done
+        for (DirNode *n = node; n;) {
+            DirNode *parent = tree_parent(n);
+            tree_sort_children(n);
+            n = parent;
+        }
+    }
+    SDL_UnlockMutex(ctx->mutex);
+    scanner_free(sub);
+    return ok;
+}
+
+static void join_workers(ScanContext *ctx)
+{
+    for (int i = 0; i < ctx->worker_count; i++) {
+        SDL_WaitThread(ctx->workers[i].thread, NULL);
+        ctx->workers[i].thread = NULL;
+    }
+}
+
+void scanner_cancel(ScanContext *ctx)
+{
+    if (!ctx) return;
+    atomic_store(&ctx->cancel, true);
+    wake_all(ctx);
+    join_workers(ctx);
+}
+
+void scanner_wait(ScanContext *ctx)
+{
+    if (ctx) join_workers(ctx);
+}
+
+void scanner_free(ScanContext *ctx)
+{
+    if (!ctx) return;
+    if (!atomic_load(&ctx->done)) scanner_cancel(ctx);
+    else join_workers(ctx);
+    for (int i = 0; i < ctx->worker_count; i++) {
+        deque_destroy(&ctx->workers[i].deque);
+        free(ctx->workers[i].names);
+        topfiles_free(&ctx->workers[i].top);
+        for (uint32_t d = 0; d < ctx->workers[i].dir_top_count; d++)
+            topfiles_free(&ctx->workers[i].dir_tops[d]);
+        free(ctx->workers[i].dir_tops);
+    }
+    topfiles_free(&ctx->top_files);
+    for (uint32_t d = 0; d < ctx->dir_top_count; d++)
+        topfiles_free(&ctx->dir_top_files[d]);
+    free(ctx->dir_top_files);
+    search_free(ctx->search);
+    free(ctx->workers);
+    tree_free(ctx->root);
+    tree_free(ctx->previous);
+    snapshot_close(ctx->snapshot);
+    heap_destroy(ctx->hot);
+    SDL_DestroySemaphore(ctx->open_slots);
+    SDL_DestroyMutex(ctx->hint_mutex);
+    SDL_DestroyCondition(ctx->idle_cond);
+    SDL_DestroyMutex(ctx->idle_mutex);
+    SDL_DestroyMutex(ctx->mutex);
+    free(ctx);
+}
@@ -1,17 +1,132 @@
 #pragma once
 #include "tree.h"
+#include "exclude.h"
+#include "topfiles.h"
+#include "search.h"
 #include <SDL3/SDL_mutex.h>
+#include <stdatomic.h>
+
+typedef struct ScanWorker ScanWorker;
+typedef struct ScanHeap ScanHeap;
+
+#define SCAN_HINT_MAX 64
+
+// Incomplete directories the user is looking at. Their unscanned
+// subdirectories are taken ahead of the regular depth-first order. Once the
+// scan is done, collapsed ones instead, to be expanded.
+typedef struct {
+    const DirNode *node;
+    float          weight;      // on-screen width in pixels, more if hovered
+} ScanHint;
+
+typedef struct {
+    ScanHint items[SCAN_HINT_MAX];
+    int      count;
+} ScanHints;
+
+// Called from a worker thread as each directory completes, children first
+typedef void (*ScanDirFn)(void *user, const DirNode *node, const char *path,
+                          int depth);
+
+typedef struct {
+    int threads;            // worker count, 0 = one per logical core
+    bool io_uring;          // batch stat calls through io_uring where supported
+    ScanDirFn on_dir;
+    void *user;
+    bool prune;             // free each directory's children once it completes
+
+    // Gentle scans of busy hosts. All off by default.
+    uint32_t max_stat_rate; // entries listed per second across all workers
+    int max_open_dirs;      // directories being listed at once
+    bool low_priority;      // idle I/O class and lowest CPU priority for workers
+    bool adaptive;          // back off when a syscall takes far longer than usual
+
+    // Directories left out as placeholders. exclude belongs to the caller and
+    // must outlive the scan and any rescan of it.
+    bool one_filesystem;    // don't cross into mounts with another st_dev
+    const ScanExclude *exclude;
+
+    // The largest files seen, overall and within each subdirectory of the
+    // root. 0 keeps none.
+    uint32_t top_files;
+    bool top_files_per_dir;
+
+    // Index directory names as they are listed, for search_find
+    bool name_index;
+
+    // Bytes the trees and name index should stay within, 0 for no limit.
+    // Completed subtrees are collapsed into summaries as it nears; see
+    // scanner_expand for getting one back.
+    size_t memory_budget;
+} ScanOptions;
 
 typedef struct {
     DirNode      *root;
-    SDL_Mutex    *mutex;
-    SDL_Thread   *thread;
-    bool          cancel;
-    bool          done;
-    uint64_t      total_size;
-    uint32_t      total_files;
+    SDL_Mutex    *mutex;        // serializes tree writers; readers use tree_read_begin
+    atomic_bool   cancel;
+    atomic_bool   done;
+    _Atomic uint64_t total_size;
+    _Atomic uint32_t total_files;
+
+    ScanOptions   opts;
+    ScanWorker   *workers;
+    int           worker_count;
+    SDL_Mutex    *idle_mutex;
+    SDL_Condition *idle_cond;
+    atomic_int    queued;
+    atomic_int    sleeping;
+
+    struct Snapshot *snapshot;  // backing file of a tree opened from disk
+
+    SDL_Mutex    *hint_mutex;
+    ScanHints     hints;
+    atomic_uint   hint_gen;     // bumped whenever hints change
+    uint64_t      hints_at;
+    ScanHeap     *hot;          // jobs under hinted directories, by priority
+    _Atomic uint32_t hinted_dirs;
+
+    _Atomic uint64_t rate_next; // when the next batch of entries may start
+    SDL_Semaphore *open_slots;  // max_open_dirs listings, NULL if unlimited
+    _Atomic uint64_t throttled_ns; // worker time spent waiting on the limits
+    uint64_t      root_dev;     // device of the root, for one_filesystem
+
+    // Filled from the workers' lists as the root completes; read once done
+    TopFiles      top_files;
+    TopFiles     *dir_top_files;    // largest file first, empty ones left out
+    uint32_t      dir_top_count;
+
+    SearchIndex  *search;       // NULL unless opts.name_index
+    _Atomic int64_t tree_bytes; // in blocks the workers made, for memory_budget
+
+    DirNode      *previous;     // tree being rescanned, freed as the root completes
+    _Atomic uint32_t reused_dirs;   // directories taken from it
 } ScanContext;
 
 ScanContext *scanner_start(const char *path);
+ScanContext *scanner_start_opts(const char *path, const ScanOptions *opts);
+ScanContext *scanner_adopt(DirNode *root);      // wraps a built tree as finished
+// Scans prev's root again with the same options. Consumes prev. Every
+// directory is still listed, but where one comes out the same as in prev's
+// tree, down to its last subdirectory, that subtree is kept rather than the
+// new one; see ScanContext.reused_dirs.
+ScanContext *scanner_rescan(ScanContext *prev);
 void         scanner_cancel(ScanContext *ctx);
+// Blocks until the scan is done, or cancelled and drained
+void         scanner_wait(ScanContext *ctx);
+// ctx's options for scanning a part of its tree again: no callbacks, and
+// nothing only a whole scan collects
+ScanOptions  scanner_sub_options(const ScanContext *ctx);
+
+// Lists a collapsed directory of ctx's finished tree again, in a scan of its
+// own with ctx's options; once that is done, scanner_expand_finish puts what
+// it found in place. Called in a read section.
+ScanContext *scanner_expand(ScanContext *ctx, const DirNode *node);
+// Grafts a finished expansion over its directory, if that is still there and
+// collapsed, and frees it
+bool         scanner_expand_finish(ScanContext *ctx, ScanContext *sub);
+
+// Keeps the heaviest SCAN_HINT_MAX hints; called while drawing a frame
+void         scan_hints_add(ScanHints *hints, const DirNode *node, float weight);
+// Publishes a frame's hints to the workers, at most every few frames
+void         scanner_set_hints(ScanContext *ctx, const ScanHints *hints);
 void         scanner_free(ScanContext *ctx);
@@ -0,0 +1,123 @@
+#pragma once
+#include "scanner.h"
+#include <SDL3/SDL_thread.h>
+#include <SDL3/SDL_timer.h>
+#include <stddef.h>
+
+// Interface between the worker pool in scanner.c and the platform code that
+// lists a single directory (scanner_posix.c, scanner_win32.c).
+
+typedef struct ScanJob {
+    DirNode        *node;
+    struct ScanJob *parent;
+    atomic_uint     pending;    // own listing + subdirectories not yet complete
+    int             dirfd;      // open directory handle for children, -1 if none
+    atomic_uint     dir_refs;   // own listing + children that haven't opened yet
+    uint64_t        exclude_state;  // exclusion patterns matched this far
+    uint32_t        nodes;      // directories below node, complete ones so far
+    uint32_t        loose;      // those of them not yet repacked
+    FileStats      *stats;      // own files, then those of completed subdirectories
+    uint32_t        top;        // subdirectory of the root it is in, SCAN_NO_TOP for the root
+    uint32_t        search_id;  // record in the name index
+    DirNode        *prev;       // same directory in the rescanned tree, if any
+    bool            changed;    // differs from prev, itself or somewhere below
+    struct ScanReuse *reuse;    // unchanged subdirectories, once complete
+    uint32_t        reuse_count;
+} ScanJob;
+
+// A subdirectory that came out the same as in the rescanned tree, with the
+// directories below it
+typedef struct ScanReuse {
+    DirNode        *node;
+    DirNode        *prev;
+    uint32_t        nodes;
+} ScanReuse;
+
+#define SCAN_NO_TOP UINT32_MAX
+
+// Hinted nodes are looked up by address in a table twice the hints' size
+#define SCAN_HINT_BITS  7
+#define SCAN_HINT_SLOTS (1u << SCAN_HINT_BITS)
+
+typedef struct {
+    SDL_Mutex  *lock;
+    ScanJob   **items;
+    uint32_t    head, tail, cap;
+} ScanDeque;
+
+typedef struct {
+    ScanJob    *job;
+    float       priority;
+} ScanHeapEntry;
+
+// Max-heap shared by all workers, checked before their own deques
+struct ScanHeap {
+    SDL_Mutex     *lock;
+    ScanHeapEntry *items;
+    uint32_t       count, cap;
+    atomic_uint    size;        // count, readable without the lock
+    unsigned       gen;         // hint generation the priorities belong to
+};
+
+struct ScanWorker {
+    ScanContext *ctx;
+    SDL_Thread  *thread;
+    ScanDeque    deque;
+    int          index;
+    void        *backend;   // per-worker backend state, owned by its thread
+
+    // Accumulated while listing job, published to the tree in batches
+    ScanJob     *job;
+    uint64_t     size;
+    uint32_t     files;
+    char        *names;
+    size_t       names_len, names_cap;
+    uint32_t     dir_count;
+    uint32_t     unpublished;
+    uint64_t     published_at;
+
+    ScanHints    hints;     // local copy of ctx->hints as of hint_gen
+    int8_t       hint_slots[SCAN_HINT_SLOTS];   // index into hints, -1 if empty
+    unsigned     hint_gen;
+
+    uint32_t     rate_credit;   // entries left before taking another rate slot
+    uint64_t     latency_avg;   // moving average of timed syscalls, ns
+
+    // Largest files this worker listed, merged into the context's at the end
+    TopFiles     top;
+    TopFiles    *dir_tops;      // by ScanJob.top, grown as needed
+    uint32_t     dir_top_count;
+};
+
+// Implemented by the platform backend. list may leave job->dirfd open for
+// the children to open relative to; close releases it once they all have.
+void scan_backend_worker_init(ScanWorker *w);
+void scan_backend_worker_free(ScanWorker *w);
+void scan_backend_list(ScanWorker *w, ScanJob *job);
+void scan_backend_close(ScanJob *job);
+
+static inline bool scan_cancelled(const ScanWorker *w)
+{
+    return atomic_load_explicit(&w->ctx->cancel, memory_order_relaxed);
+}
+
+// Called by the backend for each entry of the directory being listed
+void scan_add_file(ScanWorker *w, const char *name, uint64_t size);
+void scan_add_dir(ScanWorker *w, const char *name);
+
+// Called by the backend once the directory is open, before its entries.
+// The directory is left unlisted when scan_check_device returns false.
+bool scan_check_device(ScanWorker *w, uint64_t dev);
+
+// Adaptive throttling: the backend brackets its blocking calls with these.
+// scan_clock returns 0 when the option is off and the call isn't timed.
+static inline uint64_t scan_clock(const ScanWorker *w)
+{
+    return w->ctx->opts.adaptive ? SDL_GetTicksNS() : 0;
+}
+void scan_syscall_done(ScanWorker *w, uint64_t started);
+// count calls made together since started, such as an io_uring batch
+void scan_syscalls_done(ScanWorker *w, uint64_t started, unsigned count);
+
+// Rebuilds the full path of a job from its ancestors, false if it doesn't fit
+bool scan_job_path(const ScanJob *job, char *buf, size_t cap);
@@ -1,99 +1,242 @@
-#include "scanner.h"
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+#include "scanner_backend.h"
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <sys/stat.h>
-#include <stdlib.h>
+#include <unistd.h>
 #include <string.h>
-#include <stdio.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#ifdef __APPLE__
+#include <pthread.h>
+#endif
+#ifdef ZOOMFOLDER_IO_URING
+#include "scanner_uring.h"
+#endif
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#define DIR_OPEN_FLAGS (O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+
+#ifdef __linux__
+// From linux/ioprio.h, which older headers lack
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE  3
+#define IOPRIO_CLASS_SHIFT 13
+#endif
+
+static bool is_dot(const char *name)
+{
+    return name[0] == '.' &&
+           (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
 
-static void scan_dir(ScanContext *ctx, DirNode *node, const char *path)
+// Opens relative to the parent's descriptor so the kernel resolves a single
+// component; the full path is only rebuilt for the root or when out of fds.
+static int open_dir(const ScanJob *job)
 {
-    DIR *dir = opendir(path);
-    if (!dir) return;
+    if (job->parent && job->parent->dirfd >= 0) {
+        int fd = openat(job->parent->dirfd, job->node->name, DIR_OPEN_FLAGS);
+        if (fd >= 0 || (errno != EMFILE && errno != ENFILE))
+            return fd;
+    }
 
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (ctx->cancel) break;
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-            continue;
+    char path[PATH_MAX];
+    if (!scan_job_path(job, path, sizeof(path))) return -1;
+    return open(path, DIR_OPEN_FLAGS);
+}
 
-        char fullpath[4096];
-        snprintf(fullpath, sizeof(fullpath), "%s/%s", path, entry->d_name);
+#ifdef __linux__
 
-        struct stat st;
-        if (lstat(fullpath, &st) != 0) continue;
-
-        if (S_ISDIR(st.st_mode)) {
-            SDL_LockMutex(ctx->mutex);
-            DirNode *child = tree_add_child(node, entry->d_name);
-            SDL_UnlockMutex(ctx->mutex);
-
-            if (child)
-                scan_dir(ctx, child, fullpath);
-
-            SDL_LockMutex(ctx->mutex);
-            if (child) {
-                node->size += child->size;
-                node->file_count += child->file_count;
-                tree_sort_children(child);
-                child->complete = true;
+struct linux_dirent64 {
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+#define DENTS_BUF_SIZE (64 * 1024)
+#define URING_DEPTH    256
+
+static atomic_bool statx_missing;
+
+// Size (and type, when getdents couldn't tell) of one entry, nothing else
+static bool stat_entry(int dirfd, const char *name, bool need_type,
+                       bool *is_dir, bool *is_reg, uint64_t *size)
+{
+    if (!atomic_load_explicit(&statx_missing, memory_order_relaxed)) {
+        struct statx stx;
+        unsigned int mask = need_type ? STATX_TYPE | STATX_SIZE : STATX_SIZE;
+        if (statx(dirfd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+                  mask, &stx) == 0) {
+            // Without STATX_TYPE in the reply, d_type's answer stands
+            if (stx.stx_mask & STATX_TYPE) {
+                *is_dir = S_ISDIR(stx.stx_mode);
+                *is_reg = S_ISREG(stx.stx_mode);
             }
-            SDL_UnlockMutex(ctx->mutex);
-        } else if (S_ISREG(st.st_mode)) {
-            SDL_LockMutex(ctx->mutex);
-            node->size += st.st_size;
-            node->file_count++;
-            ctx->total_size += st.st_size;
-            ctx->total_files++;
-            SDL_UnlockMutex(ctx->mutex);
+            *size = stx.stx_size;
+            return true;
         }
+        if (errno != ENOSYS) return false;
+        atomic_store_explicit(&statx_missing, true, memory_order_relaxed);
     }
 
-    closedir(dir);
+    struct stat st;
+    if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) return false;
+    *is_dir = S_ISDIR(st.st_mode);
+    *is_reg = S_ISREG(st.st_mode);
+    *size = st.st_size;
+    return true;
+}
+
+static void list_fd(ScanWorker *w, int fd)
+{
+    _Alignas(struct linux_dirent64) char buf[DENTS_BUF_SIZE];
+#ifdef ZOOMFOLDER_IO_URING
+    ScanUring *ring = w->backend;
+#endif
+
+    for (;;) {
+        long n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+        if (n <= 0) break;
+
+        for (long off = 0; off < n;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+            off += d->d_reclen;
+            if (scan_cancelled(w)) break;
+            if (is_dot(d->d_name)) continue;
+
+            bool is_dir = d->d_type == DT_DIR;
+            bool is_reg = d->d_type == DT_REG;
+            uint64_t size = 0;
+#ifdef ZOOMFOLDER_IO_URING
+            if (ring && (d->d_type == DT_UNKNOWN || is_reg)) {
+                scan_uring_statx(ring, w, fd, d->d_name, d->d_type == DT_UNKNOWN);
+                continue;
+            }
+#endif
+            if (d->d_type == DT_UNKNOWN || is_reg) {
+                uint64_t started = scan_clock(w);
+                bool ok = stat_entry(fd, d->d_name, d->d_type == DT_UNKNOWN,
+                                     &is_dir, &is_reg, &size);
+                scan_syscall_done(w, started);
+                if (!ok) continue;
+            }
+
+            if (is_dir)
+                scan_add_dir(w, d->d_name);
+            else if (is_reg)
+                scan_add_file(w, d->d_name, size);
+        }
+
+#ifdef ZOOMFOLDER_IO_URING
+        // Names point into buf, so the batch must land before it is reused
+        if (ring) scan_uring_drain(ring, w);
+#endif
+        if (scan_cancelled(w)) break;
+    }
 }
 
-static int scanner_thread_fn(void *data)
+#else
+
+static void list_fd(ScanWorker *w, int fd)
 {
-    ScanContext *ctx = data;
-    char path[4096];
-    strncpy(path, ctx->root->name, sizeof(path) - 1);
-    path[sizeof(path) - 1] = '\0';
+    int dup_fd = dup(fd);
+    if (dup_fd < 0) return;
+    DIR *dir = fdopendir(dup_fd);
+    if (!dir) {
+        close(dup_fd);
+        return;
+    }
 
-    scan_dir(ctx, ctx->root, path);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (scan_cancelled(w)) break;
+        if (is_dot(entry->d_name)) continue;
 
-    SDL_LockMutex(ctx->mutex);
-    ctx->root->complete = true;
-    ctx->done = true;
-    ctx->total_size = ctx->root->size;
-    SDL_UnlockMutex(ctx->mutex);
+        if (entry->d_type == DT_DIR) {
+            scan_add_dir(w, entry->d_name);
+            continue;
+        }
+        if (entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN)
+            continue;
 
-    return 0;
+        struct stat st;
+        uint64_t started = scan_clock(w);
+        int rc = fstatat(fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW);
+        scan_syscall_done(w, started);
+        if (rc != 0) continue;
+
+        if (S_ISDIR(st.st_mode))
+            scan_add_dir(w, entry->d_name);
+        else if (S_ISREG(st.st_mode))
+            scan_add_file(w, entry->d_name, st.st_size);
+    }
+
+    closedir(dir);
 }
 
-ScanContext *scanner_start(const char *path)
+#endif
+
+// Both settings are per thread on these systems, so only the workers slow
+// down and the rest of the process keeps its priority.
+static void lower_priority(void)
 {
-    ScanContext *ctx = calloc(1, sizeof(ScanContext));
-    if (!ctx) return NULL;
+#if defined(__linux__)
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+            IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+    setpriority(PRIO_PROCESS, 0, 19);
+#elif defined(__APPLE__)
+    pthread_set_qos_class_self_np(QOS_CLASS_BACKGROUND, 0);
+    setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD, IOPOL_THROTTLE);
+#endif
+}
 
-    ctx->mutex = SDL_CreateMutex();
-    ctx->root = tree_create(path);
+void scan_backend_worker_init(ScanWorker *w)
+{
+    if (w->ctx->opts.low_priority) lower_priority();
+#ifdef ZOOMFOLDER_IO_URING
+    if (w->ctx->opts.io_uring)
+        w->backend = scan_uring_create(URING_DEPTH);
+#endif
+}
 
-    ctx->thread = SDL_CreateThread(scanner_thread_fn, "scanner", ctx);
-    return ctx;
+void scan_backend_worker_free(ScanWorker *w)
+{
+#ifdef ZOOMFOLDER_IO_URING
+    scan_uring_free(w->backend);
+    w->backend = NULL;
+#else
+    (void)w;
+#endif
 }
 
-void scanner_cancel(ScanContext *ctx)
+void scan_backend_list(ScanWorker *w, ScanJob *job)
 {
-    if (!ctx) return;
-    ctx->cancel = true;
-    SDL_WaitThread(ctx->thread, NULL);
+    uint64_t started = scan_clock(w);
+    int fd = open_dir(job);
+    scan_syscall_done(w, started);
+    if (fd < 0) return;
+    job->dirfd = fd;
+
+    struct stat st;
+    if (w->ctx->opts.one_filesystem && fstat(fd, &st) == 0 &&
+        !scan_check_device(w, (uint64_t)st.st_dev))
+        return;
+    list_fd(w, fd);
 }
 
-void scanner_free(ScanContext *ctx)
+void scan_backend_close(ScanJob *job)
 {
-    if (!ctx) return;
-    if (!ctx->done) scanner_cancel(ctx);
-    else SDL_WaitThread(ctx->thread, NULL);
-    tree_free(ctx->root);
-    SDL_DestroyMutex(ctx->mutex);
-    free(ctx);
+    if (job->dirfd >= 0) close(job->dirfd);
+    job->dirfd = -1;
 }
@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+#include "scanner_uring.h"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    const char  *name;
+    bool         need_type;
+    struct statx stx;
+} UringSlot;
+
+struct ScanUring {
+    int                  fd;
+    unsigned            *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned            *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void                *sq_ptr, *cq_ptr;
+    size_t               sq_len, cq_len, sqes_len;
+
+    UringSlot           *slots;
+    unsigned            *free_slots;
+    unsigned             free_count;
+    unsigned             depth;
+    unsigned             unsubmitted;
+    unsigned             in_flight;
+    unsigned             completed;     // ever, to count a batch
+};
+
+static bool supports_statx(int fd)
+{
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, len);
+    if (!probe) return false;
+    bool ok = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE,
+                      probe, 256) == 0 &&
+              probe->last_op >= IORING_OP_STATX &&
+              (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return ok;
+}
+
+ScanUring *scan_uring_create(unsigned depth)
+{
+    ScanUring *ring = calloc(1, sizeof(ScanUring));
+    if (!ring) return NULL;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring->fd = (int)syscall(__NR_io_uring_setup, depth, &p);
+    if (ring->fd < 0) {
+        free(ring);
+        return NULL;
+    }
+    if (!supports_statx(ring->fd)) goto fail;
+
+    ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_len > ring->sq_len) ring->sq_len = ring->cq_len;
+        ring->cq_len = 0;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) goto fail;
+    if (ring->cq_len) {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) goto fail;
+    } else {
+        ring->cq_ptr = ring->sq_ptr;
+    }
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) goto fail;
+
+    char *sq = ring->sq_ptr, *cq = ring->cq_ptr;
+    ring->sq_head  = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail  = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask  = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->cq_head  = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail  = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask  = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes     = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    ring->depth = p.sq_entries;
+    ring->slots = calloc(ring->depth, sizeof(UringSlot));
+    ring->free_slots = malloc(ring->depth * sizeof(unsigned));
+    if (!ring->slots || !ring->free_slots) goto fail;
+    for (unsigned i = 0; i < ring->depth; i++)
+        ring->free_slots[i] = i;
+    ring->free_count = ring->depth;
+    return ring;
+
+fail:
+    scan_uring_free(ring);
+    return NULL;
+}
+
+void scan_uring_free(ScanUring *ring)
+{
+    if (!ring) return;
+    if (ring->sqes && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ptr && ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_len);
+    if (ring->sq_ptr && ring->sq_ptr != MAP_FAILED)
+        munmap(ring->sq_ptr, ring->sq_len);
+    close(ring->fd);
+    free(ring->slots);
+    free(ring->free_slots);
+    free(ring);
+}
+
+static void finish_slot(ScanUring *ring, ScanWorker *w, unsigned slot, int res)
+{
+    UringSlot *s = &ring->slots[slot];
+    if (res == 0) {
+        bool is_dir = s->need_type ? S_ISDIR(s->stx.stx_mode) : false;
+        bool is_reg = s->need_type ? S_ISREG(s->stx.stx_mode) : true;
+        if (is_dir)
+            scan_add_dir(w, s->name);
+        else if (is_reg)
+            scan_add_file(w, s->name, s->stx.stx_size);
+    }
+    ring->free_slots[ring->free_count++] = slot;
+    ring->in_flight--;
+    ring->completed++;
+}
+
+static void reap(ScanUring *ring, ScanWorker *w)
+{
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        finish_slot(ring, w, (unsigned)cqe->user_data, cqe->res);
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Runs the entries the kernel never picked up as plain syscalls
+static void submit_failed(ScanUring *ring, ScanWorker *w)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail;
+    for (; head != tail; head++) {
+        struct io_uring_sqe *sqe = &ring->sqes[ring->sq_array[head & *ring->sq_mask]];
+        unsigned slot = (unsigned)sqe->user_data;
+        UringSlot *s = &ring->slots[slot];
+        int res = statx(sqe->fd, s->name, sqe->statx_flags, sqe->len, &s->stx);
+        finish_slot(ring, w, slot, res == 0 ? 0 : -errno);
+    }
+    __atomic_store_n(ring->sq_tail, __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE),
+                     __ATOMIC_RELEASE);
+    ring->unsubmitted = 0;
+}
+
+// Submits everything queued and blocks until at least wait completions
+// exist. Adaptive throttling sees the average time each one took.
+static void enter(ScanUring *ring, ScanWorker *w, unsigned wait)
+{
+    uint64_t started = scan_clock(w);
+    unsigned completed = ring->completed;
+    for (;;) {
+        int ret = (int)syscall(__NR_io_uring_enter, ring->fd, ring->unsubmitted,
+                               wait, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret >= 0) {
+            ring->unsubmitted -= (unsigned)ret < ring->unsubmitted
+                ? (unsigned)ret : ring->unsubmitted;
+            if (ring->unsubmitted == 0) break;
+            continue;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EBUSY) {
+            reap(ring, w);
+            if (ring->in_flight <= ring->unsubmitted) {
+                submit_failed(ring, w);
+                break;
+            }
+            wait = 1;
+            continue;
+        }
+        submit_failed(ring, w);
+        break;
+    }
+    reap(ring, w);
+    scan_syscalls_done(w, started, ring->completed - completed);
+}
+
+void scan_uring_statx(ScanUring *ring, ScanWorker *w, int dirfd,
+                      const char *name, bool need_type)
+{
+    if (ring->free_count == 0)
+        enter(ring, w, 1);
+
+    unsigned slot = ring->free_slots[--ring->free_count];
+    UringSlot *s = &ring->slots[slot];
+    s->name = name;
+    s->need_type = need_type;
+
+    unsigned tail = *ring->sq_tail;
+    unsigned idx = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = dirfd;
+    sqe->addr = (uint64_t)(uintptr_t)name;
+    sqe->len = need_type ? STATX_TYPE | STATX_SIZE : STATX_SIZE;
+    sqe->off = (uint64_t)(uintptr_t)&s->stx;
+    sqe->statx_flags = AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT;
+    sqe->user_data = slot;
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    ring->unsubmitted++;
+    ring->in_flight++;
+}
+
+void scan_uring_drain(ScanUring *ring, ScanWorker *w)
+{
+    while (ring->in_flight > 0)
+        enter(ring, w, ring->in_flight);
+}
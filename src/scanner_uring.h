@@ -0,0 +1,14 @@
+#pragma once
+#include "scanner_backend.h"
+
+// Batched statx through io_uring (Linux 5.6+). Entries are queued while a
+// getdents batch is walked and their results reach scan_add_dir/file as the
+// completions come back, so up to depth lookups are in flight per worker.
+
+typedef struct ScanUring ScanUring;
+
+ScanUring *scan_uring_create(unsigned depth);   // NULL if unsupported
+void       scan_uring_free(ScanUring *ring);
+void       scan_uring_statx(ScanUring *ring, ScanWorker *w, int dirfd,
+                            const char *name, bool need_type);
+void       scan_uring_drain(ScanUring *ring, ScanWorker *w);
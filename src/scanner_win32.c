@@ -1,103 +1,55 @@
-#include "scanner.h"
+#include "scanner_backend.h"
 #include <windows.h>
-#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
-static void scan_dir(ScanContext *ctx, DirNode *node, const char *path)
+void scan_backend_worker_init(ScanWorker *w)
 {
+    // Lowers both CPU and I/O priority, for this thread only
+    if (w->ctx->opts.low_priority)
+        SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+}
+
+void scan_backend_worker_free(ScanWorker *w)
+{
+    (void)w;
+}
+
+// one_filesystem needs no check here: junctions and mounted folders are
+// reparse points, which the listing never enters.
+void scan_backend_list(ScanWorker *w, ScanJob *job)
+{
+    char path[MAX_PATH];
+    if (!scan_job_path(job, path, sizeof(path))) return;
+
     char pattern[MAX_PATH];
     snprintf(pattern, sizeof(pattern), "%s\\*", path);
 
     WIN32_FIND_DATAA fd;
+    uint64_t started = scan_clock(w);
     HANDLE hFind = FindFirstFileA(pattern, &fd);
+    scan_syscall_done(w, started);
     if (hFind == INVALID_HANDLE_VALUE) return;
 
     do {
-        if (ctx->cancel) break;
+        if (scan_cancelled(w)) break;
         if (strcmp(fd.cFileName, ".") == 0 || strcmp(fd.cFileName, "..") == 0)
             continue;
 
-        char fullpath[MAX_PATH];
-        snprintf(fullpath, sizeof(fullpath), "%s\\%s", path, fd.cFileName);
-
         if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
             if (fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
                 continue;
-
-            SDL_LockMutex(ctx->mutex);
-            DirNode *child = tree_add_child(node, fd.cFileName);
-            SDL_UnlockMutex(ctx->mutex);
-
-            if (child)
-                scan_dir(ctx, child, fullpath);
-
-            SDL_LockMutex(ctx->mutex);
-            if (child) {
-                node->size += child->size;
-                node->file_count += child->file_count;
-                tree_sort_children(child);
-                child->complete = true;
-            }
-            SDL_UnlockMutex(ctx->mutex);
+            scan_add_dir(w, fd.cFileName);
         } else {
             uint64_t fsize = ((uint64_t)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
-
-            SDL_LockMutex(ctx->mutex);
-            node->size += fsize;
-            node->file_count++;
-            ctx->total_size += fsize;
-            ctx->total_files++;
-            SDL_UnlockMutex(ctx->mutex);
+            scan_add_file(w, fd.cFileName, fsize);
         }
     } while (FindNextFileA(hFind, &fd));
 
     FindClose(hFind);
 }
 
-static int scanner_thread_fn(void *data)
-{
-    ScanContext *ctx = data;
-    char path[MAX_PATH];
-    strncpy(path, ctx->root->name, sizeof(path) - 1);
-    path[sizeof(path) - 1] = '\0';
-
-    scan_dir(ctx, ctx->root, path);
-
-    SDL_LockMutex(ctx->mutex);
-    ctx->root->complete = true;
-    ctx->done = true;
-    ctx->total_size = ctx->root->size;
-    SDL_UnlockMutex(ctx->mutex);
-
-    return 0;
-}
-
-ScanContext *scanner_start(const char *path)
-{
-    ScanContext *ctx = calloc(1, sizeof(ScanContext));
-    if (!ctx) return NULL;
-
-    ctx->mutex = SDL_CreateMutex();
-    ctx->root = tree_create(path);
-
-    ctx->thread = SDL_CreateThread(scanner_thread_fn, "scanner", ctx);
-    return ctx;
-}
-
-void scanner_cancel(ScanContext *ctx)
-{
-    if (!ctx) return;
-    ctx->cancel = true;
-    SDL_WaitThread(ctx->thread, NULL);
-}
-
-void scanner_free(ScanContext *ctx)
+void scan_backend_close(ScanJob *job)
 {
-    if (!ctx) return;
-    if (!ctx->done) scanner_cancel(ctx);
-    else SDL_WaitThread(ctx->thread, NULL);
-    tree_free(ctx->root);
-    SDL_DestroyMutex(ctx->mutex);
-    free(ctx);
+    (void)job;
 }
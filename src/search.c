@@ -0,0 +1,391 @@
+#include "search.h"
+#include <SDL3/SDL_mutex.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_CHUNK (64 * 1024)
+#define MAX_DEPTH   256
+
+typedef struct {
+    uint32_t name;          // UINT32_MAX for the root
+    uint32_t parent;
+    uint32_t prev_same;     // previous record with the same name
+} SearchRecord;
+
+typedef struct {
+    const char *str;
+    uint32_t    last;       // latest record with it
+} SearchName;
+
+typedef struct {
+    uint32_t  key;          // trigram + 1, 0 for an empty slot
+    uint32_t  count, cap;
+    uint32_t *names;        // ascending, each once
+} Trigram;
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t             used, cap;
+    char               data[];
+} ArenaChunk;
+
+struct SearchIndex {
+    SDL_Mutex    *lock;     // writers and queries both; queries take milliseconds
+    SearchRecord *records;
+    uint32_t      record_count, record_cap;
+
+    SearchName   *names;
+    uint32_t      name_count, name_cap;
+    uint32_t     *name_slots;   // name + 1 by hash, 0 for an empty slot
+    uint32_t      name_mask;
+    ArenaChunk   *arena;
+
+    Trigram      *grams;
+    uint32_t      gram_count, gram_mask;
+    size_t        mem;      // everything but the fixed parts above
+};
+
+// The tables run to millions of slots, so the bits have to be mixed up
+// into the low ones that index them
+static uint32_t mix(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x45d9f3bu;
+    h ^= h >> 16;
+    return h;
+}
+
+static uint32_t hash_name(const char *name)
+{
+    uint32_t h = 5381;
+    while (*name)
+        h = ((h << 5) + h) ^ (uint8_t)*name++;
+    return mix(h);
+}
+
+static uint32_t hash_gram(uint32_t key)
+{
+    return mix(key);
+}
+
+static inline char lower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+}
+
+static inline uint32_t gram_at(const char *s)
+{
+    return (uint32_t)(uint8_t)lower(s[0]) << 16 |
+           (uint32_t)(uint8_t)lower(s[1]) << 8 |
+           (uint32_t)(uint8_t)lower(s[2]);
+}
+
+SearchIndex *search_create(void)
+{
+    SearchIndex *index = calloc(1, sizeof(SearchIndex));
+    if (!index) return NULL;
+    index->lock = SDL_CreateMutex();
+    index->records = malloc(sizeof(SearchRecord));
+    if (!index->lock || !index->records) {
+        search_free(index);
+        return NULL;
+    }
+    index->records[0] = (SearchRecord){UINT32_MAX, SEARCH_NONE, SEARCH_NONE};
+    index->record_count = index->record_cap = 1;
+    return index;
+}
+
+void search_free(SearchIndex *index)
+{
+    if (!index) return;
+    for (uint32_t i = 0; i <= index->gram_mask && index->grams; i++)
+        free(index->grams[i].names);
+    free(index->grams);
+    while (index->arena) {
+        ArenaChunk *next = index->arena->next;
+        free(index->arena);
+        index->arena = next;
+    }
+    free(index->name_slots);
+    free(index->names);
+    free(index->records);
+    SDL_DestroyMutex(index->lock);
+    free(index);
+}
+
+static const char *arena_copy(SearchIndex *index, const char *str, size_t len)
+{
+    ArenaChunk *chunk = index->arena;
+    if (!chunk || chunk->cap - chunk->used < len + 1) {
+        size_t cap = len + 1 > ARENA_CHUNK ? len + 1 : ARENA_CHUNK;
+        chunk = malloc(sizeof(ArenaChunk) + cap);
+        if (!chunk) return NULL;
+        chunk->next = index->arena;
+        chunk->used = 0;
+        chunk->cap = cap;
+        index->arena = chunk;
+        index->mem += sizeof(ArenaChunk) + cap;
+    }
+    char *copy = chunk->data + chunk->used;
+    memcpy(copy, str, len + 1);
+    chunk->used += len + 1;
+    return copy;
+}
+
+// Open addressing at a load of at most 3/4, like a block's name index
+static bool grow_name_slots(SearchIndex *index)
+{
+    uint32_t slots = index->name_mask ? (index->name_mask + 1) * 2 : 1024;
+    uint32_t *grown = calloc(slots, sizeof(uint32_t));
+    if (!grown) return false;
+    for (uint32_t i = 0; i < index->name_count; i++) {
+        uint32_t h = hash_name(index->names[i].str) & (slots - 1);
+        while (grown[h]) h = (h + 1) & (slots - 1);
+        grown[h] = i + 1;
+    }
+    index->mem -= (index->name_mask ? index->name_mask + 1 : 0) * sizeof(uint32_t);
+    index->mem += slots * sizeof(uint32_t);
+    free(index->name_slots);
+    index->name_slots = grown;
+    index->name_mask = slots - 1;
+    return true;
+}
+
+static bool grow_grams(SearchIndex *index)
+{
+    uint32_t slots = index->gram_mask ? (index->gram_mask + 1) * 2 : 4096;
+    Trigram *grown = calloc(slots, sizeof(Trigram));
+    if (!grown) return false;
+    for (uint32_t i = 0; index->grams && i <= index->gram_mask; i++) {
+        if (!index->grams[i].key) continue;
+        uint32_t h = hash_gram(index->grams[i].key) & (slots - 1);
+        while (grown[h].key) h = (h + 1) & (slots - 1);
+        grown[h] = index->grams[i];
+    }
+    index->mem -= (index->grams ? index->gram_mask + 1 : 0) * sizeof(Trigram);
+    index->mem += slots * sizeof(Trigram);
+    free(index->grams);
+    index->grams = grown;
+    index->gram_mask = slots - 1;
+    return true;
+}
+
+static Trigram *find_gram(const SearchIndex *index, uint32_t gram)
+{
+    if (!index->grams) return NULL;
+    uint32_t key = gram + 1;
+    for (uint32_t h = hash_gram(key) & index->gram_mask;; h = (h + 1) & index->gram_mask) {
+        if (index->grams[h].key == key) return &index->grams[h];
+        if (!index->grams[h].key) return NULL;
+    }
+}
+
+static void add_gram(SearchIndex *index, uint32_t gram, uint32_t name)
+{
+    if ((index->gram_count + 1) * 4 > (index->grams ? index->gram_mask + 1 : 0) * 3 &&
+        !grow_grams(index))
+        return;
+
+    uint32_t key = gram + 1;
+    uint32_t h = hash_gram(key) & index->gram_mask;
+    while (index->grams[h].key && index->grams[h].key != key)
+        h = (h + 1) & index->gram_mask;
+    Trigram *t = &index->grams[h];
+    if (!t->key) {
+        t->key = key;
+        index->gram_count++;
+    }
+
+    // Names are added in order, so a repeat within one is the last entry
+    if (t->count && t->names[t->count - 1] == name) return;
+    if (t->count == t->cap) {
+        uint32_t cap = t->cap ? t->cap * 2 : 4;
+        uint32_t *grown = realloc(t->names, cap * sizeof(uint32_t));
+        if (!grown) return;
+        index->mem += (cap - t->cap) * sizeof(uint32_t);
+        t->names = grown;
+        t->cap = cap;
+    }
+    t->names[t->count++] = name;
+}
+
+static uint32_t intern(SearchIndex *index, const char *str)
+{
+    if ((index->name_count + 1) * 4 > (index->name_mask ? index->name_mask + 1 : 0) * 3 &&
+        !grow_name_slots(index))
+        return UINT32_MAX;
+
+    uint32_t h = hash_name(str) & index->name_mask;
+    for (;; h = (h + 1) & index->name_mask) {
+        uint32_t at = index->name_slots[h];
+        if (!at) break;
+        if (strcmp(index->names[at - 1].str, str) == 0) return at - 1;
+    }
+
+    if (index->name_count == index->name_cap) {
+        uint32_t cap = index->name_cap ? index->name_cap * 2 : 1024;
+        SearchName *grown = realloc(index->names, cap * sizeof(SearchName));
+        if (!grown) return UINT32_MAX;
+        index->mem += (cap - index->name_cap) * sizeof(SearchName);
+        index->names = grown;
+        index->name_cap = cap;
+    }
+    size_t len = strlen(str);
+    const char *copy = arena_copy(index, str, len);
+    if (!copy) return UINT32_MAX;
+
+    uint32_t name = index->name_count++;
+    index->names[name] = (SearchName){copy, SEARCH_NONE};
+    index->name_slots[h] = name + 1;
+    for (size_t i = 0; i + 3 <= len; i++)
+        add_gram(index, gram_at(str + i), name);
+    return name;
+}
+
+static uint32_t find_name(const SearchIndex *index, const char *str)
+{
+    if (!index->name_slots) return UINT32_MAX;
+    for (uint32_t h = hash_name(str) & index->name_mask;; h = (h + 1) & index->name_mask) {
+        uint32_t at = index->name_slots[h];
+        if (!at) return UINT32_MAX;
+        if (strcmp(index->names[at - 1].str, str) == 0) return at - 1;
+    }
+}
+
+uint32_t search_add_dirs(SearchIndex *index, uint32_t parent,
+                         const DirNode *children, uint32_t count)
+{
+    if (parent == SEARCH_NONE) return SEARCH_NONE;
+    SDL_LockMutex(index->lock);
+    uint32_t first = index->record_count;
+    if (first + count > index->record_cap) {
+        uint32_t cap = index->record_cap * 2;
+        if (cap < first + count) cap = first + count;
+        SearchRecord *grown = realloc(index->records, cap * sizeof(SearchRecord));
+        if (!grown) {
+            SDL_UnlockMutex(index->lock);
+            return SEARCH_NONE;
+        }
+        index->mem += (cap - index->record_cap) * sizeof(SearchRecord);
+        index->records = grown;
+        index->record_cap = cap;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t name = intern(index, children[i].name);
+        uint32_t prev = SEARCH_NONE;
+        if (name != UINT32_MAX) {
+            prev = index->names[name].last;
+            index->names[name].last = first + i;
+        }
+        index->records[first + i] = (SearchRecord){name, parent, prev};
+    }
+    index->record_count += count;
+    SDL_UnlockMutex(index->lock);
+    return first;
+}
+
+uint32_t search_child_record(SearchIndex *index, uint32_t parent, const char *name)
+{
+    SDL_LockMutex(index->lock);
+    uint32_t n = find_name(index, name);
+    uint32_t r = n == UINT32_MAX ? SEARCH_NONE : index->names[n].last;
+    while (r != SEARCH_NONE && index->records[r].parent != parent)
+        r = index->records[r].prev_same;
+    SDL_UnlockMutex(index->lock);
+    return r;
+}
+
+bool search_name_matches(const char *name, const char *query)
+{
+    if (!*query) return true;
+    for (; *name; name++) {
+        const char *n = name, *q = query;
+        while (*n && *q && lower(*n) == *q) {
+            n++;
+            q++;
+        }
+        if (!*q) return true;
+        if (!*n) return false;
+    }
+    return false;
+}
+
+static void collect(const SearchIndex *index, uint32_t name, uint32_t *records,
+                    uint32_t max, uint32_t *found, uint32_t *total)
+{
+    for (uint32_t r = index->names[name].last; r != SEARCH_NONE;
+         r = index->records[r].prev_same) {
+        if (*found < max) records[(*found)++] = r;
+        (*total)++;
+    }
+}
+
+uint32_t search_find(SearchIndex *index, const char *query, uint32_t *records,
+                     uint32_t max, uint32_t *total)
+{
+    char lowered[256];
+    size_t len = strlen(query);
+    *total = 0;
+    if (len == 0 || len >= sizeof(lowered)) return 0;
+    for (size_t i = 0; i <= len; i++)
+        lowered[i] = lower(query[i]);
+
+    uint32_t found = 0;
+    SDL_LockMutex(index->lock);
+    if (len < 3) {
+        for (uint32_t n = 0; n < index->name_count; n++) {
+            if (search_name_matches(index->names[n].str, lowered))
+                collect(index, n, records, max, &found, total);
+        }
+        SDL_UnlockMutex(index->lock);
+        return found;
+    }
+
+    const Trigram *shortest = NULL;
+    for (size_t i = 0; i + 3 <= len; i++) {
+        const Trigram *t = find_gram(index, gram_at(lowered + i));
+        if (!t) {
+            shortest = NULL;
+            break;
+        }
+        if (!shortest || t->count < shortest->count) shortest = t;
+    }
+    for (uint32_t i = 0; shortest && i < shortest->count; i++) {
+        uint32_t n = shortest->names[i];
+        if (search_name_matches(index->names[n].str, lowered))
+            collect(index, n, records, max, &found, total);
+    }
+    SDL_UnlockMutex(index->lock);
+    return found;
+}
+
+DirNode *search_resolve(SearchIndex *index, DirNode *root, uint32_t record)
+{
+    const char *path[MAX_DEPTH];
+    int depth = 0;
+
+    // Names stay where they were interned, so they outlive the lock
+    SDL_LockMutex(index->lock);
+    bool ok = record < index->record_count;
+    for (uint32_t r = record; ok && r != SEARCH_ROOT; r = index->records[r].parent) {
+        const SearchRecord *rec = &index->records[r];
+        ok = depth < MAX_DEPTH && rec->name != UINT32_MAX && rec->parent != SEARCH_NONE;
+        if (ok) path[depth++] = index->names[rec->name].str;
+    }
+    SDL_UnlockMutex(index->lock);
+    if (!ok) return NULL;
+
+    DirNode *node = root;
+    while (node && depth > 0 && node->kind != NODE_COLLAPSED)
+        node = tree_find_child(node, path[--depth]);
+    return node;
+}
+
+size_t search_mem_used(SearchIndex *index)
+{
+    SDL_LockMutex(index->lock);
+    size_t mem = sizeof(SearchIndex) + index->mem + sizeof(SearchRecord);
+    SDL_UnlockMutex(index->lock);
+    return mem;
+}
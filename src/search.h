@@ -0,0 +1,44 @@
+#pragma once
+#include "tree.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Finds directories by part of their name. The scanner adds each listed
+// directory to the index as a record of its name and its parent's record,
+// since nodes move whenever their parent's block is regrown or repacked; a
+// match is turned back into a node by walking its names down from the root.
+//
+// Names are interned, and each distinct lowercased trigram of a name lists
+// the names that have it. A query only checks the names on the shortest list
+// of its trigrams, or all distinct names if it is shorter than a trigram.
+//
+// The watcher records directories it adds, and removed ones are skipped when
+// resolved.
+
+typedef struct SearchIndex SearchIndex;
+
+#define SEARCH_ROOT 0           // record of the scan's root, whose name isn't indexed
+#define SEARCH_NONE UINT32_MAX  // a directory that couldn't be recorded
+
+SearchIndex *search_create(void);
+void         search_free(SearchIndex *index);
+// Records count children of parent's record, returning the first one's; the
+// rest follow it. SEARCH_NONE if they couldn't be. Called by scanner threads.
+uint32_t     search_add_dirs(SearchIndex *index, uint32_t parent,
+                             const DirNode *children, uint32_t count);
+// The record of parent's child called name, SEARCH_NONE if there's none
+uint32_t     search_child_record(SearchIndex *index, uint32_t parent,
+                                 const char *name);
+// Up to max records whose names contain query, ignoring ASCII case, those
+// of one name together; total gets how many there are in all
+uint32_t     search_find(SearchIndex *index, const char *query, uint32_t *records,
+                         uint32_t max, uint32_t *total);
+// NULL if the directory is gone, the collapsed one holding it if it is in
+// one. Called in a read section.
+DirNode     *search_resolve(SearchIndex *index, DirNode *root, uint32_t record);
+// Bytes held by the index
+size_t       search_mem_used(SearchIndex *index);
+
+// Whether name contains query, which is already lowercase
+bool         search_name_matches(const char *name, const char *query);
@@ -0,0 +1,418 @@
+#include "snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define SNAP_MAGIC   "ZFSNAP\r\n"
+#define SNAP_VERSION 2
+#define SNAP_ENDIAN  0x01020304u
+
+#define SNAP_COMPLETE   1u
+#define SNAP_COLLAPSED  2u      // children dropped, the collapsed_ fields hold
+#define SNAP_SKIP_SHIFT 8       // DirSkip in bits 8-15
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t node_size;
+    uint64_t node_count;
+    uint64_t nodes_offset;
+    uint64_t names_offset;
+    uint64_t names_size;
+    uint64_t total_size;
+    uint32_t total_files;
+    uint32_t endian;        // SNAP_ENDIAN as the writer stored it
+} SnapHeader;
+
+typedef struct {
+    uint64_t size;
+    uint64_t name;          // offset into the name pool
+    uint32_t file_count;
+    uint32_t first_child;   // index of the first child, always after this one
+    uint32_t child_count;
+    uint32_t flags;
+    uint32_t collapsed_dirs;
+    uint32_t collapsed_depth;
+} SnapNode;
+
+struct Snapshot {
+    const unsigned char *data;
+    size_t               len;
+    const SnapNode      *nodes;
+    uint64_t             node_count;
+    const char          *names;
+    uint64_t             names_size;
+#ifdef _WIN32
+    HANDLE               file, mapping;
+#endif
+};
+
+// A directory to write: a node, or a record of the snapshot a node was
+// opened from that hasn't been materialized and is copied straight across
+typedef struct {
+    const DirNode  *node;       // NULL for a record
+    const Snapshot *source;
+    uint32_t        index;
+} SaveItem;
+
+// Directories whose children are still to be written, oldest first
+typedef struct {
+    SaveItem *items;
+    size_t    head, count, cap;
+} SaveQueue;
+
+static bool queue_push(SaveQueue *q, SaveItem item)
+{
+    if (q->count == q->cap) {
+        size_t cap = q->cap ? q->cap * 2 : 256;
+        SaveItem *items = malloc(cap * sizeof(SaveItem));
+        if (!items) return false;
+        for (size_t i = 0; i < q->count; i++)
+            items[i] = q->items[(q->head + i) % q->cap];
+        free(q->items);
+        q->items = items;
+        q->head = 0;
+        q->cap = cap;
+    }
+    q->items[(q->head + q->count++) % q->cap] = item;
+    return true;
+}
+
+static SaveItem queue_pop(SaveQueue *q)
+{
+    SaveItem item = q->items[q->head];
+    q->head = (q->head + 1) % q->cap;
+    q->count--;
+    return item;
+}
+
+static const char *node_name(const Snapshot *snap, uint32_t index)
+{
+    uint64_t name = snap->nodes[index].name;
+    return name < snap->names_size ? snap->names + name : "";
+}
+
+// A record's children, none if they aren't all after it in the table
+static uint32_t record_children(const Snapshot *snap, uint32_t index, uint32_t *first)
+{
+    const SnapNode *rec = &snap->nodes[index];
+    *first = rec->first_child;
+    bool valid = rec->first_child > index &&
+                 (uint64_t)rec->first_child + rec->child_count <= snap->node_count;
+    return valid ? rec->child_count : 0;
+}
+
+static const char *item_name(const SaveItem *item)
+{
+    return item->node ? item->node->name : node_name(item->source, item->index);
+}
+
+// An unexpanded node is written as the record it was opened from
+static SaveItem as_record(SaveItem item)
+{
+    if (item.node && item.node->kind == NODE_UNEXPANDED)
+        return (SaveItem){NULL, item.node->source, item.node->source_index};
+    return item;
+}
+
+static uint32_t item_children(const SaveItem *item)
+{
+    uint32_t first;
+    return item->node ? tree_child_count(item->node)
+                      : record_children(item->source, item->index, &first);
+}
+
+static SaveItem item_child(const SaveItem *item, uint32_t i)
+{
+    if (!item->node) {
+        uint32_t first;
+        record_children(item->source, item->index, &first);
+        return (SaveItem){NULL, item->source, first + i};
+    }
+    DirNode *children = tree_children(item->node);
+    const DirNode *child = tree_child_at(children, tree_child_order(children), i);
+    return as_record((SaveItem){child, NULL, 0});
+}
+
+static SnapNode item_record(const SaveItem *item)
+{
+    if (!item->node) return item->source->nodes[item->index];
+    const DirNode *node = item->node;
+    bool collapsed = node->kind == NODE_COLLAPSED;
+    return (SnapNode){
+        .size = node->size,
+        .file_count = node->file_count,
+        .flags = (node->complete ? SNAP_COMPLETE : 0) |
+                 (collapsed ? SNAP_COLLAPSED : 0) |
+                 (uint32_t)node->skip << SNAP_SKIP_SHIFT,
+        .collapsed_dirs = collapsed ? node->collapsed_dirs : 0,
+        .collapsed_depth = collapsed ? node->collapsed_depth : 0,
+    };
+}
+
+// Writes the tree one directory at a time, breadth-first so each
+// directory's children get consecutive indices: its record in the first
+// pass, its name in the second. Only directories with children wait in the
+// queue, and levels of an opened snapshot not yet materialized are copied
+// from it as they are.
+typedef struct {
+    FILE     *f;
+    bool      names;        // the pass writing names
+    uint64_t  count;        // directories written
+    uint64_t  next_child;
+    uint64_t  names_size;
+} SaveState;
+
+static bool save_item(SaveState *st, SaveQueue *q, const SaveItem *item)
+{
+    const char *name = item_name(item);
+    size_t len = strlen(name) + 1;
+    uint32_t n = item_children(item);
+    if (st->names) {
+        if (fwrite(name, len, 1, st->f) != 1) return false;
+    } else {
+        SnapNode rec = item_record(item);
+        rec.name = st->names_size;
+        rec.first_child = n ? (uint32_t)st->next_child : 0;
+        rec.child_count = n;
+        st->next_child += n;
+        if (st->next_child > UINT32_MAX || fwrite(&rec, sizeof(rec), 1, st->f) != 1)
+            return false;
+    }
+    st->count++;
+    st->names_size += len;
+    return !n || queue_push(q, *item);
+}
+
+static bool save_pass(SaveState *st, const DirNode *root)
+{
+    SaveQueue q = {0};
+    SaveItem top = as_record((SaveItem){root, NULL, 0});
+    bool ok = save_item(st, &q, &top);
+    while (ok && q.count) {
+        SaveItem dir = queue_pop(&q);
+        uint32_t n = item_children(&dir);
+        for (uint32_t i = 0; ok && i < n; i++) {
+            SaveItem child = item_child(&dir, i);
+            ok = save_item(st, &q, &child);
+        }
+    }
+    free(q.items);
+    return ok;
+}
+
+bool snapshot_save(ScanContext *ctx, const char *path)
+{
+    if (!ctx || !ctx->root) return false;
+
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+        return false;
+    FILE *f = fopen(tmp, "wb");
+    if (!f) return false;
+
+    // The lock keeps a watcher from editing the tree halfway through
+    SDL_LockMutex(ctx->mutex);
+    tree_read_begin();
+
+    // The header goes in last, once the counts are known
+    SnapHeader hdr = {
+        .magic = SNAP_MAGIC,
+        .version = SNAP_VERSION,
+        .node_size = sizeof(SnapNode),
+        .nodes_offset = sizeof(SnapHeader),
+        .total_size = ctx->root->size,
+        .total_files = ctx->root->file_count,
+        .endian = SNAP_ENDIAN,
+    };
+    SnapHeader blank = {0};
+    SaveState nodes = {.f = f, .next_child = 1};
+    bool ok = fwrite(&blank, sizeof(blank), 1, f) == 1 &&
+              save_pass(&nodes, ctx->root);
+    SaveState names = {.f = f, .names = true};
+    ok = ok && save_pass(&names, ctx->root) &&
+         names.count == nodes.count && names.names_size == nodes.names_size;
+
+    tree_read_end();
+    SDL_UnlockMutex(ctx->mutex);
+
+    hdr.node_count = nodes.count;
+    hdr.names_offset = sizeof(SnapHeader) + nodes.count * sizeof(SnapNode);
+    hdr.names_size = nodes.names_size;
+    ok = ok && fseek(f, 0, SEEK_SET) == 0 && fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+
+    if (fclose(f) != 0) ok = false;
+    if (ok) {
+#ifdef _WIN32
+        ok = MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        ok = rename(tmp, path) == 0;
+#endif
+    }
+    if (!ok) remove(tmp);
+    return ok;
+}
+
+static bool map_file(Snapshot *snap, const char *path)
+{
+#ifdef _WIN32
+    snap->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (snap->file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(snap->file, &size) || size.QuadPart == 0) {
+        CloseHandle(snap->file);
+        return false;
+    }
+    snap->mapping = CreateFileMappingA(snap->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!snap->mapping) {
+        CloseHandle(snap->file);
+        return false;
+    }
+    snap->data = MapViewOfFile(snap->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!snap->data) {
+        CloseHandle(snap->mapping);
+        CloseHandle(snap->file);
+        return false;
+    }
+    snap->len = (size_t)size.QuadPart;
+    return true;
+#else
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    snap->data = data;
+    snap->len = (size_t)st.st_size;
+    return true;
+#endif
+}
+
+void snapshot_close(Snapshot *snap)
+{
+    if (!snap) return;
+#ifdef _WIN32
+    UnmapViewOfFile(snap->data);
+    CloseHandle(snap->mapping);
+    CloseHandle(snap->file);
+#else
+    munmap((void *)snap->data, snap->len);
+#endif
+    free(snap);
+}
+
+static bool header_valid(const Snapshot *snap, const SnapHeader *hdr)
+{
+    if (memcmp(hdr->magic, SNAP_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != SNAP_VERSION || hdr->endian != SNAP_ENDIAN ||
+        hdr->node_size != sizeof(SnapNode))
+        return false;
+    if (hdr->node_count == 0 || hdr->node_count > UINT32_MAX ||
+        hdr->nodes_offset % _Alignof(SnapNode) != 0 ||
+        hdr->nodes_offset > snap->len ||
+        hdr->node_count > (snap->len - hdr->nodes_offset) / sizeof(SnapNode))
+        return false;
+    // A pool that ends in NUL terminates every in-range name
+    return hdr->names_size > 0 && hdr->names_offset <= snap->len &&
+           hdr->names_size <= snap->len - hdr->names_offset &&
+           snap->data[hdr->names_offset + hdr->names_size - 1] == '\0';
+}
+
+static void fill_node(const Snapshot *snap, DirNode *node, uint32_t index)
+{
+    const SnapNode *rec = &snap->nodes[index];
+    node->size = rec->size;
+    atomic_init(&node->display_size, (float)rec->size);
+    node->file_count = rec->file_count;
+    node->complete = (rec->flags & SNAP_COMPLETE) != 0;
+    uint8_t skip = (uint8_t)(rec->flags >> SNAP_SKIP_SHIFT);
+    node->skip = skip <= DIR_EXCLUDED ? skip : DIR_SCANNED;
+    if (rec->flags & SNAP_COLLAPSED) {
+        node->collapsed_dirs = rec->collapsed_dirs;
+        node->collapsed_depth = rec->collapsed_depth;
+        node->kind = NODE_COLLAPSED;
+    } else if (rec->child_count) {
+        node->source = snap;
+        node->source_index = index;
+        node->kind = NODE_UNEXPANDED;
+    }
+}
+
+void snapshot_expand(DirNode *node)
+{
+    const Snapshot *snap = node->source;
+    const SnapNode *rec = &snap->nodes[node->source_index];
+    node->kind = NODE_SCANNED;
+
+    // Children always follow their parent, so a bad file can't make a cycle
+    uint64_t first = rec->first_child, count = rec->child_count;
+    bool valid = first > node->source_index && first + count <= snap->node_count;
+    node->source = NULL;
+    node->source_index = 0;
+    if (!valid) return;
+
+    size_t name_bytes = 0;
+    for (uint32_t i = 0; i < count; i++)
+        name_bytes += strlen(node_name(snap, (uint32_t)(first + i))) + 1;
+    tree_reserve_children(node, (uint32_t)count, name_bytes);
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t index = (uint32_t)(first + i);
+        DirNode *child = tree_add_child(node, node_name(snap, index));
+        if (!child) return;
+        fill_node(snap, child, index);
+        if (child->skip != DIR_SCANNED) node->placeholders++;
+    }
+    // Directories saved mid-scan may be out of order; this also totals them
+    tree_sort_children(node);
+}
+
+ScanContext *snapshot_open(const char *path)
+{
+    Snapshot *snap = calloc(1, sizeof(Snapshot));
+    if (!snap) return NULL;
+    if (!map_file(snap, path)) {
+        free(snap);
+        return NULL;
+    }
+
+    SnapHeader hdr;
+    if (snap->len < sizeof(hdr)) goto fail;
+    memcpy(&hdr, snap->data, sizeof(hdr));
+    if (!header_valid(snap, &hdr)) goto fail;
+    snap->nodes = (const SnapNode *)(snap->data + hdr.nodes_offset);
+    snap->node_count = hdr.node_count;
+    snap->names = (const char *)snap->data + hdr.names_offset;
+    snap->names_size = hdr.names_size;
+
+    DirNode *root = tree_create(node_name(snap, 0));
+    if (!root) goto fail;
+    fill_node(snap, root, 0);
+    snapshot_ensure(root);
+
+    ScanContext *ctx = scanner_adopt(root);
+    if (!ctx) {
+        tree_free(root);
+        goto fail;
+    }
+    ctx->snapshot = snap;
+    return ctx;
+
+fail:
+    snapshot_close(snap);
+    return NULL;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include "scanner.h"
+
+// Binary snapshot of a finished scan. The file is a header, a table of
+// fixed-size node records in breadth-first order (so every directory's
+// children are contiguous) and a pool of NUL-terminated names. Opening maps
+// it and only materializes the root's children; deeper levels become
+// DirNodes as the renderer first reaches them.
+
+typedef struct Snapshot Snapshot;
+
+bool         snapshot_save(ScanContext *ctx, const char *path);
+ScanContext *snapshot_open(const char *path);     // NULL if missing or invalid
+void         snapshot_close(Snapshot *snap);
+
+// Materializes node's children from its snapshot. Trees opened from a
+// snapshot have no other writer, so the rendering thread calls this itself.
+void         snapshot_expand(DirNode *node);
+
+static inline void snapshot_ensure(DirNode *node)
+{
+    if (node->kind == NODE_UNEXPANDED) snapshot_expand(node);
+}
@@ -0,0 +1,88 @@
+#include "topfiles.h"
+#include <stdlib.h>
+#include <string.h>
+
+bool topfiles_init(TopFiles *top, uint32_t cap)
+{
+    memset(top, 0, sizeof(*top));
+    if (cap == 0) return true;
+    top->items = calloc(cap, sizeof(TopFile));
+    if (!top->items) return false;
+    top->cap = cap;
+    return true;
+}
+
+void topfiles_free(TopFiles *top)
+{
+    for (uint32_t i = 0; i < top->count; i++)
+        free(top->items[i].path);
+    free(top->items);
+    free(top->dir);
+    memset(top, 0, sizeof(*top));
+}
+
+static void sift_down(TopFile *heap, uint32_t count, uint32_t i)
+{
+    for (;;) {
+        uint32_t smallest = i, l = 2 * i + 1, r = l + 1;
+        if (l < count && heap[l].size < heap[smallest].size) smallest = l;
+        if (r < count && heap[r].size < heap[smallest].size) smallest = r;
+        if (smallest == i) return;
+        TopFile tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+// Takes ownership of path
+static void push_owned(TopFiles *top, uint64_t size, char *path)
+{
+    if (!topfiles_wants(top, size)) {
+        free(path);
+        return;
+    }
+    if (top->count == top->cap) {
+        free(top->items[0].path);
+        top->items[0] = (TopFile){size, path};
+        sift_down(top->items, top->count, 0);
+        return;
+    }
+
+    uint32_t i = top->count++;
+    top->items[i] = (TopFile){size, path};
+    while (i > 0 && top->items[(i - 1) / 2].size > top->items[i].size) {
+        TopFile tmp = top->items[i];
+        top->items[i] = top->items[(i - 1) / 2];
+        top->items[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+void topfiles_push(TopFiles *top, uint64_t size, const char *path)
+{
+    char *copy = strdup(path);
+    if (copy) push_owned(top, size, copy);
+}
+
+void topfiles_merge(TopFiles *dst, TopFiles *src)
+{
+    for (uint32_t i = 0; i < src->count; i++)
+        push_owned(dst, src->items[i].size, src->items[i].path);
+    src->count = 0;
+    if (!dst->dir) {
+        dst->dir = src->dir;
+        src->dir = NULL;
+    }
+}
+
+static int cmp_size_desc(const void *a, const void *b)
+{
+    const TopFile *fa = a, *fb = b;
+    return (fa->size < fb->size) - (fa->size > fb->size);
+}
+
+void topfiles_sort(TopFiles *top)
+{
+    qsort(top->items, top->count, sizeof(TopFile), cmp_size_desc);
+}
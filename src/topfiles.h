@@ -0,0 +1,35 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// The largest files a scan came across. Files never become nodes, so the
+// scanner offers each one here as it is listed: each worker fills a
+// min-heap of its own, which costs one comparison for the usual file once
+// the heap is full, and the heaps are merged when the scan completes.
+
+typedef struct {
+    uint64_t size;
+    char    *path;
+} TopFile;
+
+typedef struct {
+    TopFile  *items;        // a min-heap by size, largest first once sorted
+    uint32_t  count, cap;
+    char     *dir;          // top-level directory they are under, NULL for all
+} TopFiles;
+
+bool topfiles_init(TopFiles *top, uint32_t cap);
+void topfiles_free(TopFiles *top);
+
+static inline bool topfiles_wants(const TopFiles *top, uint64_t size)
+{
+    return top->count < top->cap || (top->count && size > top->items[0].size);
+}
+
+// Copies path; only worth calling once topfiles_wants has said so
+void topfiles_push(TopFiles *top, uint64_t size, const char *path);
+// Moves src's files into dst, leaving src empty; dst takes src's dir if it
+// has none
+void topfiles_merge(TopFiles *dst, TopFiles *src);
+// Largest first; the result is no longer a heap to push to
+void topfiles_sort(TopFiles *top);
@@ -1,64 +1,976 @@
 #include "tree.h"
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define INITIAL_CAPACITY 8
+// A child block is a header, the nodes, their order while the directory is
+// being scanned and then their names. Blocks up to 2^POOL_MAX_SHIFT bytes
+// come in size classes of 2^n and 1.5 * 2^n, carved from slabs and recycled
+// through a free list per class, with the rounding slack going to names.
+// Larger ones are allocated on their own.
+#define POOL_MIN_SHIFT 7
+#define POOL_MAX_SHIFT 20
+#define POOL_CLASSES   (2 * (POOL_MAX_SHIFT - POOL_MIN_SHIFT) + 1)
+#define SLAB_SIZE      ((size_t)4 << 20)
+#define LARGE_BLOCK    0xff
+#define PACKED_BLOCK   0xfe
+#define INDEX_MIN      32      // slots from which a block hashes its names
 
-static void free_children(DirNode *node)
+#ifdef _WIN32
+#define PATH_SEP '\\'
+#else
+#define PATH_SEP '/'
+#endif
+
+typedef struct Block {
+    struct Block *next;         // in a free list or the retired list
+    struct Pack  *pack;         // holding it, if PACKED_BLOCK
+    _Atomic(DirNode *) owner;   // whose children these are
+    _Atomic uint32_t *index;    // open addressing by name, slot + 1 or 0
+    uint32_t      cap;          // node slots
+    uint32_t      name_used, name_cap;
+    uint32_t      index_mask;
+    _Atomic uint64_t total;     // of the nodes' sizes
+    uint8_t       cls;          // size class, LARGE_BLOCK or PACKED_BLOCK if not pooled
+    bool          ordered;      // nodes are followed by their order
+    DirNode       nodes[];
+} Block;
+
+// The blocks of a complete subtree, moved by tree_repack into one
+// allocation in depth-first order. It goes when the last of them does.
+typedef struct Pack {
+    atomic_uint   live;         // blocks not yet freed
+    size_t        bytes;
+} Pack;
+
+// Slabs are never returned; each keeps a link to the previous one in its
+// first minimum-size block so they stay reachable
+typedef struct Slab {
+    struct Slab *prev;
+} Slab;
+
+static atomic_flag   pool_lock = ATOMIC_FLAG_INIT;
+static Block        *free_lists[POOL_CLASSES];
+static Slab         *slabs;
+static char         *slab_next, *slab_end;
+static atomic_size_t pool_reserved;
+static atomic_size_t mem_used;
+static _Thread_local _Atomic int64_t *account;     // see tree_mem_account
+
+static atomic_int      readers;
+static _Atomic(Block *) retired;
+
+static void pool_acquire(void)
+{
+    while (atomic_flag_test_and_set_explicit(&pool_lock, memory_order_acquire)) {}
+}
+
+static void pool_release(void)
+{
+    atomic_flag_clear_explicit(&pool_lock, memory_order_release);
+}
+
+static size_t class_size(int cls)
+{
+    size_t base = (size_t)1 << (cls / 2 + POOL_MIN_SHIFT);
+    return cls % 2 ? base + base / 2 : base;
+}
+
+// Splits what is left of the slab into free blocks, largest first
+static void slab_carve_rest(void)
+{
+    for (int cls = POOL_CLASSES - 1; cls >= 0; cls--) {
+        while ((size_t)(slab_end - slab_next) >= class_size(cls)) {
+            Block *b = (Block *)slab_next;
+            b->next = free_lists[cls];
+            free_lists[cls] = b;
+            slab_next += class_size(cls);
+        }
+    }
+}
+
+// A new slab is allocated outside the lock, so other threads keep taking
+// and returning blocks meanwhile. If another thread put one in first, what
+// is left of that goes to the free lists, so neither is wasted.
+static Block *pool_take(int cls)
+{
+    for (;;) {
+        pool_acquire();
+        Block *b = free_lists[cls];
+        if (b) {
+            free_lists[cls] = b->next;
+        } else if ((size_t)(slab_end - slab_next) >= class_size(cls)) {
+            b = (Block *)slab_next;
+            slab_next += class_size(cls);
+        }
+        pool_release();
+        if (b) return b;
+
+        Slab *slab = malloc(SLAB_SIZE);
+        if (!slab) return NULL;
+        atomic_fetch_add(&pool_reserved, SLAB_SIZE);
+        pool_acquire();
+        slab_carve_rest();
+        slab->prev = slabs;
+        slabs = slab;
+        slab_next = (char *)slab + class_size(0);
+        slab_end = (char *)slab + SLAB_SIZE;
+        pool_release();
+    }
+}
+
+// Bytes up to the names
+static size_t block_head(uint32_t cap, bool ordered)
+{
+    size_t slot = sizeof(DirNode) + (ordered ? sizeof(uint32_t) : 0);
+    return offsetof(Block, nodes) + (size_t)cap * slot;
+}
+
+static uint32_t hash_name(const char *name)
+{
+    uint32_t h = 5381;
+    while (*name)
+        h = ((h << 5) + h) ^ (uint8_t)*name++;
+    return h;
+}
+
+static void mem_add(size_t bytes)
+{
+    atomic_fetch_add_explicit(&mem_used, bytes, memory_order_relaxed);
+    if (account) atomic_fetch_add_explicit(account, (int64_t)bytes, memory_order_relaxed);
+}
+
+// What b holds with its index; a packed block about its share of the pack
+static size_t block_bytes(const Block *b)
+{
+    size_t bytes = block_head(b->cap, b->ordered) + b->name_cap;
+    if (b->index) bytes += ((size_t)b->index_mask + 1) * sizeof(*b->index);
+    return bytes;
+}
+
+// A block of INDEX_MIN slots or more gets a table at most 3/4 full when
+// they all are. Without one, lookups just compare every name.
+static void index_alloc(Block *b)
+{
+    b->index = NULL;
+    b->index_mask = 0;
+    if (b->cap < INDEX_MIN) return;
+    size_t size = 1;
+    while (size < (size_t)b->cap + b->cap / 3 + 1) size *= 2;
+    b->index = calloc(size, sizeof(*b->index));
+    if (!b->index) return;
+    b->index_mask = (uint32_t)(size - 1);
+    mem_add(size * sizeof(*b->index));
+}
+
+// Published after the node it names, so a reader that finds it finds a name
+static void index_add(Block *b, uint32_t slot)
+{
+    if (!b->index) return;
+    uint32_t h = hash_name(b->nodes[slot].name) & b->index_mask;
+    while (atomic_load_explicit(&b->index[h], memory_order_relaxed))
+        h = (h + 1) & b->index_mask;
+    atomic_store_explicit(&b->index[h], slot + 1, memory_order_release);
+}
+
+static void index_fill(Block *b, uint32_t count)
+{
+    for (uint32_t i = 0; b->index && i < count; i++)
+        index_add(b, i);
+}
+
+static Block *block_alloc(uint32_t cap, size_t name_cap, bool ordered)
+{
+    size_t nodes = block_head(cap, ordered);
+    size_t bytes = nodes + name_cap;
+    Block *b;
+    int cls = 0;
+    if (bytes <= class_size(POOL_CLASSES - 1)) {
+        while (class_size(cls) < bytes) cls++;
+        bytes = class_size(cls);
+        b = pool_take(cls);
+    } else {
+        cls = LARGE_BLOCK;
+        b = malloc(bytes);
+    }
+    if (!b) return NULL;
+    b->cap = cap;
+    b->name_used = 0;
+    b->name_cap = (uint32_t)(bytes - nodes);
+    b->cls = (uint8_t)cls;
+    b->ordered = ordered;
+    b->total = 0;
+    b->owner = NULL;
+    mem_add(bytes);
+    index_alloc(b);
+    return b;
+}
+
+static void block_free(Block *b)
+{
+    if (b->index) {
+        size_t bytes = ((size_t)b->index_mask + 1) * sizeof(*b->index);
+        atomic_fetch_sub_explicit(&mem_used, bytes, memory_order_relaxed);
+        free((void *)b->index);
+    }
+    if (b->cls == PACKED_BLOCK) {
+        Pack *pack = b->pack;
+        if (atomic_fetch_sub(&pack->live, 1) == 1) {
+            atomic_fetch_sub_explicit(&mem_used, pack->bytes, memory_order_relaxed);
+            free(pack);
+        }
+        return;
+    }
+    size_t bytes = block_head(b->cap, b->ordered) + b->name_cap;
+    atomic_fetch_sub_explicit(&mem_used, bytes, memory_order_relaxed);
+    if (b->cls == LARGE_BLOCK) {
+        free(b);
+        return;
+    }
+    pool_acquire();
+    b->next = free_lists[b->cls];
+    free_lists[b->cls] = b;
+    pool_release();
+}
+
+static Block *block_of(DirNode *children)
+{
+    return children ? (Block *)((char *)children - offsetof(Block, nodes)) : NULL;
+}
+
+static _Atomic uint32_t *block_order(Block *b)
+{
+    return b && b->ordered ? (_Atomic uint32_t *)(b->nodes + b->cap) : NULL;
+}
+
+// i-th child in order, or in place if b keeps no order
+static uint32_t order_at(_Atomic uint32_t *order, uint32_t i)
+{
+    return order ? atomic_load_explicit(&order[i], memory_order_relaxed) : i;
+}
+
+static char *block_names(Block *b)
+{
+    return (char *)b + block_head(b->cap, b->ordered);
+}
+
+// Copies a node into another block, pointing its name at the copy there.
+// Names from elsewhere (a root's) are left alone. The renderer may be
+// animating display_size meanwhile, so that one is loaded, not copied.
+static void copy_node(DirNode *dst, const DirNode *src, Block *from, Block *to)
+{
+    size_t anim = offsetof(DirNode, display_size);
+    size_t rest = anim + sizeof(dst->display_size);
+    memcpy(dst, src, anim);
+    memcpy((char *)dst + rest, (const char *)src + rest, sizeof(DirNode) - rest);
+    atomic_init(&dst->display_size,
+                atomic_load_explicit(&src->display_size, memory_order_relaxed));
+    dst->slot = (uint32_t)(dst - to->nodes);
+    uintptr_t names = (uintptr_t)block_names(from), name = (uintptr_t)src->name;
+    if (name >= names && name < names + from->name_used)
+        dst->name = block_names(to) + (name - names);
+}
+
+// Points the block of node's children back at node, after node moved
+static void adopt(DirNode *node)
+{
+    Block *b = block_of(atomic_load_explicit(&node->children, memory_order_relaxed));
+    if (b) atomic_store_explicit(&b->owner, node, memory_order_release);
+}
+
+// A block with the same room and owner as b and a copy of its names
+static Block *block_clone(Block *b, bool ordered)
+{
+    Block *copy = block_alloc(b->cap, b->name_used, ordered);
+    if (!copy) return NULL;
+    memcpy(block_names(copy), block_names(b), b->name_used);
+    copy->name_used = b->name_used;
+    copy->total = b->total;
+    copy->owner = atomic_load_explicit(&b->owner, memory_order_relaxed);
+    return copy;
+}
+
+// Blocks leave the retiring thread's account as they are retired, though
+// they are only freed once no reader can see them
+static void account_retired(Block *first, Block *last)
+{
+    if (!account) return;
+    int64_t bytes = 0;
+    for (Block *b = first;; b = b->next) {
+        bytes += (int64_t)block_bytes(b);
+        if (b == last) break;
+    }
+    atomic_fetch_sub_explicit(account, bytes, memory_order_relaxed);
+}
+
+// Blocks moved in from a tree another account paid for join this thread's
+static void account_moved(Block *first, Block *last)
+{
+    if (!account) return;
+    int64_t bytes = 0;
+    for (Block *b = first;; b = b->next) {
+        bytes += (int64_t)block_bytes(b);
+        if (b == last) break;
+    }
+    atomic_fetch_add_explicit(account, bytes, memory_order_relaxed);
+}
+
+static void retire_push(Block *first, Block *last)
+{
+    Block *head = atomic_load(&retired);
+    do {
+        last->next = head;
+    } while (!atomic_compare_exchange_weak(&retired, &head, first));
+}
+
+// Frees everything retired so far if no reader is inside the tree. A reader
+// that enters afterwards can only reach the arrays that replaced them.
+static void reclaim(void)
+{
+    Block *list = atomic_exchange(&retired, NULL);
+    if (!list) return;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&readers) != 0) {
+        Block *last = list;
+        while (last->next) last = last->next;
+        retire_push(list, last);
+        return;
+    }
+
+    while (list) {
+        Block *next = list->next;
+        block_free(list);
+        list = next;
+    }
+}
+
+static void retire(DirNode *children)
+{
+    Block *b = block_of(children);
+    if (!b) return;
+    account_retired(b, b);
+    retire_push(b, b);
+    if (atomic_load(&readers) == 0)
+        reclaim();
+}
+
+void tree_read_begin(void)
+{
+    atomic_fetch_add(&readers, 1);
+}
+
+void tree_read_end(void)
+{
+    if (atomic_fetch_sub(&readers, 1) == 1)
+        reclaim();
+}
+
+static bool has_stats(const DirNode *node)
+{
+    uint8_t kind = atomic_load_explicit(&node->kind, memory_order_acquire);
+    return kind == NODE_SCANNED || kind == NODE_COLLAPSED;
+}
+
+// A node's file stats sit in a block of their own with no nodes, so they
+// are recycled and retired like child blocks
+static Block *stats_block(const DirNode *node)
+{
+    if (!has_stats(node)) return NULL;
+    const FileStats *stats = atomic_load_explicit(&node->stats, memory_order_acquire);
+    return stats ? (Block *)((char *)stats - offsetof(Block, nodes)) : NULL;
+}
+
+// Links node's child block and all those below it after last, and their
+// file stats too if the nodes are going rather than moving
+static Block *chain_subtree(const DirNode *node, Block *last, bool stats)
+{
+    Block *own = stats ? stats_block(node) : NULL;
+    if (own) {
+        last->next = own;
+        last = own;
+    }
+    uint32_t count = tree_child_count(node);
+    DirNode *children = tree_children(node);
+    Block *b = block_of(children);
+    if (!b) return last;
+    last->next = b;
+    last = b;
+    for (uint32_t i = 0; i < count; i++)
+        last = chain_subtree(&children[i], last, stats);
+    return last;
+}
+
+// Retires a whole subtree's blocks in one push
+static void retire_subtree(const DirNode *node, bool stats)
+{
+    Block head;
+    Block *last = chain_subtree(node, &head, stats);
+    if (last == &head) return;
+    account_retired(head.next, last);
+    retire_push(head.next, last);
+    if (atomic_load(&readers) == 0)
+        reclaim();
+}
+
+static void free_subtree(DirNode *node)
+{
+    uint32_t count = tree_child_count(node);
+    DirNode *children = tree_children(node);
+    for (uint32_t i = 0; i < count; i++)
+        free_subtree(&children[i]);
+    if (children) block_free(block_of(children));
+    Block *stats = stats_block(node);
+    if (stats) block_free(stats);
+    atomic_store(&node->children, NULL);
+}
+
+// Where a child goes in an order: larger first, placeholders ahead of empty
+// directories, then in the order they were added
+typedef struct {
+    uint64_t size;
+    bool     placeholder;
+    uint32_t index;
+} Rank;
+
+static Rank rank_at(const Block *b, uint32_t index)
+{
+    const DirNode *node = &b->nodes[index];
+    return (Rank){node->size, node->skip != DIR_SCANNED, index};
+}
+
+static bool ranks_before(Rank a, Rank b)
 {
-    for (uint32_t i = 0; i < node->child_count; i++)
-        free_children(&node->children[i]);
-    free(node->children);
-    node->children = NULL;
+    if (a.size != b.size) return a.size > b.size;
+    if (a.placeholder != b.placeholder) return a.placeholder;
+    return a.index < b.index;
+}
+
+// Entries of order[0, hi) that go before r
+static uint32_t rank_of(const Block *b, _Atomic uint32_t *order, uint32_t hi, Rank r)
+{
+    uint32_t lo = 0;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        uint32_t at = atomic_load_explicit(&order[mid], memory_order_relaxed);
+        if (ranks_before(rank_at(b, at), r)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Where child is in the order, count if it isn't there. Found by bisection,
+// so it has to happen before the child changes.
+static uint32_t order_find(const Block *b, _Atomic uint32_t *order, uint32_t count,
+                           const DirNode *child)
+{
+    if (child < b->nodes || child >= b->nodes + count) return count;
+    uint32_t self = (uint32_t)(child - b->nodes);
+    uint32_t at = rank_of(b, order, count, rank_at(b, self));
+    if (at < count && atomic_load_explicit(&order[at], memory_order_relaxed) == self)
+        return at;
+    return count;   // sizes were set behind the order's back; sorting fixes it
+}
+
+// Moves the child at order[from] up to where it goes after changing. Sizes
+// only grow while there is an order, and a placeholder stays empty, so it
+// never moves back; the entries it passes shift back by one.
+static void order_raise(const Block *b, _Atomic uint32_t *order, uint32_t from,
+                        uint32_t count)
+{
+    if (from == count) return;
+    uint32_t self = atomic_load_explicit(&order[from], memory_order_relaxed);
+    uint32_t to = rank_of(b, order, from, rank_at(b, self));
+    for (uint32_t i = from; i > to; i--) {
+        uint32_t moved = atomic_load_explicit(&order[i - 1], memory_order_relaxed);
+        atomic_store_explicit(&order[i], moved, memory_order_release);
+    }
+    atomic_store_explicit(&order[to], self, memory_order_release);
 }
 
 DirNode *tree_create(const char *name)
 {
-    DirNode *node = calloc(1, sizeof(DirNode));
+    size_t len = strlen(name) + 1;
+    DirNode *node = calloc(1, sizeof(DirNode) + len);
     if (!node) return NULL;
-    strncpy(node->name, name, sizeof(node->name) - 1);
+    char *copy = (char *)(node + 1);
+    memcpy(copy, name, len);
+    node->name = copy;
+    node->slot = TREE_NO_SLOT;
     return node;
 }
 
-DirNode *tree_add_child(DirNode *parent, const char *name)
+void tree_reserve_children(DirNode *parent, uint32_t count, size_t name_bytes)
 {
-    if (parent->child_count == parent->child_capacity) {
-        uint32_t new_cap = parent->child_capacity == 0
-            ? INITIAL_CAPACITY
-            : parent->child_capacity * 2;
-        DirNode *buf = realloc(parent->children, new_cap * sizeof(DirNode));
-        if (!buf) return NULL;
-        parent->children = buf;
-        parent->child_capacity = new_cap;
+    uint32_t used = atomic_load_explicit(&parent->child_count, memory_order_relaxed);
+    DirNode *children = atomic_load_explicit(&parent->children, memory_order_relaxed);
+    Block *old = block_of(children);
+    uint32_t cap = old ? old->cap : 0;
+    size_t name_cap = old ? old->name_cap : 0;
+    size_t name_used = old ? old->name_used : 0;
+    if (used + count <= cap && name_used + name_bytes <= name_cap) return;
+
+    // Names grow along with the nodes, from what they use: the old block's
+    // rounding slack would otherwise pile up with every regrowth
+    size_t names = name_used + name_bytes;
+    if (used + count > cap) {
+        cap = cap * 2 > used + count ? cap * 2 : used + count;
+        name_cap = name_used * 2 > names ? name_used * 2 : names;
+    } else {
+        name_cap = name_cap * 2 > names ? name_cap * 2 : names;
+    }
+
+    // Directories still being scanned get an order, kept through regrowth
+    Block *b = block_alloc(cap, name_cap, old ? old->ordered : !parent->complete);
+    if (!b) return;
+    b->owner = parent;
+    if (old) {
+        memcpy(block_names(b), block_names(old), name_used);
+        b->name_used = (uint32_t)name_used;
+        b->total = old->total;
+        for (uint32_t i = 0; i < used; i++) {
+            copy_node(&b->nodes[i], &old->nodes[i], old, b);
+            adopt(&b->nodes[i]);
+        }
+        index_fill(b, used);
+        _Atomic uint32_t *order = block_order(b);
+        for (uint32_t i = 0; order && i < used; i++)
+            atomic_store_explicit(&order[i], order_at(block_order(old), i),
+                                  memory_order_relaxed);
     }
+    atomic_store_explicit(&parent->children, b->nodes, memory_order_release);
+    retire(children);
+}
 
-    DirNode *child = &parent->children[parent->child_count++];
+DirNode *tree_add_child(DirNode *parent, const char *name)
+{
+    size_t len = strlen(name) + 1;
+    tree_reserve_children(parent, 1, len);
+
+    uint32_t count = atomic_load_explicit(&parent->child_count, memory_order_relaxed);
+    Block *b = block_of(atomic_load_explicit(&parent->children, memory_order_relaxed));
+    if (!b || count == b->cap || b->name_used + len > b->name_cap)
+        return NULL;
+
+    DirNode *child = &b->nodes[count];
     memset(child, 0, sizeof(DirNode));
-    strncpy(child->name, name, sizeof(child->name) - 1);
+    char *copy = block_names(b) + b->name_used;
+    memcpy(copy, name, len);
+    b->name_used += (uint32_t)len;
+    child->name = copy;
+    child->slot = count;
+    index_add(b, count);
+    // Sizes start at zero, so it goes last
+    _Atomic uint32_t *order = block_order(b);
+    if (order) atomic_store_explicit(&order[count], count, memory_order_relaxed);
+    atomic_store_explicit(&parent->child_count, count + 1, memory_order_release);
     return child;
 }
 
+// Completes child as an empty placeholder, once, before or after it was
+// published
+void tree_mark_skipped(DirNode *parent, DirNode *child, DirSkip why)
+{
+    Block *b = block_of(tree_children(parent));
+    _Atomic uint32_t *order = block_order(b);
+    uint32_t count = tree_child_count(parent);
+    uint32_t from = order ? order_find(b, order, count, child) : count;
+
+    if (atomic_exchange(&child->skip, (uint8_t)why) == DIR_SCANNED)
+        atomic_fetch_add(&parent->placeholders, 1);
+    child->complete = true;
+    if (order) order_raise(b, order, from, count);
+}
+
+const char *tree_skip_label(DirSkip why)
+{
+    switch (why) {
+    case DIR_OTHER_FS: return "other filesystem";
+    case DIR_EXCLUDED: return "excluded";
+    default:           return "";
+    }
+}
+
+// An index may hold children added after count was loaded; they are
+// skipped, as a reader could not see them in the array either
+DirNode *tree_find_child(const DirNode *parent, const char *name)
+{
+    uint32_t count = tree_child_count(parent);
+    DirNode *children = tree_children(parent);
+    Block *b = block_of(children);
+    if (b && b->index) {
+        uint32_t h = hash_name(name) & b->index_mask;
+        for (;; h = (h + 1) & b->index_mask) {
+            uint32_t at = atomic_load_explicit(&b->index[h], memory_order_acquire);
+            if (!at) return NULL;
+            if (at <= count && strcmp(children[at - 1].name, name) == 0)
+                return &children[at - 1];
+        }
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (strcmp(children[i].name, name) == 0)
+            return &children[i];
+    }
+    return NULL;
+}
+
+void tree_remove_child(DirNode *parent, uint32_t index)
+{
+    uint32_t count = atomic_load_explicit(&parent->child_count, memory_order_relaxed);
+    if (index >= count) return;
+
+    DirNode *children = atomic_load_explicit(&parent->children, memory_order_relaxed);
+    Block *old = block_of(children);
+    Block *b = block_clone(old, old->ordered);
+    if (!b) return;
+    if (children[index].skip != DIR_SCANNED)
+        atomic_fetch_sub(&parent->placeholders, 1);
+    b->total -= children[index].size;
+    for (uint32_t i = 0, j = 0; i < count; i++) {
+        if (i == index) continue;
+        copy_node(&b->nodes[j], &children[i], old, b);
+        adopt(&b->nodes[j++]);
+    }
+    index_fill(b, count - 1);
+    _Atomic uint32_t *order = block_order(b);
+    for (uint32_t i = 0, j = 0; order && i < count; i++) {
+        uint32_t at = order_at(block_order(old), i);
+        if (at == index) continue;
+        atomic_store_explicit(&order[j++], at - (at > index), memory_order_relaxed);
+    }
+
+    // Shrink the count before swapping so no reader pairs it with a short array
+    atomic_store_explicit(&parent->child_count, count - 1, memory_order_release);
+    atomic_store_explicit(&parent->children, b->nodes, memory_order_release);
+    retire_subtree(&children[index], true);
+    retire(children);
+}
+
+void tree_clear_children(DirNode *node)
+{
+    uint32_t count = atomic_load_explicit(&node->child_count, memory_order_relaxed);
+    DirNode *children = atomic_load_explicit(&node->children, memory_order_relaxed);
+
+    atomic_store_explicit(&node->child_count, 0, memory_order_release);
+    atomic_store_explicit(&node->children, NULL, memory_order_release);
+    node->placeholders = 0;
+    for (uint32_t i = 0; i < count; i++)
+        retire_subtree(&children[i], true);
+    retire(children);
+}
+
+// Directories below node, counting those a collapsed one stands for, and
+// how many levels deep they go; nodes gets how many are actually there
+static uint32_t count_below(const DirNode *node, uint32_t *depth, uint32_t *nodes)
+{
+    if (atomic_load_explicit(&node->kind, memory_order_relaxed) == NODE_COLLAPSED) {
+        *depth = node->collapsed_depth;
+        return node->collapsed_dirs;
+    }
+    uint32_t count = tree_child_count(node), dirs = count, deepest = 0;
+    DirNode *children = tree_children(node);
+    *nodes += count;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t below;
+        dirs += count_below(&children[i], &below, nodes);
+        if (below + 1 > deepest) deepest = below + 1;
+    }
+    *depth = deepest;
+    return dirs;
+}
+
+uint32_t tree_collapse(DirNode *node)
+{
+    if (atomic_load(&node->kind) != NODE_SCANNED || tree_child_count(node) == 0)
+        return 0;
+    uint32_t depth, nodes = 0;
+    uint32_t dirs = count_below(node, &depth, &nodes);
+    tree_clear_children(node);
+    node->collapsed_dirs = dirs;
+    node->collapsed_depth = depth;
+    atomic_store_explicit(&node->kind, NODE_COLLAPSED, memory_order_release);
+    return nodes;
+}
+
+// Moves src's children and totals onto dst, which must have no children of
+// its own yet, and frees src itself. Whatever dst knew of its files goes.
+void tree_graft(DirNode *dst, DirNode *src)
+{
+    Block *old = stats_block(dst);
+    dst->size = src->size;
+    dst->file_count = src->file_count;
+    atomic_store_explicit(&dst->children, tree_children(src), memory_order_release);
+    atomic_store_explicit(&dst->child_count, tree_child_count(src), memory_order_release);
+    adopt(dst);
+    dst->complete = src->complete;
+    dst->stats = src->stats;
+    atomic_store(&dst->kind, atomic_load(&src->kind));
+    dst->collapsed_dirs = src->collapsed_dirs;
+    dst->collapsed_depth = src->collapsed_depth;
+    dst->placeholders = src->placeholders;
+    free(src);
+    if (old) {
+        account_retired(old, old);
+        retire_push(old, old);
+        if (atomic_load(&readers) == 0) reclaim();
+    }
+}
+
+void tree_take_children(DirNode *dst, DirNode *src)
+{
+    uint32_t count = atomic_load_explicit(&dst->child_count, memory_order_relaxed);
+    DirNode *old = atomic_load_explicit(&dst->children, memory_order_relaxed);
+    uint32_t taken_count = tree_child_count(src);
+    DirNode *taken = tree_children(src);
+
+    if (taken) {
+        Block head;
+        head.next = block_of(taken);
+        Block *last = head.next;
+        for (uint32_t i = 0; i < taken_count; i++)
+            last = chain_subtree(&taken[i], last, true);
+        account_moved(head.next, last);
+    }
+
+    // Shrink the count before swapping so no reader pairs it with a short array
+    if (taken_count < count)
+        atomic_store_explicit(&dst->child_count, taken_count, memory_order_release);
+    atomic_store_explicit(&dst->children, taken, memory_order_release);
+    atomic_store_explicit(&dst->child_count, taken_count, memory_order_release);
+    dst->placeholders = src->placeholders;
+    adopt(dst);
+
+    atomic_store_explicit(&src->children, NULL, memory_order_relaxed);
+    atomic_store_explicit(&src->child_count, 0, memory_order_relaxed);
+    src->placeholders = 0;
+
+    for (uint32_t i = 0; i < count; i++)
+        retire_subtree(&old[i], true);
+    retire(old);
+}
+
+DirNode *tree_parent(const DirNode *node)
+{
+    if (node->slot == TREE_NO_SLOT) return NULL;
+    Block *b = block_of((DirNode *)(node - node->slot));
+    return atomic_load_explicit(&b->owner, memory_order_acquire);
+}
+
+// Writes node's path at buf and returns its length, cap if it doesn't fit
+static size_t path_at(const DirNode *node, char *buf, size_t cap)
+{
+    const DirNode *parent = tree_parent(node);
+    size_t len = parent ? path_at(parent, buf, cap) : 0;
+    if (len >= cap) return cap;
+
+    // A root of "/" or "C:\" already ends in a separator
+    if (parent && (len == 0 || buf[len - 1] != PATH_SEP)) buf[len++] = PATH_SEP;
+    size_t name_len = strlen(node->name);
+    if (len + name_len >= cap) return cap;
+    memcpy(buf + len, node->name, name_len + 1);
+    return len + name_len;
+}
+
+bool tree_path(const DirNode *node, char *buf, size_t cap)
+{
+    return cap > 0 && path_at(node, buf, cap) < cap;
+}
+
 void tree_propagate_size(DirNode *node, uint64_t added)
 {
-    node->size += added;
+    while (node) {
+        DirNode *parent = tree_parent(node);
+        tree_add_size(parent, node, added);
+        node = parent;
+    }
 }
 
+void tree_add_size(DirNode *parent, DirNode *child, uint64_t added)
+{
+    Block *b = parent ? block_of(tree_children(parent)) : NULL;
+    _Atomic uint32_t *order = block_order(b);
+    uint32_t count = parent ? tree_child_count(parent) : 0;
+    uint32_t from = order ? order_find(b, order, count, child) : count;
+
+    child->size += added;
+    if (b) b->total += added;
+    if (order) order_raise(b, order, from, count);
+}
+
+uint64_t tree_children_size(const DirNode *node)
+{
+    Block *b = block_of(tree_children(node));
+    return b ? atomic_load_explicit(&b->total, memory_order_relaxed) : 0;
+}
+
+const _Atomic uint32_t *tree_child_order(DirNode *children)
+{
+    return block_order(block_of(children));
+}
+
+// Placeholders go ahead of empty directories, as in an order
 static int cmp_size_desc(const void *a, const void *b)
 {
     uint64_t sa = ((const DirNode *)a)->size;
     uint64_t sb = ((const DirNode *)b)->size;
-    return (sb > sa) - (sb < sa);
+    if (sa != sb) return (sb > sa) - (sb < sa);
+    bool pa = ((const DirNode *)a)->skip != DIR_SCANNED;
+    bool pb = ((const DirNode *)b)->skip != DIR_SCANNED;
+    return (pb > pa) - (pb < pa);
+}
+
+static bool sorted(const DirNode *nodes, uint32_t count)
+{
+    for (uint32_t i = 1; i < count; i++) {
+        if (cmp_size_desc(&nodes[i - 1], &nodes[i]) > 0) return false;
+    }
+    return true;
 }
 
 void tree_sort_children(DirNode *node)
 {
-    if (node->child_count > 1)
-        qsort(node->children, node->child_count, sizeof(DirNode), cmp_size_desc);
+    uint32_t count = atomic_load_explicit(&node->child_count, memory_order_relaxed);
+    DirNode *children = atomic_load_explicit(&node->children, memory_order_relaxed);
+    Block *old = block_of(children);
+    if (!old) return;
+
+    // The watcher sets sizes directly, so the total is redone here
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < count; i++)
+        total += children[i].size;
+    atomic_store_explicit(&old->total, total, memory_order_relaxed);
+    _Atomic uint32_t *order = block_order(old);
+    if (!order && sorted(children, count)) return;
+
+    // Following the order leaves nothing to sort unless sizes changed
+    // behind its back; either way the order goes
+    Block *b = block_clone(old, false);
+    if (!b) return;
+    for (uint32_t i = 0; i < count; i++)
+        copy_node(&b->nodes[i], &children[order_at(order, i)], old, b);
+    if (!sorted(b->nodes, count)) qsort(b->nodes, count, sizeof(DirNode), cmp_size_desc);
+    for (uint32_t i = 0; i < count; i++) {
+        b->nodes[i].slot = i;
+        adopt(&b->nodes[i]);
+    }
+    index_fill(b, count);
+    atomic_store_explicit(&node->children, b->nodes, memory_order_release);
+    retire(children);
+}
+
+// Room a block for node's children takes in a pack, none if it has none
+static size_t packed_size(const DirNode *node)
+{
+    uint32_t count = tree_child_count(node);
+    if (!count) return 0;
+    size_t bytes = block_head(count, false) + block_of(tree_children(node))->name_used;
+    return (bytes + _Alignof(Block) - 1) & ~(_Alignof(Block) - 1);
+}
+
+static size_t subtree_packed_size(const DirNode *node, unsigned *blocks)
+{
+    uint32_t count = tree_child_count(node);
+    DirNode *children = tree_children(node);
+    size_t bytes = packed_size(node);
+    *blocks += count > 0;
+    for (uint32_t i = 0; i < count; i++)
+        bytes += subtree_packed_size(&children[i], blocks);
+    return bytes;
+}
+
+// Writes a copy of node's block at `at` and then, child by child, those
+// below it. Sets the copy of node's array in *out and returns where the
+// next block goes.
+static char *pack_subtree(Pack *pack, char *at, const DirNode *node, DirNode **out)
+{
+    uint32_t count = tree_child_count(node);
+    *out = NULL;
+    if (!count) return at;
+
+    Block *old = block_of(tree_children(node));
+    Block *b = (Block *)at;
+    b->pack = pack;
+    b->cap = count;
+    b->name_used = b->name_cap = old->name_used;
+    b->cls = PACKED_BLOCK;
+    b->ordered = false;
+    b->total = old->total;
+    memcpy(block_names(b), block_names(old), old->name_used);
+    for (uint32_t i = 0; i < count; i++)
+        copy_node(&b->nodes[i], &old->nodes[order_at(block_order(old), i)], old, b);
+    index_alloc(b);
+    index_fill(b, count);
+
+    at += packed_size(node);
+    for (uint32_t i = 0; i < count; i++) {
+        DirNode *children;
+        at = pack_subtree(pack, at, &old->nodes[order_at(block_order(old), i)], &children);
+        atomic_store_explicit(&b->nodes[i].children, children, memory_order_relaxed);
+        adopt(&b->nodes[i]);
+    }
+    *out = b->nodes;
+    return at;
+}
+
+void tree_repack(DirNode *node)
+{
+    uint32_t count = atomic_load_explicit(&node->child_count, memory_order_relaxed);
+    DirNode *children = atomic_load_explicit(&node->children, memory_order_relaxed);
+    if (!count) return;
+
+    unsigned blocks = 0;
+    size_t bytes = sizeof(Pack) + subtree_packed_size(node, &blocks);
+    Pack *pack = malloc(bytes);
+    if (!pack) return;      // stays scattered, which only costs speed
+    pack->bytes = bytes;
+    atomic_init(&pack->live, blocks);
+    DirNode *packed;
+    pack_subtree(pack, (char *)(pack + 1), node, &packed);
+    block_of(packed)->owner = node;
+    mem_add(bytes);
+
+    atomic_store_explicit(&node->children, packed, memory_order_release);
+    for (uint32_t i = 0; i < count; i++)
+        retire_subtree(&children[i], false);
+    retire(children);
 }
 
 void tree_free(DirNode *node)
 {
     if (!node) return;
-    free_children(node);
+    free_subtree(node);
     free(node);
 }
+
+const FileStats *tree_file_stats(const DirNode *node)
+{
+    return has_stats(node) ? atomic_load_explicit(&node->stats, memory_order_acquire)
+                           : NULL;
+}
+
+void tree_set_file_stats(DirNode *node, const FileStats *stats)
+{
+    if (!has_stats(node)) return;
+    Block *b = block_alloc(0, sizeof(FileStats), false);
+    if (!b) return;
+    FileStats *copy = (FileStats *)block_names(b);
+    memcpy(copy, stats, sizeof(FileStats));
+    Block *old = stats_block(node);
+    atomic_store_explicit(&node->stats, copy, memory_order_release);
+    if (old) {
+        account_retired(old, old);
+        retire_push(old, old);
+        if (atomic_load(&readers) == 0) reclaim();
+    }
+}
+
+void tree_mem_stats(TreeMemStats *out)
+{
+    out->reserved = atomic_load(&pool_reserved);
+    out->used = atomic_load(&mem_used);
+}
+
+void tree_mem_account(_Atomic int64_t *bytes)
+{
+    account = bytes;
+}
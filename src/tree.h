@@ -1,20 +1,155 @@
 #pragma once
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include "filestats.h"
+
+// Why a directory was left unscanned. Such nodes stay empty placeholders.
+typedef enum {
+    DIR_SCANNED,
+    DIR_OTHER_FS,       // mount point of another filesystem
+    DIR_EXCLUDED,       // matched an exclusion pattern
+} DirSkip;
+
+// What a node's union holds
+typedef enum {
+    NODE_SCANNED,       // stats
+    NODE_UNEXPANDED,    // opened from a snapshot, children still only in source
+    NODE_DIFFED,        // made by diff_trees, deltas
+    NODE_COLLAPSED,     // children dropped by tree_collapse, stats and a summary
+} NodeKind;
+
+// Writers (the scanner) serialize among themselves; readers (the renderer)
+// walk the tree lock-free between tree_read_begin and tree_read_end. Child
+// arrays are never modified in place once visible: growing or sorting them
+// publishes a new array and the old one is freed after the readers that
+// could still see it have left.
+//
+// A directory's children live in one pooled block together with their
+// names, so a node is a single cache line and leaves cost nothing beyond
+// their slot in the parent's block.
+//
+// Children are largest first, placeholders ahead of empty directories.
+// While a directory is being scanned they stay where they were added, since
+// jobs point at them, and its block keeps an order instead: a permutation
+// updated in place as sizes grow, so a reader passing a moving child may see
+// one twice or miss one for that pass.
+//
+// A node finds its parent through its slot: the block it sits in names the
+// directory it belongs to. Blocks of 32 children or more also hash their
+// names, so a lookup doesn't compare against every sibling.
+#define TREE_NO_SLOT UINT32_MAX
 
 typedef struct DirNode {
-    char            name[256];
-    uint64_t        size;
-    float           display_size;
-    uint32_t        file_count;
-    struct DirNode *children;
-    uint32_t        child_count;
-    uint32_t        child_capacity;
-    bool            complete;
+    // Read by every frame
+    _Atomic uint64_t  size;
+    _Atomic(struct DirNode *) children;
+    const char       *name;             // in the parent's block; the root's follows it
+    _Atomic uint32_t  child_count;
+    _Atomic uint32_t  file_count;
+    _Atomic float     display_size;     // animated by the renderer, relaxed
+    _Atomic uint32_t  placeholders;     // children that were skipped
+    atomic_bool       complete;
+    _Atomic uint8_t   skip;             // DirSkip
+    _Atomic uint8_t   kind;             // NodeKind
+    uint32_t          slot;             // in the parent's block, TREE_NO_SLOT for a root
+
+    // Scanned trees keep what their files are; trees opened from a snapshot
+    // instead know where their children are in it, and a diff how each
+    // directory changed. A collapsed directory keeps its files too.
+    union {
+        struct {
+            _Atomic(const FileStats *) stats;   // see tree_file_stats
+            uint32_t  collapsed_dirs;   // directories that were below it
+            uint32_t  collapsed_depth;  // levels of them
+        };
+        struct {
+            const struct Snapshot *source;
+            uint32_t  source_index;
+        };
+        struct {
+            int64_t   size_delta;       // after minus before
+            int32_t   files_delta;
+        };
+    };
 } DirNode;
 
 DirNode *tree_create(const char *name);
 DirNode *tree_add_child(DirNode *parent, const char *name);
+// Makes room for count more children with name_bytes of names in total
+// (terminators included), so adding them doesn't regrow the block
+void     tree_reserve_children(DirNode *parent, uint32_t count, size_t name_bytes);
+DirNode *tree_find_child(const DirNode *parent, const char *name);
+// NULL for a root. A reader may get a copy of the parent that is on its way
+// out, which stays readable until it leaves.
+DirNode *tree_parent(const DirNode *node);
+// Full path, the root's name first; false if it doesn't fit in cap
+bool     tree_path(const DirNode *node, char *buf, size_t cap);
+void     tree_mark_skipped(DirNode *parent, DirNode *child, DirSkip why);
+void     tree_remove_child(DirNode *parent, uint32_t index);
+void     tree_graft(DirNode *dst, DirNode *src);
+// Puts src's children, with everything below them, in place of dst's and
+// leaves src with none. For two scans of the same complete directory; dst's
+// old children are retired.
+void     tree_take_children(DirNode *dst, DirNode *src);
+void     tree_clear_children(DirNode *node);
+// Frees a complete subtree's children, keeping node's size and file count
+// and a summary of what was below it, and returns how many nodes went. The
+// memory only goes back if they aren't part of a pack made for one of
+// node's ancestors.
+uint32_t tree_collapse(DirNode *node);
+// Grows node and every directory above it, keeping their orders
 void     tree_propagate_size(DirNode *node, uint64_t added);
+// Grows child's size and moves it up parent's order (parent may be NULL)
+void     tree_add_size(DirNode *parent, DirNode *child, uint64_t added);
+// Sum of the children's sizes, without the directory's own files
+uint64_t tree_children_size(const DirNode *node);
 void     tree_sort_children(DirNode *node);
+// Moves every child array below node into one allocation, each directory's
+// ahead of its subdirectories', so a depth-first walk reads it front to
+// back. For complete subtrees: nothing else may write to them meanwhile.
+void     tree_repack(DirNode *node);
 void     tree_free(DirNode *node);
+// What the files below node are, NULL if none were kept. A reader has to
+// stay in its read section while using them.
+const FileStats *tree_file_stats(const DirNode *node);
+// Replaces node's with a copy of stats
+void     tree_set_file_stats(DirNode *node, const FileStats *stats);
+const char *tree_skip_label(DirSkip why);
+
+// Memory held by child blocks of all trees in the process
+typedef struct {
+    size_t reserved;    // taken from the system for pooled blocks
+    size_t used;        // in live or retired blocks, including large ones
+} TreeMemStats;
+
+void     tree_mem_stats(TreeMemStats *out);
+// Blocks the calling thread allocates from now on also count into *bytes,
+// and come off it as the thread retires them, so a scan can tell what its
+// own tree holds. NULL stops counting.
+void     tree_mem_account(_Atomic int64_t *bytes);
+
+void     tree_read_begin(void);
+void     tree_read_end(void);
+
+// Reader-side accessors; load the count before the array
+static inline uint32_t tree_child_count(const DirNode *node)
+{
+    return atomic_load_explicit(&node->child_count, memory_order_acquire);
+}
+
+static inline DirNode *tree_children(const DirNode *node)
+{
+    return atomic_load_explicit(&node->children, memory_order_acquire);
+}
+
+// The order of an array from tree_children, NULL if it is sorted in place
+const _Atomic uint32_t *tree_child_order(DirNode *children);
+
+// i-th largest child
+static inline DirNode *tree_child_at(DirNode *children, const _Atomic uint32_t *order,
+                                     uint32_t i)
+{
+    return &children[order ? atomic_load_explicit(&order[i], memory_order_acquire) : i];
+}
@@ -0,0 +1,930 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+#include "watcher.h"
+
+#ifdef __linux__
+
+#include <SDL3/SDL_thread.h>
+#include <SDL3/SDL_timer.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/fanotify.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+
+// Events are coalesced per entry and applied once the queue has been
+// quiet for a poll interval, or at least every FLUSH_MS under a steady stream.
+#define POLL_MS  200
+#define FLUSH_MS 1000
+
+// The first event in a directory lists it, remembering its files' sizes;
+// later ones only stat the entry they name. Past CACHED_DIRS_MAX such
+// directories all are forgotten, and listed again as events come.
+#define CACHED_DIRS_MAX 4096
+// fanotify parent handles kept resolved, to a path or to outside the root
+#define HANDLES_MAX     65536
+
+#define INOTIFY_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | \
+                      IN_MOVED_FROM | IN_MOVED_TO)
+
+typedef enum { WATCH_FANOTIFY, WATCH_INOTIFY } WatchBackend;
+
+// Hash map keyed by bytes, chained so entries can go one at a time
+typedef struct MapEntry {
+    struct MapEntry *next;
+    uint64_t         hash;
+    union {
+        void        *ptr;
+        uint64_t     size;
+    };
+    size_t           len;
+    char             key[];     // len bytes, then a terminator
+} MapEntry;
+
+typedef struct {
+    MapEntry **buckets;
+    size_t     cap, count;      // cap is a power of two
+} Map;
+
+// Sizes of a directory's files as last seen, so an event on one of them
+// applies its own difference
+typedef struct {
+    dev_t    dev;
+    ino_t    ino;           // of the directory listed, not whatever is there now
+    uint32_t flush;         // the flush it was listed in
+    Map      files;         // name -> size
+} DirCache;
+
+struct Watcher {
+    ScanContext  *ctx;
+    SDL_Thread   *thread;
+    atomic_bool   stop;
+    WatchBackend  backend;
+    int           fd;
+    int           mount_fd;
+    char          root[PATH_MAX];
+    size_t        root_len;
+
+    char        **wd_paths;     // inotify: watch descriptor -> relative path
+    int           wd_cap;
+    bool          watches_full;
+
+    fsid_t        fsid;         // fanotify: of the root's filesystem
+    Map           handles;      // fanotify: parent handle -> relative path, NULL outside
+
+    Map           pending;      // "dir\0name" to apply, an empty name to list dir
+    Map           caches;       // relative path -> DirCache
+    uint32_t      flushes;
+};
+
+static uint64_t hash_bytes(const void *key, size_t len)
+{
+    const unsigned char *p = key;
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ p[i]) * 1099511628211ULL;
+    return h;
+}
+
+static MapEntry **map_slot(const Map *m, const void *key, size_t len, uint64_t hash)
+{
+    MapEntry **at = &m->buckets[hash & (m->cap - 1)];
+    while (*at && ((*at)->hash != hash || (*at)->len != len ||
+                   memcmp((*at)->key, key, len) != 0))
+        at = &(*at)->next;
+    return at;
+}
+
+static MapEntry *map_find(const Map *m, const void *key, size_t len)
+{
+    return m->count ? *map_slot(m, key, len, hash_bytes(key, len)) : NULL;
+}
+
+static bool map_grow(Map *m)
+{
+    size_t cap = m->cap ? m->cap * 2 : 64;
+    MapEntry **buckets = calloc(cap, sizeof(MapEntry *));
+    if (!buckets) return false;
+    for (size_t i = 0; i < m->cap; i++) {
+        for (MapEntry *e = m->buckets[i], *next; e; e = next) {
+            next = e->next;
+            MapEntry **at = &buckets[e->hash & (cap - 1)];
+            e->next = *at;
+            *at = e;
+        }
+    }
+    free(m->buckets);
+    m->buckets = buckets;
+    m->cap = cap;
+    return true;
+}
+
+// The entry for key, added zeroed if it wasn't there; NULL if out of memory
+static MapEntry *map_add(Map *m, const void *key, size_t len)
+{
+    if (m->count >= m->cap && !map_grow(m) && !m->cap) return NULL;
+    uint64_t hash = hash_bytes(key, len);
+    MapEntry **at = map_slot(m, key, len, hash);
+    if (*at) return *at;
+    MapEntry *e = calloc(1, sizeof(MapEntry) + len + 1);
+    if (!e) return NULL;
+    e->hash = hash;
+    e->len = len;
+    memcpy(e->key, key, len);
+    *at = e;
+    m->count++;
+    return e;
+}
+
+static void map_remove(Map *m, MapEntry *e)
+{
+    MapEntry **at = &m->buckets[e->hash & (m->cap - 1)];
+    while (*at != e) at = &(*at)->next;
+    *at = e->next;
+    free(e);
+    m->count--;
+}
+
+static void map_clear(Map *m, void (*free_ptr)(void *))
+{
+    for (size_t i = 0; i < m->cap; i++) {
+        for (MapEntry *e = m->buckets[i], *next; e; e = next) {
+            next = e->next;
+            if (free_ptr) free_ptr(e->ptr);
+            free(e);
+        }
+        m->buckets[i] = NULL;
+    }
+    m->count = 0;
+}
+
+static void map_free(Map *m, void (*free_ptr)(void *))
+{
+    map_clear(m, free_ptr);
+    free(m->buckets);
+}
+
+static void cache_free(void *p)
+{
+    DirCache *cache = p;
+    if (!cache) return;
+    map_free(&cache->files, NULL);
+    free(cache);
+}
+
+// Queues name in the directory rel for the next flush; an empty name has
+// all of rel listed again
+static void queue_event(Watcher *w, const char *rel, const char *name)
+{
+    char key[PATH_MAX + NAME_MAX + 2];
+    size_t rel_len = strlen(rel), name_len = strlen(name);
+    if (rel_len + 1 + name_len >= sizeof(key)) return;
+    memcpy(key, rel, rel_len + 1);
+    memcpy(key + rel_len + 1, name, name_len);
+    map_add(&w->pending, key, rel_len + 1 + name_len);
+}
+
+static const char *event_name(const MapEntry *e)
+{
+    return e->key + strlen(e->key) + 1;
+}
+
+// Events were lost: the root and every directory with remembered files are
+// listed again
+static void queue_overflow(Watcher *w)
+{
+    queue_event(w, "", "");
+    for (size_t i = 0; i < w->caches.cap; i++) {
+        for (MapEntry *e = w->caches.buckets[i]; e; e = e->next)
+            queue_event(w, e->key, "");
+    }
+    map_clear(&w->handles, free);
+}
+
+// Full path of a directory relative to the root, false if it doesn't fit
+static bool full_path(const Watcher *w, const char *rel, char *buf, size_t cap)
+{
+    int n = *rel ? snprintf(buf, cap, "%s/%s", w->root, rel)
+                 : snprintf(buf, cap, "%s", w->root);
+    return n >= 0 && (size_t)n < cap;
+}
+
+// rel/name, or just name for the root; false if it doesn't fit
+static bool join_rel(const char *rel, const char *name, char *buf, size_t cap)
+{
+    int n = *rel ? snprintf(buf, cap, "%s/%s", rel, name)
+                 : snprintf(buf, cap, "%s", name);
+    return n >= 0 && (size_t)n < cap;
+}
+
+static void add_watch(Watcher *w, const char *rel)
+{
+    char path[PATH_MAX];
+    if (w->watches_full || !full_path(w, rel, path, sizeof(path))) return;
+
+    int wd = inotify_add_watch(w->fd, path, INOTIFY_MASK | IN_DONT_FOLLOW);
+    if (wd < 0) {
+        if (errno == ENOSPC) {
+            fprintf(stderr, "watcher: inotify watch limit reached, "
+                    "changes below %s may be missed\n", path);
+            w->watches_full = true;
+        }
+        return;
+    }
+
+    if (wd >= w->wd_cap) {
+        int new_cap = w->wd_cap ? w->wd_cap : 256;
+        while (new_cap <= wd) new_cap *= 2;
+        char **buf = realloc(w->wd_paths, new_cap * sizeof(char *));
+        if (!buf) return;
+        memset(buf + w->wd_cap, 0, (new_cap - w->wd_cap) * sizeof(char *));
+        w->wd_paths = buf;
+        w->wd_cap = new_cap;
+    }
+    free(w->wd_paths[wd]);
+    w->wd_paths[wd] = strdup(rel);
+}
+
+static void add_watches(Watcher *w, const DirNode *node, char *rel, size_t len)
+{
+    add_watch(w, rel);
+
+    uint32_t count = tree_child_count(node);
+    DirNode *children = tree_children(node);
+    for (uint32_t i = 0; i < count; i++) {
+        size_t name_len = strlen(children[i].name);
+        size_t sep = len ? 1 : 0;
+        if (len + sep + name_len >= PATH_MAX) continue;
+        if (sep) rel[len] = '/';
+        memcpy(rel + len + sep, children[i].name, name_len + 1);
+        add_watches(w, &children[i], rel, len + sep + name_len);
+        rel[len] = '\0';
+    }
+}
+
+static void read_inotify(Watcher *w)
+{
+    _Alignas(struct inotify_event) char buf[16384];
+    ssize_t n;
+    while ((n = read(w->fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n;) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                queue_overflow(w);
+                continue;
+            }
+            if (ev->wd < 0 || ev->wd >= w->wd_cap || !w->wd_paths[ev->wd])
+                continue;
+            if (ev->mask & IN_IGNORED) {
+                free(w->wd_paths[ev->wd]);
+                w->wd_paths[ev->wd] = NULL;
+                continue;
+            }
+            queue_event(w, w->wd_paths[ev->wd], ev->len ? ev->name : "");
+        }
+    }
+}
+
+// The directory a handle names relative to the root, NULL if it is outside
+// it or gone. Answers are kept, so a busy directory elsewhere on the
+// filesystem is only resolved once.
+static const char *resolve_handle(Watcher *w, struct file_handle *handle, size_t len)
+{
+    MapEntry *e = map_find(&w->handles, handle, len);
+    if (e) return e->ptr;
+
+    int dfd = open_by_handle_at(w->mount_fd, handle, O_PATH | O_CLOEXEC);
+    if (dfd < 0) return NULL;
+    char link[64], path[PATH_MAX];
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", dfd);
+    ssize_t n = readlink(link, path, sizeof(path) - 1);
+    close(dfd);
+    if (n <= 0) return NULL;
+    path[n] = '\0';
+
+    char *rel = NULL;
+    if (strncmp(path, w->root, w->root_len) == 0 &&
+        (path[w->root_len] == '/' || path[w->root_len] == '\0'))
+        rel = strdup(path[w->root_len] ? path + w->root_len + 1 : "");
+
+    if (w->handles.count >= HANDLES_MAX) map_clear(&w->handles, free);
+    e = map_add(&w->handles, handle, len);
+    if (!e) {
+        free(rel);
+        return NULL;
+    }
+    e->ptr = rel;
+    return rel;
+}
+
+static void read_fanotify(Watcher *w)
+{
+    _Alignas(struct fanotify_event_metadata) char buf[16384];
+    ssize_t n;
+    while ((n = read(w->fd, buf, sizeof(buf))) > 0) {
+        // Events with names are only padded to 4 bytes, so the 8-byte
+        // aligned header is copied out rather than pointed at
+        size_t at = 0;
+        while (at + FAN_EVENT_METADATA_LEN <= (size_t)n) {
+            struct fanotify_event_metadata meta, *m = &meta;
+            memcpy(m, buf + at, sizeof(meta));
+            if (m->event_len < FAN_EVENT_METADATA_LEN || at + m->event_len > (size_t)n)
+                break;
+            char *event = buf + at;
+            at += m->event_len;
+            if (m->mask & FAN_Q_OVERFLOW) {
+                queue_overflow(w);
+                continue;
+            }
+
+            // With FAN_REPORT_DFID_NAME the record names the parent directory
+            if (m->metadata_len + sizeof(struct fanotify_event_info_fid) > m->event_len)
+                continue;
+            struct fanotify_event_info_fid *fid =
+                (struct fanotify_event_info_fid *)(event + m->metadata_len);
+            if (fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME &&
+                fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID)
+                continue;
+
+            // The mark covers the whole filesystem; what happens elsewhere
+            // on it is dropped by its handle, without resolving a path
+            if (memcmp(&fid->fsid, &w->fsid, sizeof(w->fsid)) != 0) continue;
+            struct file_handle *handle = (struct file_handle *)fid->handle;
+            size_t len = sizeof(*handle) + handle->handle_bytes;
+            const char *name = fid->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME
+                             ? (const char *)handle->f_handle + handle->handle_bytes : "";
+            const char *rel = resolve_handle(w, handle, len);
+            if (rel) queue_event(w, rel, name);
+
+            // A directory moved or went away, and the paths of those below
+            // it with it
+            if ((m->mask & FAN_ONDIR) &&
+                (m->mask & (FAN_MOVED_FROM | FAN_MOVED_TO | FAN_DELETE)))
+                map_clear(&w->handles, free);
+        }
+    }
+}
+
+static int cmp_str(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// By directory, then name: parents before children, so a new subtree is
+// grafted before any of its own events are looked up, and a directory is
+// listed before its entries' events find it already done
+static int cmp_event(const void *a, const void *b)
+{
+    const MapEntry *ea = *(MapEntry *const *)a, *eb = *(MapEntry *const *)b;
+    int c = strcmp(ea->key, eb->key);
+    return c ? c : strcmp(event_name(ea), event_name(eb));
+}
+
+// Resolves a path relative to the root to its node
+static DirNode *lookup(Watcher *w, const char *rel)
+{
+    DirNode *node = w->ctx->root;
+    char name[256];
+    const char *p = rel;
+    while (*p && node) {
+        const char *end = strchr(p, '/');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len >= sizeof(name)) return NULL;
+        memcpy(name, p, len);
+        name[len] = '\0';
+        node = tree_find_child(node, name);
+        p = end ? end + 1 : p + len;
+    }
+    return node;
+}
+
+// A collapsed node has no children to compare against; its next expansion
+// lists it afresh
+static bool watched(const DirNode *node)
+{
+    return node && node->complete && atomic_load(&node->kind) != NODE_COLLAPSED;
+}
+
+// Scans a new directory as the watched scan would have, minus what only the
+// whole scan collects
+static DirNode *scan_subtree(ScanContext *ctx, const char *path)
+{
+    ScanOptions opts = scanner_sub_options(ctx);
+    opts.threads = 1;       // most new directories are small
+    ScanContext *sub = scanner_start_opts(path, &opts);
+    if (!sub) return NULL;
+    scanner_wait(sub);
+    DirNode *root = sub->root;
+    sub->root = NULL;
+    scanner_free(sub);
+    return root;
+}
+
+// What a directory that appeared at path becomes: scanned, or the
+// placeholder the scan would have left
+static void prepare_dir(ScanContext *ctx, const char *path, dev_t parent_dev,
+                        DirNode **graft, DirSkip *skip)
+{
+    const ScanExclude *ex = ctx->opts.exclude;
+    struct stat st;
+    *graft = NULL;
+    *skip = DIR_SCANNED;
+    if (ex && exclude_matched(ex, exclude_start(ex, path)))
+        *skip = DIR_EXCLUDED;
+    else if (ctx->opts.one_filesystem && stat(path, &st) == 0 && st.st_dev != parent_dev)
+        *skip = DIR_OTHER_FS;
+    else
+        *graft = scan_subtree(ctx, path);
+}
+
+// Adds what prepare_dir made as node's child name, false if there was
+// nothing to add or no room for it
+static bool add_dir(DirNode *node, const char *name, DirNode *graft, DirSkip skip,
+                    int64_t *dsize, int64_t *dfiles)
+{
+    if (!graft && skip == DIR_SCANNED) return false;
+    DirNode *child = tree_find_child(node, name) ? NULL : tree_add_child(node, name);
+    if (!child) {
+        tree_free(graft);
+        return false;
+    }
+    if (skip != DIR_SCANNED) {
+        tree_mark_skipped(node, child, skip);
+        return true;
+    }
+    *dsize += (int64_t)graft->size;
+    *dfiles += (int64_t)graft->file_count;
+    tree_graft(child, graft);
+    return true;
+}
+
+// A child directory gone from disk leaves the tree, and what was remembered
+// about its files with it
+static void remove_dir(Watcher *w, DirNode *node, DirNode *child, const char *rel,
+                       int64_t *dsize, int64_t *dfiles)
+{
+    char sub[PATH_MAX];
+    if (join_rel(rel, child->name, sub, sizeof(sub))) {
+        MapEntry *e = map_find(&w->caches, sub, strlen(sub));
+        if (e) {
+            cache_free(e->ptr);
+            map_remove(&w->caches, e);
+        }
+    }
+    *dsize -= (int64_t)child->size;
+    *dfiles -= (int64_t)child->file_count;
+    tree_remove_child(node, (uint32_t)(child - tree_children(node)));
+}
+
+// The search record of a directory relative to the root
+static uint32_t search_record(SearchIndex *index, const char *rel)
+{
+    uint32_t record = SEARCH_ROOT;
+    char name[256];
+    const char *p = rel;
+    while (*p && record != SEARCH_NONE) {
+        const char *end = strchr(p, '/');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len >= sizeof(name)) return SEARCH_NONE;
+        memcpy(name, p, len);
+        name[len] = '\0';
+        record = search_child_record(index, record, name);
+        p = end ? end + 1 : p + len;
+    }
+    return record;
+}
+
+// Records node and everything below it under parent's record, keeping the
+// records of names that were there before
+static void index_dir(SearchIndex *index, uint32_t parent, const DirNode *node)
+{
+    uint32_t record = search_child_record(index, parent, node->name);
+    if (record == SEARCH_NONE) record = search_add_dirs(index, parent, node, 1);
+    if (record == SEARCH_NONE) return;
+    uint32_t count = tree_child_count(node);
+    const DirNode *children = tree_children(node);
+    for (uint32_t i = 0; i < count; i++)
+        index_dir(index, record, &children[i]);
+}
+
+// Applies node's change to it and every ancestor, then re-sorts them
+// deepest first: sorting a level moves the node below it, which is done
+static void settle(ScanContext *ctx, DirNode *node, int64_t dsize, int64_t dfiles)
+{
+    for (DirNode *n = node; n; n = tree_parent(n)) {
+        atomic_fetch_add(&n->size, (uint64_t)dsize);
+        atomic_fetch_add(&n->file_count, (uint32_t)dfiles);
+    }
+    atomic_fetch_add(&ctx->total_size, (uint64_t)dsize);
+    atomic_fetch_add(&ctx->total_files, (uint32_t)dfiles);
+
+    for (DirNode *n = node; n;) {
+        DirNode *parent = tree_parent(n);
+        tree_sort_children(n);
+        n = parent;
+    }
+}
+
+// Watches a directory grafted as rel/name and everything below it
+static void watch_new(Watcher *w, const char *rel, const char *name)
+{
+    char sub[PATH_MAX];
+    if (w->backend != WATCH_INOTIFY || !join_rel(rel, name, sub, sizeof(sub)))
+        return;
+    DirNode *child = lookup(w, sub);
+    if (child) add_watches(w, child, sub, strlen(sub));
+}
+
+// Lists one directory again and applies what changed since the tree saw it:
+// its own files as a size delta, vanished subdirectories removed, new ones
+// scanned and grafted. Every ancestor takes the same delta. The sizes of
+// its files are remembered for the events that follow.
+static void resync(Watcher *w, const char *rel)
+{
+    ScanContext *ctx = w->ctx;
+    size_t rel_len = strlen(rel);
+    MapEntry *old = map_find(&w->caches, rel, rel_len);
+    if (old) {
+        cache_free(old->ptr);
+        map_remove(&w->caches, old);
+    }
+
+    char path[PATH_MAX];
+    if (!full_path(w, rel, path, sizeof(path))) return;
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) return;     // gone; the parent's own event removes it
+    struct stat dir_st;
+    DIR *dir = fstat(fd, &dir_st) == 0 ? fdopendir(fd) : NULL;
+    if (!dir) {
+        close(fd);
+        return;
+    }
+
+    DirCache *cache = calloc(1, sizeof(DirCache));
+    uint64_t direct_size = 0;
+    uint32_t direct_files = 0;
+    char **names = NULL;
+    uint32_t name_count = 0, name_cap = 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *n = entry->d_name;
+        if (n[0] == '.' && (n[1] == '\0' || (n[1] == '.' && n[2] == '\0')))
+            continue;
+
+        bool is_dir = entry->d_type == DT_DIR;
+        if (!is_dir) {
+            struct stat st;
+            if (fstatat(fd, n, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+            if (S_ISREG(st.st_mode)) {
+                direct_size += st.st_size;
+                direct_files++;
+                MapEntry *file = cache ? map_add(&cache->files, n, strlen(n)) : NULL;
+                if (file) {
+                    file->size = st.st_size;
+                } else {
+                    cache_free(cache);
+                    cache = NULL;
+                }
+                continue;
+            }
+            is_dir = S_ISDIR(st.st_mode);
+        }
+        if (!is_dir) continue;
+
+        if (name_count == name_cap) {
+            name_cap = name_cap ? name_cap * 2 : 64;
+            char **buf = realloc(names, name_cap * sizeof(char *));
+            if (!buf) break;
+            names = buf;
+        }
+        names[name_count] = strdup(n);
+        if (names[name_count]) name_count++;
+    }
+    closedir(dir);
+    if (name_count > 1) qsort(names, name_count, sizeof(char *), cmp_str);
+
+    // Subdirectories new on disk are scanned before taking the lock
+    DirNode *node = lookup(w, rel);
+    if (!watched(node)) goto out;
+
+    DirNode **grafts = calloc(name_count + 1, sizeof(DirNode *));
+    DirSkip *skips = calloc(name_count + 1, sizeof(DirSkip));
+    if (!grafts || !skips) {
+        free(grafts);
+        free(skips);
+        goto out;
+    }
+    for (uint32_t i = 0; i < name_count; i++) {
+        char sub[PATH_MAX];
+        if (tree_find_child(node, names[i])) continue;
+        if (snprintf(sub, sizeof(sub), "%s/%s", path, names[i]) >= (int)sizeof(sub))
+            continue;
+        prepare_dir(ctx, sub, dir_st.st_dev, &grafts[i], &skips[i]);
+    }
+
+    // An expansion can graft or re-sort this part of the tree meanwhile, so
+    // the node and its children are looked up again under the lock.
+    SDL_LockMutex(ctx->mutex);
+    node = lookup(w, rel);
+    if (!watched(node)) {
+        SDL_UnlockMutex(ctx->mutex);
+        for (uint32_t i = 0; i < name_count; i++)
+            tree_free(grafts[i]);
+        free(grafts);
+        free(skips);
+        goto out;
+    }
+
+    uint32_t count = tree_child_count(node);
+    DirNode *children = tree_children(node);
+    uint64_t child_size = 0;
+    uint32_t child_files = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        child_size += children[i].size;
+        child_files += children[i].file_count;
+    }
+    int64_t dsize = (int64_t)direct_size - (int64_t)(node->size - child_size);
+    int64_t dfiles = (int64_t)direct_files - (int64_t)(node->file_count - child_files);
+
+    // Children no longer on disk are gone. Removing one only shifts the
+    // indices above it, so walk down from the top.
+    for (uint32_t i = count; i-- > 0;) {
+        DirNode *child = &tree_children(node)[i];
+        if (!bsearch(&child->name, names, name_count, sizeof(char *), cmp_str))
+            remove_dir(w, node, child, rel, &dsize, &dfiles);
+    }
+    bool *added = calloc(name_count + 1, sizeof(bool));
+    for (uint32_t i = 0; added && i < name_count; i++)
+        added[i] = add_dir(node, names[i], grafts[i], skips[i], &dsize, &dfiles);
+
+    // Before sorting moves node: what was added is found by name under it
+    uint32_t record = ctx->search ? search_record(ctx->search, rel) : SEARCH_NONE;
+    for (uint32_t i = 0; added && record != SEARCH_NONE && i < name_count; i++) {
+        DirNode *child = added[i] ? tree_find_child(node, names[i]) : NULL;
+        if (child) index_dir(ctx->search, record, child);
+    }
+    settle(ctx, node, dsize, dfiles);
+    SDL_UnlockMutex(ctx->mutex);
+
+    for (uint32_t i = 0; added && i < name_count; i++) {
+        if (added[i] && skips[i] == DIR_SCANNED) watch_new(w, rel, names[i]);
+    }
+    if (!added) {
+        for (uint32_t i = 0; i < name_count; i++)
+            tree_free(grafts[i]);
+    }
+    free(added);
+    free(grafts);
+    free(skips);
+
+    if (cache) {
+        if (w->caches.count >= CACHED_DIRS_MAX) map_clear(&w->caches, cache_free);
+        MapEntry *e = map_add(&w->caches, rel, rel_len);
+        if (e) {
+            cache->dev = dir_st.st_dev;
+            cache->ino = dir_st.st_ino;
+            cache->flush = w->flushes;
+            e->ptr = cache;
+            cache = NULL;
+        }
+    }
+out:
+    cache_free(cache);
+    for (uint32_t i = 0; i < name_count; i++) free(names[i]);
+    free(names);
+}
+
+// Applies one entry's change: a file's own size difference from what was
+// remembered, a directory removed, or a new one scanned and grafted. A
+// directory without remembered files, or listed since the event, is listed.
+static void apply_event(Watcher *w, const char *rel, const char *name)
+{
+    ScanContext *ctx = w->ctx;
+    MapEntry *e = map_find(&w->caches, rel, strlen(rel));
+    DirCache *cache = e ? e->ptr : NULL;
+    if (cache && cache->flush == w->flushes) return;
+
+    char path[PATH_MAX], sub[PATH_MAX];
+    struct stat dir_st, st;
+    if (!full_path(w, rel, path, sizeof(path))) return;
+    if (!*name || !cache || stat(path, &dir_st) != 0 ||
+        dir_st.st_dev != cache->dev || dir_st.st_ino != cache->ino) {
+        resync(w, rel);
+        return;
+    }
+    if (snprintf(sub, sizeof(sub), "%s/%s", path, name) >= (int)sizeof(sub))
+        return;
+    bool exists = lstat(sub, &st) == 0;
+    bool is_reg = exists && S_ISREG(st.st_mode);
+    bool is_dir = exists && S_ISDIR(st.st_mode);
+
+    DirNode *node = lookup(w, rel);
+    if (!watched(node)) return;
+    DirNode *graft = NULL;
+    DirSkip skip = DIR_SCANNED;
+    if (is_dir && !tree_find_child(node, name))
+        prepare_dir(ctx, sub, dir_st.st_dev, &graft, &skip);
+
+    SDL_LockMutex(ctx->mutex);
+    node = lookup(w, rel);
+    if (!watched(node)) {
+        SDL_UnlockMutex(ctx->mutex);
+        tree_free(graft);
+        return;
+    }
+
+    int64_t dsize = 0, dfiles = 0;
+    size_t name_len = strlen(name);
+    MapEntry *file = map_find(&cache->files, name, name_len);
+    if (file && !is_reg) {
+        dsize -= (int64_t)file->size;
+        dfiles--;
+        map_remove(&cache->files, file);
+    } else if (is_reg) {
+        if (!file) dfiles++;
+        dsize += (int64_t)st.st_size - (int64_t)(file ? file->size : 0);
+        if (!file) file = map_add(&cache->files, name, name_len);
+        // Without the size on record, the next event lists it all again
+        if (file) file->size = st.st_size;
+        else cache->ino = 0;
+    }
+
+    DirNode *child = tree_find_child(node, name);
+    if (child && !is_dir)
+        remove_dir(w, node, child, rel, &dsize, &dfiles);
+    bool added = !child && add_dir(node, name, graft, skip, &dsize, &dfiles);
+    if (child) tree_free(graft);
+    uint32_t record = added && ctx->search ? search_record(ctx->search, rel) : SEARCH_NONE;
+    child = record != SEARCH_NONE ? tree_find_child(node, name) : NULL;
+    if (child) index_dir(ctx->search, record, child);
+    settle(ctx, node, dsize, dfiles);
+    SDL_UnlockMutex(ctx->mutex);
+
+    if (added && skip == DIR_SCANNED) watch_new(w, rel, name);
+}
+
+static void flush_events(Watcher *w)
+{
+    MapEntry **events = malloc(w->pending.count * sizeof(MapEntry *));
+    if (events) {
+        size_t count = 0;
+        for (size_t i = 0; i < w->pending.cap; i++) {
+            for (MapEntry *e = w->pending.buckets[i]; e; e = e->next)
+                events[count++] = e;
+        }
+        qsort(events, count, sizeof(MapEntry *), cmp_event);
+
+        w->flushes++;
+        tree_read_begin();
+        for (size_t i = 0; i < count && !atomic_load(&w->stop); i++)
+            apply_event(w, events[i]->key, event_name(events[i]));
+        tree_read_end();
+        free(events);
+    }
+    map_clear(&w->pending, NULL);
+}
+
+static int watcher_fn(void *data)
+{
+    Watcher *w = data;
+    uint64_t first_pending = 0;
+
+    while (!atomic_load(&w->stop)) {
+        struct pollfd pfd = {.fd = w->fd, .events = POLLIN};
+        int ready = poll(&pfd, 1, POLL_MS);
+
+        if (ready > 0) {
+            size_t before = w->pending.count;
+            if (w->backend == WATCH_FANOTIFY) read_fanotify(w);
+            else read_inotify(w);
+            if (before == 0 && w->pending.count > 0)
+                first_pending = SDL_GetTicks();
+        }
+
+        if (w->pending.count > 0 &&
+            (ready == 0 || SDL_GetTicks() - first_pending >= FLUSH_MS))
+            flush_events(w);
+    }
+    return 0;
+}
+
+static bool open_fanotify(Watcher *w)
+{
+    w->fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK |
+                          FAN_REPORT_DFID_NAME, O_RDONLY | O_LARGEFILE);
+    if (w->fd < 0) return false;
+
+    uint64_t mask = FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO |
+                    FAN_MODIFY | FAN_CLOSE_WRITE | FAN_ONDIR;
+    w->mount_fd = open(w->root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct statfs sfs;
+    if (w->mount_fd < 0 || fstatfs(w->mount_fd, &sfs) != 0 ||
+        fanotify_mark(w->fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask,
+                      AT_FDCWD, w->root) != 0) {
+        if (w->mount_fd >= 0) close(w->mount_fd);
+        close(w->fd);
+        w->fd = w->mount_fd = -1;
+        return false;
+    }
+    w->fsid = sfs.f_fsid;
+    w->backend = WATCH_FANOTIFY;
+    return true;
+}
+
+static bool open_inotify(Watcher *w)
+{
+    w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w->fd < 0) return false;
+    w->backend = WATCH_INOTIFY;
+
+    char rel[PATH_MAX] = "";
+    add_watches(w, w->ctx->root, rel, 0);
+    return true;
+}
+
+Watcher *watcher_start(ScanContext *ctx)
+{
+    // Snapshot trees are only partly materialized and may be stale anyway
+    if (!ctx || !atomic_load(&ctx->done) || atomic_load(&ctx->cancel) ||
+        ctx->snapshot)
+        return NULL;
+
+    Watcher *w = calloc(1, sizeof(Watcher));
+    if (!w) return NULL;
+    w->ctx = ctx;
+    w->fd = w->mount_fd = -1;
+    if (!realpath(ctx->root->name, w->root)) {
+        free(w);
+        return NULL;
+    }
+    w->root_len = strlen(w->root);
+    if (w->root_len > 1 && w->root[w->root_len - 1] == '/')
+        w->root[--w->root_len] = '\0';
+
+    if (!open_fanotify(w) && !open_inotify(w)) {
+        free(w);
+        return NULL;
+    }
+
+    w->thread = SDL_CreateThread(watcher_fn, "watcher", w);
+    if (!w->thread) {
+        watcher_stop(w);
+        return NULL;
+    }
+    return w;
+}
+
+const char *watcher_backend(const Watcher *w)
+{
+    if (!w) return "none";
+    return w->backend == WATCH_FANOTIFY ? "fanotify" : "inotify";
+}
+
+void watcher_stop(Watcher *w)
+{
+    if (!w) return;
+    atomic_store(&w->stop, true);
+    SDL_WaitThread(w->thread, NULL);
+    if (w->fd >= 0) close(w->fd);
+    if (w->mount_fd >= 0) close(w->mount_fd);
+    for (int i = 0; i < w->wd_cap; i++)
+        free(w->wd_paths[i]);
+    free(w->wd_paths);
+    map_free(&w->handles, free);
+    map_free(&w->pending, NULL);
+    map_free(&w->caches, cache_free);
+    free(w);
+}
+
+#else
+
+Watcher *watcher_start(ScanContext *ctx)
+{
+    (void)ctx;
+    return NULL;
+}
+
+const char *watcher_backend(const Watcher *w)
+{
+    (void)w;
+    return "none";
+}
+
+void watcher_stop(Watcher *w)
+{
+    (void)w;
+}
+
+#endif
@@ -0,0 +1,13 @@
+#pragma once
+#include "scanner.h"
+
+// Keeps a finished scan current by applying each entry the kernel reports
+// as changed to the tree. A directory is listed once, on its first event or
+// after lost events, and later ones stat only the entry they name. Linux
+// only: fanotify filesystem marks when permitted, recursive inotify otherwise.
+
+typedef struct Watcher Watcher;
+
+Watcher    *watcher_start(ScanContext *ctx);    // NULL if unsupported
+const char *watcher_backend(const Watcher *w);
+void        watcher_stop(Watcher *w);
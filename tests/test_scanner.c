@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -6,6 +7,9 @@
 #include <unistd.h>
 #include <SDL3/SDL.h>
 #include "scanner.h"
+#include "watcher.h"
+#include "snapshot.h"
+#include "diff.h"
 
 static void make_test_dir(void)
 {
@@ -65,11 +69,826 @@ void test_scan_empty(void)
     rmdir("/tmp/zf_test_empty");
 }
 
+static void make_deep_dir(const char *path, int depth)
+{
+    mkdir(path, 0755);
+    char sub[256];
+    snprintf(sub, sizeof(sub), "%s/f", path);
+    FILE *f = fopen(sub, "w");
+    if (f) { fprintf(f, "%*s", 100, ""); fclose(f); }
+    if (depth == 0) return;
+    for (int i = 0; i < 3; i++) {
+        snprintf(sub, sizeof(sub), "%s/d%d", path, i);
+        make_deep_dir(sub, depth - 1);
+    }
+}
+
+static void remove_deep_dir(const char *path, int depth)
+{
+    char sub[256];
+    if (depth > 0) {
+        for (int i = 0; i < 3; i++) {
+            snprintf(sub, sizeof(sub), "%s/d%d", path, i);
+            remove_deep_dir(sub, depth - 1);
+        }
+    }
+    snprintf(sub, sizeof(sub), "%s/f", path);
+    unlink(sub);
+    rmdir(path);
+}
+
+static uint32_t count_complete(DirNode *node)
+{
+    uint32_t n = node->complete ? 1 : 0;
+    for (uint32_t i = 0; i < node->child_count; i++)
+        n += count_complete(&node->children[i]);
+    return n;
+}
+
+void test_scan_parallel(void)
+{
+    // 1 + 3 + 9 + 27 + 81 directories, one 100-byte file each
+    make_deep_dir("/tmp/zf_test_deep", 4);
+
+    ScanOptions opts = {.threads = 4};
+    ScanContext *ctx = scanner_start_opts("/tmp/zf_test_deep", &opts);
+    assert(ctx != NULL);
+    assert(ctx->worker_count == 4);
+
+    while (!ctx->done)
+        SDL_Delay(10);
+
+    SDL_LockMutex(ctx->mutex);
+    assert(ctx->root->child_count == 3);
+    assert(ctx->total_files == 121);
+    assert(ctx->root->file_count == 121);
+    assert(ctx->root->size == 12100);
+    assert(ctx->total_size == 12100);
+    assert(count_complete(ctx->root) == 121);
+    SDL_UnlockMutex(ctx->mutex);
+
+    scanner_free(ctx);
+    remove_deep_dir("/tmp/zf_test_deep", 4);
+}
+
+void test_scan_io_uring(void)
+{
+    // Falls back to plain syscalls where io_uring is unavailable. The wide
+    // directory holds more files than the ring has slots.
+    make_deep_dir("/tmp/zf_test_uring", 3);
+    mkdir("/tmp/zf_test_uring/wide", 0755);
+    char path[256];
+    for (int i = 0; i < 600; i++) {
+        snprintf(path, sizeof(path), "/tmp/zf_test_uring/wide/%d", i);
+        FILE *f = fopen(path, "w");
+        if (f) { fprintf(f, "%*s", 10, ""); fclose(f); }
+    }
+
+    ScanOptions opts = {.threads = 2, .io_uring = true};
+    ScanContext *ctx = scanner_start_opts("/tmp/zf_test_uring", &opts);
+    while (!ctx->done)
+        SDL_Delay(10);
+
+    SDL_LockMutex(ctx->mutex);
+    assert(ctx->root->child_count == 4);
+    assert(ctx->total_files == 640);
+    assert(ctx->root->size == 10000);
+    assert(count_complete(ctx->root) == 41);
+    SDL_UnlockMutex(ctx->mutex);
+
+    scanner_free(ctx);
+    for (int i = 0; i < 600; i++) {
+        snprintf(path, sizeof(path), "/tmp/zf_test_uring/wide/%d", i);
+        unlink(path);
+    }
+    rmdir("/tmp/zf_test_uring/wide");
+    remove_deep_dir("/tmp/zf_test_uring", 3);
+}
+
+void test_scan_cancel(void)
+{
+    make_deep_dir("/tmp/zf_test_cancel", 4);
+
+    ScanOptions opts = {.threads = 3};
+    ScanContext *ctx = scanner_start_opts("/tmp/zf_test_cancel", &opts);
+    scanner_cancel(ctx);
+    assert(ctx->done);
+    scanner_free(ctx);
+    remove_deep_dir("/tmp/zf_test_cancel", 4);
+}
+
+void test_scan_throttled(void)
+{
+    make_deep_dir("/tmp/zf_test_throttle", 4);
+
+    // 121 files and 120 directories in slots of 20 entries every 10 ms
+    ScanOptions opts = {.threads = 4, .max_stat_rate = 2000};
+    uint64_t started = SDL_GetTicks();
+    ScanContext *ctx = scanner_start_opts("/tmp/zf_test_throttle", &opts);
+    while (!ctx->done)
+        SDL_Delay(5);
+    assert(SDL_GetTicks() - started >= 100);
+    assert(ctx->total_files == 121);
+    assert(ctx->total_size == 12100);
+    assert(ctx->throttled_ns > 0);
+    scanner_free(ctx);
+
+    opts = (ScanOptions){.threads = 4, .max_open_dirs = 1, .low_priority = true,
+                         .adaptive = true};
+    ctx = scanner_start_opts("/tmp/zf_test_throttle", &opts);
+    while (!ctx->done)
+        SDL_Delay(5);
+    assert(ctx->total_files == 121);
+    assert(count_complete(ctx->root) == 121);
+    scanner_free(ctx);
+
+    remove_deep_dir("/tmp/zf_test_throttle", 4);
+}
+
+#define LONG_LEVELS 24
+
+void test_scan_long_path(void)
+{
+    // 24 levels of 200-character names, well past PATH_MAX
+    char name[201];
+    memset(name, 'x', 200);
+    name[200] = '\0';
+
+    mkdir("/tmp/zf_test_long", 0755);
+    int fd = open("/tmp/zf_test_long", O_RDONLY | O_DIRECTORY);
+    for (int i = 0; i < LONG_LEVELS; i++) {
+        mkdirat(fd, name, 0755);
+        int next = openat(fd, name, O_RDONLY | O_DIRECTORY);
+        close(fd);
+        fd = next;
+    }
+    int file = openat(fd, "leaf", O_WRONLY | O_CREAT, 0644);
+    assert(write(file, "0123456789", 10) == 10);
+    close(file);
+    close(fd);
+
+    ScanContext *ctx = scanner_start("/tmp/zf_test_long");
+    while (!ctx->done)
+        SDL_Delay(10);
+
+    SDL_LockMutex(ctx->mutex);
+    assert(ctx->total_files == 1);
+    assert(ctx->root->size == 10);
+    SDL_UnlockMutex(ctx->mutex);
+    scanner_free(ctx);
+
+    int fds[LONG_LEVELS + 1];
+    fds[0] = open("/tmp/zf_test_long", O_RDONLY | O_DIRECTORY);
+    for (int i = 0; i < LONG_LEVELS; i++)
+        fds[i + 1] = openat(fds[i], name, O_RDONLY | O_DIRECTORY);
+    unlinkat(fds[LONG_LEVELS], "leaf", 0);
+    for (int i = LONG_LEVELS; i > 0; i--) {
+        close(fds[i]);
+        unlinkat(fds[i - 1], name, AT_REMOVEDIR);
+    }
+    close(fds[0]);
+    rmdir("/tmp/zf_test_long");
+}
+
+static void write_file(const char *path, int size)
+{
+    FILE *f = fopen(path, "w");
+    if (f) { fprintf(f, "%*s", size, ""); fclose(f); }
+}
+
+void test_exclude(void)
+{
+    ScanExclude *ex = exclude_create();
+    assert(exclude_add(ex, "node_modules"));
+    assert(exclude_add(ex, "/proc"));
+    assert(exclude_add(ex, ".git/objects"));
+    assert(exclude_add(ex, "/srv/**/cache-*"));
+    assert(!exclude_add(ex, "/"));
+    assert(!exclude_add(ex, ""));
+
+    uint64_t root = exclude_start(ex, "/");
+    assert(exclude_matched(ex, exclude_step(ex, root, "proc")));
+    assert(!exclude_matched(ex, exclude_step(ex, root, "procs")));
+    assert(exclude_matched(ex, exclude_step(ex, root, "node_modules")));
+
+    // Anchored patterns only match at the filesystem root
+    uint64_t home = exclude_start(ex, "/home/me");
+    assert(!exclude_matched(ex, exclude_step(ex, home, "proc")));
+    assert(exclude_matched(ex, exclude_step(ex, home, "node_modules")));
+    uint64_t git = exclude_step(ex, home, ".git");
+    assert(!exclude_matched(ex, git));
+    assert(exclude_matched(ex, exclude_step(ex, git, "objects")));
+    assert(!exclude_matched(ex, exclude_step(ex, home, "objects")));
+
+    uint64_t srv = exclude_start(ex, "/srv");
+    assert(exclude_matched(ex, exclude_step(ex, srv, "cache-1")));
+    uint64_t deep = exclude_step(ex, exclude_step(ex, srv, "a"), "b");
+    assert(exclude_matched(ex, exclude_step(ex, deep, "cache-x")));
+    assert(!exclude_matched(ex, exclude_step(ex, deep, "cache")));
+
+    // Starting inside an excluded directory scans it
+    uint64_t inside = exclude_start(ex, "/proc");
+    assert(!exclude_matched(ex, exclude_step(ex, inside, "1")));
+    exclude_free(ex);
+}
+
+void test_scan_exclude(void)
+{
+    mkdir("/tmp/zf_test_excl", 0755);
+    mkdir("/tmp/zf_test_excl/node_modules", 0755);
+    mkdir("/tmp/zf_test_excl/src", 0755);
+    mkdir("/tmp/zf_test_excl/src/.git", 0755);
+    mkdir("/tmp/zf_test_excl/src/.git/objects", 0755);
+    write_file("/tmp/zf_test_excl/node_modules/big", 5000);
+    write_file("/tmp/zf_test_excl/src/.git/objects/pack", 3000);
+    write_file("/tmp/zf_test_excl/src/main.c", 100);
+
+    ScanExclude *ex = exclude_create();
+    assert(exclude_add(ex, "node_modules"));
+    assert(exclude_add(ex, ".git/objects"));
+    ScanOptions opts = {.threads = 2, .exclude = ex, .one_filesystem = true};
+    ScanContext *ctx = scanner_start_opts("/tmp/zf_test_excl", &opts);
+    while (!ctx->done)
+        SDL_Delay(5);
+
+    assert(ctx->total_files == 1);
+    assert(ctx->total_size == 100);
+    DirNode *modules = tree_find_child(ctx->root, "node_modules");
+    assert(modules && modules->skip == DIR_EXCLUDED && modules->complete);
+    assert(ctx->root->placeholders == 1);
+    DirNode *git = tree_find_child(tree_find_child(ctx->root, "src"), ".git");
+    assert(git && git->skip == DIR_SCANNED);
+    DirNode *objects = tree_find_child(git, "objects");
+    assert(objects && objects->skip == DIR_EXCLUDED);
+    scanner_free(ctx);
+    exclude_free(ex);
+
+    unlink("/tmp/zf_test_excl/node_modules/big");
+    unlink("/tmp/zf_test_excl/src/.git/objects/pack");
+    unlink("/tmp/zf_test_excl/src/main.c");
+    rmdir("/tmp/zf_test_excl/node_modules");
+    rmdir("/tmp/zf_test_excl/src/.git/objects");
+    rmdir("/tmp/zf_test_excl/src/.git");
+    rmdir("/tmp/zf_test_excl/src");
+    rmdir("/tmp/zf_test_excl");
+
+    // /dev/pts is its own mount where it exists
+    struct stat dev, pts;
+    if (stat("/dev", &dev) != 0 || stat("/dev/pts", &pts) != 0 ||
+        dev.st_dev == pts.st_dev)
+        return;
+    opts = (ScanOptions){.threads = 1, .one_filesystem = true};
+    ctx = scanner_start_opts("/dev", &opts);
+    while (!ctx->done)
+        SDL_Delay(5);
+    DirNode *node = tree_find_child(ctx->root, "pts");
+    assert(node && node->skip == DIR_OTHER_FS && tree_child_count(node) == 0);
+    scanner_free(ctx);
+}
+
+static bool wait_for_totals(ScanContext *ctx, uint64_t size, uint32_t files,
+                            uint32_t children)
+{
+    for (int i = 0; i < 500; i++) {
+        if (ctx->total_size == size && ctx->total_files == files &&
+            ctx->root->size == size && ctx->root->file_count == files &&
+            tree_child_count(ctx->root) == children)
+            return true;
+        SDL_Delay(10);
+    }
+    return false;
+}
+
+void test_watch(void)
+{
+    mkdir("/tmp/zf_test_watch", 0755);
+    mkdir("/tmp/zf_test_watch/a", 0755);
+    mkdir("/tmp/zf_test_watch/b", 0755);
+    write_file("/tmp/zf_test_watch/a/file1.txt", 1000);
+    write_file("/tmp/zf_test_watch/b/file2.txt", 2000);
+
+    ScanExclude *ex = exclude_create();
+    assert(exclude_add(ex, "skipped"));
+    ScanOptions opts = {.exclude = ex, .name_index = true};
+    ScanContext *ctx = scanner_start_opts("/tmp/zf_test_watch", &opts);
+    while (!ctx->done)
+        SDL_Delay(10);
+
+    Watcher *w = watcher_start(ctx);
+    if (!w) {
+        printf("watching unsupported, skipping\n");
+    } else {
+        // A file appears next to an existing one
+        write_file("/tmp/zf_test_watch/a/file3.txt", 500);
+        assert(wait_for_totals(ctx, 3500, 3, 2));
+
+        // Later events there apply each file's own change
+        write_file("/tmp/zf_test_watch/a/file3.txt", 800);
+        unlink("/tmp/zf_test_watch/a/file1.txt");
+        assert(wait_for_totals(ctx, 2800, 2, 2));
+
+        // A populated directory moves in and an old one goes away
+        mkdir("/tmp/zf_test_watch_stage", 0755);
+        mkdir("/tmp/zf_test_watch_stage/deeper", 0755);
+        mkdir("/tmp/zf_test_watch_stage/skipped", 0755);
+        write_file("/tmp/zf_test_watch_stage/file4.txt", 300);
+        rename("/tmp/zf_test_watch_stage", "/tmp/zf_test_watch/c");
+        unlink("/tmp/zf_test_watch/b/file2.txt");
+        rmdir("/tmp/zf_test_watch/b");
+        assert(wait_for_totals(ctx, 1100, 2, 2));
+        DirNode *c = tree_find_child(ctx->root, "c");
+        assert(c && c->size == 300 && c->complete);
+        assert(tree_find_child(ctx->root, "b") == NULL);
+
+        // The new subtree is scanned with the same options and indexed
+        DirNode *skipped = tree_find_child(c, "skipped");
+        assert(skipped && skipped->skip == DIR_EXCLUDED);
+        uint32_t records[4], total;
+        assert(search_find(ctx->search, "deeper", records, 4, &total) == 1);
+        tree_read_begin();
+        DirNode *deeper = search_resolve(ctx->search, ctx->root, records[0]);
+        assert(deeper && strcmp(deeper->name, "deeper") == 0);
+        tree_read_end();
+
+        // Changes inside the new directory are seen too
+        write_file("/tmp/zf_test_watch/c/file4.txt", 100);
+        assert(wait_for_totals(ctx, 900, 2, 2));
+
+        watcher_stop(w);
+    }
+    scanner_free(ctx);
+    exclude_free(ex);
+
+    unlink("/tmp/zf_test_watch/a/file1.txt");
+    unlink("/tmp/zf_test_watch/a/file3.txt");
+    unlink("/tmp/zf_test_watch/c/file4.txt");
+    unlink("/tmp/zf_test_watch/b/file2.txt");
+    rmdir("/tmp/zf_test_watch/a");
+    rmdir("/tmp/zf_test_watch/b");
+    rmdir("/tmp/zf_test_watch/c/deeper");
+    rmdir("/tmp/zf_test_watch/c/skipped");
+    rmdir("/tmp/zf_test_watch/c");
+    rmdir("/tmp/zf_test_watch");
+}
+
+void test_rescan(void)
+{
+    mkdir("/tmp/zf_test_rescan", 0755);
+    mkdir("/tmp/zf_test_rescan/a", 0755);
+    mkdir("/tmp/zf_test_rescan/b", 0755);
+    mkdir("/tmp/zf_test_rescan/b/c", 0755);
+    mkdir("/tmp/zf_test_rescan/d", 0755);
+    mkdir("/tmp/zf_test_rescan/d/e", 0755);
+    mkdir("/tmp/zf_test_rescan/d/e/f", 0755);
+    write_file("/tmp/zf_test_rescan/a/file1.txt", 1000);
+    write_file("/tmp/zf_test_rescan/b/c/file2.txt", 2000);
+    write_file("/tmp/zf_test_rescan/d/e/file4.dat", 300);
+
+    ScanContext *ctx = scanner_start("/tmp/zf_test_rescan");
+    while (!ctx->done)
+        SDL_Delay(10);
+    assert(ctx->reused_dirs == 0);
+
+    // Nothing changed, so the whole old tree is kept
+    ctx = scanner_rescan(ctx);
+    assert(ctx != NULL);
+    while (!ctx->done)
+        SDL_Delay(10);
+    assert(ctx->reused_dirs == 6);
+    assert(ctx->previous == NULL);
+    assert(ctx->total_files == 3 && ctx->root->size == 3300);
+
+    // One directory gains an entry, another only has a file grow
+    write_file("/tmp/zf_test_rescan/a/file3.txt", 500);
+    write_file("/tmp/zf_test_rescan/b/c/file2.txt", 2500);
+
+    ctx = scanner_rescan(ctx);
+    assert(ctx != NULL);
+    while (!ctx->done)
+        SDL_Delay(10);
+
+    // Only d's subtree is the same all the way down
+    assert(ctx->reused_dirs == 2);
+    assert(ctx->total_files == 4);
+    assert(ctx->root->size == 4300);
+    assert(tree_child_count(ctx->root) == 3);
+    DirNode *b = tree_find_child(ctx->root, "b");
+    assert(b && tree_child_count(b) == 1);
+    assert(tree_children(b)[0].size == 2500);
+    DirNode *e = tree_find_child(tree_find_child(ctx->root, "d"), "e");
+    assert(e && e->size == 300 && tree_find_child(e, "f"));
+    char path[64];
+    assert(tree_path(tree_find_child(e, "f"), path, sizeof(path)));
+    assert(strcmp(path, "/tmp/zf_test_rescan/d/e/f") == 0);
+    scanner_free(ctx);
+
+    unlink("/tmp/zf_test_rescan/a/file1.txt");
+    unlink("/tmp/zf_test_rescan/a/file3.txt");
+    unlink("/tmp/zf_test_rescan/b/c/file2.txt");
+    unlink("/tmp/zf_test_rescan/d/e/file4.dat");
+    rmdir("/tmp/zf_test_rescan/b/c");
+    rmdir("/tmp/zf_test_rescan/d/e/f");
+    rmdir("/tmp/zf_test_rescan/d/e");
+    rmdir("/tmp/zf_test_rescan/d");
+    rmdir("/tmp/zf_test_rescan/a");
+    rmdir("/tmp/zf_test_rescan/b");
+    rmdir("/tmp/zf_test_rescan");
+}
+
+static uint32_t expand_all(DirNode *node)
+{
+    snapshot_ensure(node);
+    uint32_t n = 1;
+    for (uint32_t i = 0; i < tree_child_count(node); i++)
+        n += expand_all(&tree_children(node)[i]);
+    return n;
+}
+
+void test_snapshot(void)
+{
+    // 1 + 3 + 9 + 27 directories
+    make_deep_dir("/tmp/zf_test_snap", 3);
+    ScanContext *ctx = scanner_start("/tmp/zf_test_snap");
+    while (!ctx->done)
+        SDL_Delay(10);
+    assert(snapshot_save(ctx, "/tmp/zf_test.zfsnap"));
+    scanner_free(ctx);
+
+    // Only the root's children exist after opening
+    ctx = snapshot_open("/tmp/zf_test.zfsnap");
+    assert(ctx != NULL && ctx->done);
+    assert(strcmp(ctx->root->name, "/tmp/zf_test_snap") == 0);
+    assert(ctx->total_files == 40 && ctx->total_size == 4000);
+    assert(tree_child_count(ctx->root) == 3);
+    DirNode *d0 = &tree_children(ctx->root)[0];
+    assert(d0->source != NULL && tree_child_count(d0) == 0);
+    assert(d0->size == 1300 && d0->file_count == 13 && d0->complete);
+
+    // Saving a partly materialized tree writes all of it, copying the rest
+    // from the file without materializing it
+    assert(snapshot_save(ctx, "/tmp/zf_test2.zfsnap"));
+    assert(d0->kind == NODE_UNEXPANDED && tree_child_count(d0) == 0);
+    scanner_free(ctx);
+    ctx = snapshot_open("/tmp/zf_test2.zfsnap");
+    assert(ctx != NULL);
+    assert(expand_all(ctx->root) == 40);
+    assert(watcher_start(ctx) == NULL);
+    scanner_free(ctx);
+
+    // A truncated file is refused
+    FILE *in = fopen("/tmp/zf_test.zfsnap", "rb");
+    FILE *out = fopen("/tmp/zf_test3.zfsnap", "wb");
+    char buf[600];
+    size_t n = fread(buf, 1, sizeof(buf), in);
+    fwrite(buf, 1, n, out);
+    fclose(in);
+    fclose(out);
+    assert(snapshot_open("/tmp/zf_test3.zfsnap") == NULL);
+    assert(snapshot_open("/tmp/zf_test_missing.zfsnap") == NULL);
+
+    unlink("/tmp/zf_test.zfsnap");
+    unlink("/tmp/zf_test2.zfsnap");
+    unlink("/tmp/zf_test3.zfsnap");
+    remove_deep_dir("/tmp/zf_test_snap", 3);
+}
+
+void test_scan_hints(void)
+{
+    DirNode nodes[SCAN_HINT_MAX + 1];
+    ScanHints hints = {0};
+    for (int i = 0; i <= SCAN_HINT_MAX; i++)
+        scan_hints_add(&hints, &nodes[i], (float)(i + 1));
+    assert(hints.count == SCAN_HINT_MAX);
+    for (int i = 0; i < hints.count; i++)
+        assert(hints.items[i].node != &nodes[0]);
+
+    // Everything below the hinted root goes through the priority heap
+    make_deep_dir("/tmp/zf_test_hint", 4);
+    ScanOptions opts = {.threads = 2};
+    ScanContext *ctx = scanner_start_opts("/tmp/zf_test_hint", &opts);
+    hints.count = 0;
+    scan_hints_add(&hints, ctx->root, 100.0f);
+    scanner_set_hints(ctx, &hints);
+    while (!ctx->done)
+        SDL_Delay(10);
+
+    assert(ctx->total_files == 121);
+    assert(ctx->root->size == 12100);
+    assert(count_complete(ctx->root) == 121);
+    scanner_free(ctx);
+    remove_deep_dir("/tmp/zf_test_hint", 4);
+}
+
+typedef struct {
+    SDL_Mutex *lock;        // workers report concurrently
+    uint32_t dirs;
+    uint32_t deepest;
+    uint64_t root_size;
+} ReportCount;
+
+static void count_report(void *user, const DirNode *node, const char *path,
+                         int depth)
+{
+    ReportCount *rc = user;
+    SDL_LockMutex(rc->lock);
+    rc->dirs++;
+    if ((uint32_t)depth > rc->deepest) rc->deepest = depth;
+    if (depth == 0) {
+        assert(strcmp(path, "/tmp/zf_test_report") == 0);
+        rc->root_size = node->size;
+    } else {
+        assert(strncmp(path, "/tmp/zf_test_report/d", 21) == 0);
+    }
+    SDL_UnlockMutex(rc->lock);
+}
+
+void test_scan_report(void)
+{
+    make_deep_dir("/tmp/zf_test_report", 4);
+
+    ReportCount rc = {.lock = SDL_CreateMutex()};
+    ScanOptions opts = {.threads = 4, .on_dir = count_report, .user = &rc,
+                        .prune = true};
+    ScanContext *ctx = scanner_start_opts("/tmp/zf_test_report", &opts);
+    while (!ctx->done)
+        SDL_Delay(10);
+
+    // Every directory reported once, with its final size; nothing kept
+    assert(rc.dirs == 121);
+    assert(rc.deepest == 4);
+    assert(rc.root_size == 12100);
+    assert(ctx->total_files == 121);
+    assert(tree_child_count(ctx->root) == 0);
+    scanner_free(ctx);
+    SDL_DestroyMutex(rc.lock);
+    remove_deep_dir("/tmp/zf_test_report", 4);
+}
+
+void test_scan_file_stats(void)
+{
+    mkdir("/tmp/zf_test_stats", 0755);
+    mkdir("/tmp/zf_test_stats/sub", 0755);
+    write_file("/tmp/zf_test_stats/a.log", 3000);
+    write_file("/tmp/zf_test_stats/sub/b.LOG", 1000);
+    write_file("/tmp/zf_test_stats/sub/c.mp4", 5000);
+    write_file("/tmp/zf_test_stats/sub/README", 10);
+
+    ScanOptions opts = {.threads = 2};
+    ScanContext *ctx = scanner_start_opts("/tmp/zf_test_stats", &opts);
+    while (!ctx->done)
+        SDL_Delay(5);
+
+    // The small subdirectory only counts toward the root
+    const FileStats *stats = tree_file_stats(ctx->root);
+    assert(stats != NULL);
+    assert(strcmp(stats->exts[0].name, "mp4") == 0 && stats->exts[0].bytes == 5000);
+    assert(strcmp(stats->exts[1].name, "log") == 0 && stats->exts[1].files == 2);
+    assert(stats->exts[2].name[0] == '\0' && stats->exts[2].bytes == 10);
+    assert(stats->bins[filestats_bin(3000)] == 1 && stats->bins[filestats_bin(10)] == 1);
+    assert(tree_file_stats(tree_find_child(ctx->root, "sub")) == NULL);
+    scanner_free(ctx);
+
+    unlink("/tmp/zf_test_stats/a.log");
+    unlink("/tmp/zf_test_stats/sub/b.LOG");
+    unlink("/tmp/zf_test_stats/sub/c.mp4");
+    unlink("/tmp/zf_test_stats/sub/README");
+    rmdir("/tmp/zf_test_stats/sub");
+    rmdir("/tmp/zf_test_stats");
+}
+
+void test_scan_top_files(void)
+{
+    mkdir("/tmp/zf_test_top", 0755);
+    mkdir("/tmp/zf_test_top/a", 0755);
+    mkdir("/tmp/zf_test_top/a/deep", 0755);
+    mkdir("/tmp/zf_test_top/b", 0755);
+    write_file("/tmp/zf_test_top/root.bin", 4000);
+    write_file("/tmp/zf_test_top/a/small", 10);
+    write_file("/tmp/zf_test_top/a/deep/big", 9000);
+    write_file("/tmp/zf_test_top/b/one", 2000);
+    write_file("/tmp/zf_test_top/b/two", 3000);
+    write_file("/tmp/zf_test_top/b/three", 100);
+
+    ScanOptions opts = {.threads = 4, .top_files = 2, .top_files_per_dir = true};
+    ScanContext *ctx = scanner_start_opts("/tmp/zf_test_top", &opts);
+    while (!ctx->done)
+        SDL_Delay(5);
+
+    const TopFiles *top = &ctx->top_files;
+    assert(top->count == 2 && top->dir == NULL);
+    assert(top->items[0].size == 9000 &&
+           strcmp(top->items[0].path, "/tmp/zf_test_top/a/deep/big") == 0);
+    assert(top->items[1].size == 4000);
+
+    // Files directly in the root belong to no subdirectory's list
+    assert(ctx->dir_top_count == 2);
+    assert(strcmp(ctx->dir_top_files[0].dir, "a") == 0);
+    assert(ctx->dir_top_files[0].count == 2);
+    assert(ctx->dir_top_files[0].items[1].size == 10);
+    assert(strcmp(ctx->dir_top_files[1].dir, "b") == 0);
+    assert(ctx->dir_top_files[1].count == 2);
+    assert(ctx->dir_top_files[1].items[0].size == 3000 &&
+           ctx->dir_top_files[1].items[1].size == 2000);
+    scanner_free(ctx);
+
+    unlink("/tmp/zf_test_top/root.bin");
+    unlink("/tmp/zf_test_top/a/small");
+    unlink("/tmp/zf_test_top/a/deep/big");
+    unlink("/tmp/zf_test_top/b/one");
+    unlink("/tmp/zf_test_top/b/two");
+    unlink("/tmp/zf_test_top/b/three");
+    rmdir("/tmp/zf_test_top/a/deep");
+    rmdir("/tmp/zf_test_top/a");
+    rmdir("/tmp/zf_test_top/b");
+    rmdir("/tmp/zf_test_top");
+}
+
+void test_scan_search(void)
+{
+    const char *dirs[] = {
+        "/tmp/zf_test_search", "/tmp/zf_test_search/Projects",
+        "/tmp/zf_test_search/Projects/alpha", "/tmp/zf_test_search/Projects/beta",
+        "/tmp/zf_test_search/Projects/beta/alphabet", "/tmp/zf_test_search/misc",
+        "/tmp/zf_test_search/misc/ALPHA_old", "/tmp/zf_test_search/misc/x",
+    };
+    int n = (int)(sizeof(dirs) / sizeof(dirs[0]));
+    for (int i = 0; i < n; i++)
+        mkdir(dirs[i], 0755);
+
+    ScanOptions opts = {.threads = 4, .name_index = true};
+    ScanContext *ctx = scanner_start_opts("/tmp/zf_test_search", &opts);
+    while (!ctx->done)
+        SDL_Delay(5);
+    assert(ctx->search != NULL);
+
+    uint32_t records[8], total;
+    assert(search_find(ctx->search, "alpha", records, 8, &total) == 3 && total == 3);
+    assert(search_find(ctx->search, "Alp", records, 2, &total) == 2 && total == 3);
+    assert(search_find(ctx->search, "bet", records, 8, &total) == 2 && total == 2);
+    assert(search_find(ctx->search, "zzz", records, 8, &total) == 0 && total == 0);
+    assert(search_find(ctx->search, "x", records, 8, &total) == 1);
+
+    // Every match leads back to its node, wherever repacking moved it
+    char path[256];
+    assert(search_find(ctx->search, "_old", records, 8, &total) == 1);
+    tree_read_begin();
+    DirNode *node = search_resolve(ctx->search, ctx->root, records[0]);
+    assert(node && tree_path(node, path, sizeof(path)));
+    assert(strcmp(path, "/tmp/zf_test_search/misc/ALPHA_old") == 0);
+    tree_read_end();
+    assert(search_mem_used(ctx->search) > 0);
+    scanner_free(ctx);
+
+    for (int i = n - 1; i >= 0; i--)
+        rmdir(dirs[i]);
+}
+
+void test_diff(void)
+{
+    // 1 + 3 + 9 directories of 100 bytes each
+    make_deep_dir("/tmp/zf_test_diff", 2);
+    ScanContext *ctx = scanner_start("/tmp/zf_test_diff");
+    while (!ctx->done)
+        SDL_Delay(5);
+    assert(snapshot_save(ctx, "/tmp/zf_test_diff.zfsnap"));
+    scanner_free(ctx);
+
+    write_file("/tmp/zf_test_diff/d0/d1/big", 5000);
+    remove_deep_dir("/tmp/zf_test_diff/d2", 1);
+    mkdir("/tmp/zf_test_diff/d3", 0755);
+    write_file("/tmp/zf_test_diff/d3/f", 50);
+    ScanContext *after = scanner_start("/tmp/zf_test_diff");
+    while (!after->done)
+        SDL_Delay(5);
+    ScanContext *before = snapshot_open("/tmp/zf_test_diff.zfsnap");
+    assert(before != NULL);
+
+    DirNode *diff = diff_trees(before->root, after->root);
+    assert(diff && diff->kind == NODE_DIFFED);
+    assert(diff->size_delta == 5000 - 400 + 50 && diff->files_delta == -2);
+    assert(tree_child_count(diff) == 4);
+    DirNode *d0 = tree_find_child(diff, "d0");
+    assert(d0->size_delta == 5000 && d0->files_delta == 1 && d0->size == 5400);
+    assert(tree_find_child(d0, "d1")->size_delta == 5000);
+    assert(tree_child_count(tree_find_child(d0, "d0")) == 0);
+
+    // Removed directories keep their old size, and everything below them
+    DirNode *d2 = tree_find_child(diff, "d2");
+    assert(d2->size == 400 && d2->size_delta == -400 && d2->files_delta == -4);
+    assert(tree_child_count(d2) == 3);
+    assert(tree_find_child(diff, "d3")->size_delta == 50);
+    assert(&tree_children(diff)[0] == d0);
+
+    // Unchanged subtrees of the snapshot aren't even expanded
+    DirNode *d1 = tree_find_child(diff, "d1");
+    assert(d1->size_delta == 0 && tree_child_count(d1) == 0);
+    assert(tree_find_child(before->root, "d1")->kind == NODE_UNEXPANDED);
+    assert(tree_file_stats(d1) == NULL);
+
+    tree_free(diff);
+    scanner_free(before);
+    scanner_free(after);
+    unlink("/tmp/zf_test_diff.zfsnap");
+    unlink("/tmp/zf_test_diff/d0/d1/big");
+    unlink("/tmp/zf_test_diff/d3/f");
+    rmdir("/tmp/zf_test_diff/d3");
+    remove_deep_dir("/tmp/zf_test_diff", 2);
+}
+
+void test_memory_budget(void)
+{
+    // 1 + 3 + 9 + 27 directories of 100 bytes each. A budget of one byte
+    // collapses every completed subtree below a directory as it completes.
+    make_deep_dir("/tmp/zf_test_budget", 3);
+    ScanOptions opts = {.memory_budget = 1};
+    ScanContext *ctx = scanner_start_opts("/tmp/zf_test_budget", &opts);
+    while (!ctx->done)
+        SDL_Delay(5);
+    assert(ctx->root->size == 4000 && ctx->root->file_count == 40);
+    assert(tree_child_count(ctx->root) == 3);
+    DirNode *d0 = tree_find_child(ctx->root, "d0");
+    assert(d0->kind == NODE_COLLAPSED && tree_child_count(d0) == 0);
+    assert(d0->size == 1300 && d0->file_count == 13);
+    assert(d0->collapsed_dirs == 12 && d0->collapsed_depth == 2);
+
+    // Expanding lists it again, under the same budget
+    tree_read_begin();
+    ScanContext *sub = scanner_expand(ctx, d0);
+    tree_read_end();
+    assert(sub != NULL);
+    while (!sub->done)
+        SDL_Delay(5);
+    assert(scanner_expand_finish(ctx, sub));
+    d0 = tree_find_child(ctx->root, "d0");
+    assert(d0->kind == NODE_SCANNED && tree_child_count(d0) == 3);
+    assert(d0->size == 1300 && ctx->root->size == 4000);
+    DirNode *d1 = tree_find_child(d0, "d1");
+    assert(d1->kind == NODE_COLLAPSED && d1->collapsed_dirs == 3);
+    assert(d1->collapsed_depth == 1);
+
+    // Snapshots keep the summaries, and don't list them again
+    assert(snapshot_save(ctx, "/tmp/zf_test_budget.zfsnap"));
+    scanner_free(ctx);
+    ctx = snapshot_open("/tmp/zf_test_budget.zfsnap");
+    assert(ctx != NULL);
+    d1 = tree_find_child(ctx->root, "d1");
+    assert(d1->kind == NODE_COLLAPSED && tree_child_count(d1) == 0);
+    assert(d1->size == 1300 && d1->collapsed_dirs == 12 && d1->collapsed_depth == 2);
+    d0 = tree_find_child(ctx->root, "d0");
+    snapshot_ensure(d0);
+    d1 = tree_find_child(d0, "d1");
+    assert(d1->kind == NODE_COLLAPSED && d1->collapsed_dirs == 3);
+    tree_read_begin();
+    assert(scanner_expand(ctx, d1) == NULL);
+    tree_read_end();
+
+    scanner_free(ctx);
+    unlink("/tmp/zf_test_budget.zfsnap");
+
+    // Only a scan's own tree counts against its budget, not others alive
+    ScanContext *others[8];
+    for (int i = 0; i < 8; i++) {
+        others[i] = scanner_start("/tmp/zf_test_budget");
+        while (!others[i]->done)
+            SDL_Delay(5);
+    }
+    int64_t own = others[0]->tree_bytes;
+    assert(own > 0);
+    opts.memory_budget = (size_t)own * 6;
+    ctx = scanner_start_opts("/tmp/zf_test_budget", &opts);
+    while (!ctx->done)
+        SDL_Delay(5);
+    d0 = tree_find_child(ctx->root, "d0");
+    assert(d0->kind == NODE_SCANNED && tree_child_count(d0) == 3);
+    scanner_free(ctx);
+    for (int i = 0; i < 8; i++)
+        scanner_free(others[i]);
+
+    remove_deep_dir("/tmp/zf_test_budget", 3);
+}
+
 int main(void)
 {
     SDL_Init(0);
     test_scan_basic();
     test_scan_empty();
+    test_scan_parallel();
+    test_scan_io_uring();
+    test_scan_hints();
+    test_scan_report();
+    test_scan_file_stats();
+    test_scan_top_files();
+    test_scan_search();
+    test_scan_cancel();
+    test_scan_throttled();
+    test_exclude();
+    test_scan_exclude();
+    test_scan_long_path();
+    test_watch();
+    test_rescan();
+    test_snapshot();
+    test_diff();
+    test_memory_budget();
     printf("All scanner tests passed.\n");
     SDL_Quit();
     return 0;
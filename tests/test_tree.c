@@ -29,8 +29,10 @@ void test_propagate_size(void)
 {
     DirNode *root = tree_create("root");
     DirNode *a = tree_add_child(root, "a");
-    tree_propagate_size(a, 1000);
-    assert(a->size == 1000);
+    DirNode *b = tree_add_child(a, "b");
+    tree_propagate_size(b, 1000);
+    assert(b->size == 1000 && a->size == 1000 && root->size == 1000);
+    assert(tree_children_size(a) == 1000 && tree_children_size(root) == 1000);
     tree_free(root);
 }
 
@@ -59,6 +61,314 @@ void test_dynamic_growth(void)
     tree_free(root);
 }
 
+void test_read_section(void)
+{
+    DirNode *root = tree_create("root");
+    DirNode *small = tree_add_child(root, "small");
+    DirNode *big = tree_add_child(root, "big");
+    small->size = 100;
+    big->size = 9000;
+
+    // A reader keeps seeing the array it loaded while the writer replaces it
+    tree_read_begin();
+    uint32_t count = tree_child_count(root);
+    DirNode *seen = tree_children(root);
+    tree_sort_children(root);
+    for (int i = 0; i < 20; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "child_%d", i);
+        tree_add_child(root, name);
+    }
+    assert(count == 2);
+    assert(seen != tree_children(root));
+    assert(strcmp(seen[0].name, "small") == 0);
+    assert(strcmp(seen[1].name, "big") == 0);
+    tree_read_end();
+
+    assert(tree_child_count(root) == 22);
+    assert(strcmp(tree_children(root)[0].name, "big") == 0);
+    tree_free(root);
+}
+
+void test_names_follow_copies(void)
+{
+    // Growing, sorting and removing all move names to the new block
+    DirNode *root = tree_create("/a/long/root/path");
+    for (int i = 0; i < 50; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "child_%d", i);
+        DirNode *child = tree_add_child(root, name);
+        child->size = (uint64_t)i;
+    }
+    tree_sort_children(root);
+    tree_remove_child(root, 0);
+    assert(tree_child_count(root) == 49);
+    assert(strcmp(tree_children(root)[0].name, "child_48") == 0);
+    assert(strcmp(tree_children(root)[48].name, "child_0") == 0);
+    assert(strcmp(root->name, "/a/long/root/path") == 0);
+    tree_free(root);
+}
+
+void test_memory_per_dir(void)
+{
+    // 1 + 8 + 64 + 512 + 4096 directories with 8-character names
+    TreeMemStats before, after;
+    tree_mem_stats(&before);
+    DirNode *root = tree_create("root");
+    DirNode *level[4096];
+    int count = 1, dirs = 1;
+    level[0] = root;
+    for (int depth = 0; depth < 4; depth++) {
+        DirNode *next[4096];
+        int next_count = 0;
+        for (int i = 0; i < count; i++) {
+            tree_reserve_children(level[i], 8, 8 * 9);
+            for (int c = 0; c < 8; c++) {
+                char name[16];
+                snprintf(name, sizeof(name), "dir_%04d", c);
+                tree_add_child(level[i], name);
+            }
+        }
+        for (int i = 0; i < count && next_count < 4096; i++) {
+            for (int c = 0; c < 8; c++)
+                next[next_count++] = &tree_children(level[i])[c];
+        }
+        dirs += next_count;
+        memcpy(level, next, next_count * sizeof(DirNode *));
+        count = next_count;
+    }
+    tree_mem_stats(&after);
+    // A node of its own used to be over 300 bytes
+    size_t per_dir = (after.used - before.used) / dirs;
+    assert(sizeof(DirNode) <= 64);
+    assert(per_dir <= 128);
+    tree_free(root);
+
+    tree_mem_stats(&after);
+    assert(after.used == before.used);
+}
+
+void test_take_children(void)
+{
+    TreeMemStats before, after;
+    tree_mem_stats(&before);
+    DirNode *old = tree_create("/r");
+    DirNode *kept = tree_add_child(old, "a");
+    tree_add_child(kept, "deep")->size = 7;
+    tree_add_child(old, "b");
+    tree_repack(old);
+
+    DirNode *root = tree_create("/r");
+    DirNode *a = tree_add_child(root, "a");
+    tree_add_child(a, "deep");
+
+    // The old subtree moves under the new node, pack and all
+    tree_take_children(a, tree_find_child(old, "a"));
+    DirNode *deep = tree_find_child(a, "deep");
+    assert(deep && deep->size == 7 && tree_parent(deep) == a);
+    assert(tree_child_count(tree_find_child(old, "a")) == 0);
+    tree_free(old);
+    assert(tree_find_child(a, "deep") == deep);
+    tree_free(root);
+    tree_mem_stats(&after);
+    assert(after.used == before.used);
+}
+
+static uint64_t subtree_sum(const DirNode *node, int *dirs)
+{
+    uint64_t sum = node->size + strlen(node->name);
+    (*dirs)++;
+    for (uint32_t i = 0; i < tree_child_count(node); i++)
+        sum += subtree_sum(&tree_children(node)[i], dirs);
+    return sum;
+}
+
+void test_repack(void)
+{
+    TreeMemStats before, after;
+    tree_mem_stats(&before);
+    DirNode *root = tree_create("root");
+    for (int i = 0; i < 20; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "d%d", i);
+        DirNode *child = tree_add_child(root, name);
+        child->size = (uint64_t)i;
+        for (int j = 0; j < i; j++) {
+            snprintf(name, sizeof(name), "leaf%d", j);
+            tree_add_child(child, name)->size = (uint64_t)j;
+        }
+    }
+    int dirs = 0;
+    uint64_t sum = subtree_sum(root, &dirs);
+
+    // Blocks follow each other depth first, then the tree changes as usual
+    tree_repack(root);
+    DirNode *d1 = &tree_children(root)[1], *d2 = &tree_children(root)[2];
+    assert((char *)tree_children(d1) > (char *)tree_children(root));
+    assert((char *)tree_children(d2) > (char *)tree_children(d1));
+    int repacked = 0;
+    assert(subtree_sum(root, &repacked) == sum && repacked == dirs);
+
+    tree_repack(root);
+    tree_sort_children(root);
+    tree_add_child(&tree_children(root)[0], "late");
+    tree_remove_child(root, 5);
+    assert(strcmp(tree_children(root)[0].name, "d19") == 0);
+    assert(tree_child_count(&tree_children(root)[0]) == 20);
+    tree_free(root);
+
+    tree_mem_stats(&after);
+    assert(after.used == before.used);
+}
+
+void test_order_while_scanning(void)
+{
+    DirNode *root = tree_create("root");
+    DirNode *dir = tree_add_child(root, "dir");
+    for (int i = 0; i < 40; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "c%d", i);
+        tree_add_child(dir, name);
+    }
+    DirNode *children = tree_children(dir);
+    assert(tree_child_order(children) != NULL);
+
+    // Children stay put while the order follows their sizes
+    for (int round = 0; round < 200; round++) {
+        DirNode *child = &children[(round * 7) % 40];
+        tree_add_size(dir, child, (uint64_t)(round % 13));
+        const _Atomic uint32_t *order = tree_child_order(children);
+        for (uint32_t i = 1; i < 40; i++)
+            assert(tree_child_at(children, order, i - 1)->size >=
+                   tree_child_at(children, order, i)->size);
+    }
+    assert(tree_children(dir) == children && strcmp(children[5].name, "c5") == 0);
+
+    // Growing keeps it, so does removing; sorting in place drops it
+    tree_add_child(dir, "late");
+    tree_remove_child(dir, 3);
+    children = tree_children(dir);
+    const _Atomic uint32_t *order = tree_child_order(children);
+    assert(order && tree_child_at(children, order, 39)->size == 0);
+    uint64_t largest = tree_child_at(children, order, 0)->size;
+    dir->complete = true;
+    tree_sort_children(dir);
+    assert(tree_child_order(tree_children(dir)) == NULL);
+    assert(tree_children(dir)[0].size == largest);
+    tree_free(root);
+}
+
+void test_children_size(void)
+{
+    DirNode *root = tree_create("root");
+    DirNode *dir = tree_add_child(root, "dir");
+    for (int i = 0; i < 6; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "c%d", i);
+        tree_add_child(dir, name);
+    }
+    DirNode *children = tree_children(dir);
+    tree_add_size(dir, &children[1], 100);
+    tree_add_size(dir, &children[4], 50);
+    tree_add_size(dir, &children[4], 70);
+    tree_mark_skipped(dir, &children[5], DIR_EXCLUDED);
+    assert(tree_children_size(dir) == 220);
+
+    // Sized ones first, then placeholders, then empty directories
+    const _Atomic uint32_t *order = tree_child_order(children);
+    assert(tree_child_at(children, order, 0) == &children[4]);
+    assert(tree_child_at(children, order, 1) == &children[1]);
+    assert(tree_child_at(children, order, 2) == &children[5]);
+
+    tree_remove_child(dir, 1);
+    assert(tree_children_size(dir) == 120);
+    dir->complete = true;
+    tree_sort_children(dir);
+    assert(tree_children(dir)[1].skip == DIR_EXCLUDED);
+
+    // Sorting also catches up with sizes set directly
+    tree_children(dir)[2].size = 5;
+    tree_sort_children(dir);
+    assert(tree_children_size(dir) == 125);
+    tree_free(root);
+}
+
+void test_parent_links(void)
+{
+    DirNode *root = tree_create("/r/");
+    DirNode *sub = tree_add_child(root, "sub");
+    for (int i = 0; i < 100; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "c%d", i);
+        tree_add_child(sub, name)->size = (uint64_t)i;
+    }
+    tree_add_child(&tree_children(sub)[42], "leaf");
+    assert(tree_parent(root) == NULL);
+    assert(tree_parent(tree_children(root)) == root);
+
+    // Parents and the name index follow every move
+    char path[64];
+    sub = tree_find_child(root, "sub");
+    for (int round = 0; round < 4; round++) {
+        if (round == 1) tree_sort_children(sub);
+        if (round == 2) tree_remove_child(sub, 0);
+        if (round == 3) tree_repack(root);
+        sub = tree_find_child(root, "sub");
+        DirNode *c42 = tree_find_child(sub, "c42");
+        DirNode *leaf = tree_find_child(c42, "leaf");
+        assert(c42 && c42->size == 42 && tree_parent(c42) == sub);
+        assert(tree_parent(leaf) == c42 && tree_parent(sub) == root);
+        assert(tree_path(leaf, path, sizeof(path)));
+        assert(strcmp(path, "/r/sub/c42/leaf") == 0);
+        assert(!tree_path(leaf, path, strlen("/r/sub/c42/leaf")));
+        assert(tree_find_child(sub, "c100") == NULL);
+    }
+    assert(tree_find_child(sub, "c99") == NULL);
+    tree_free(root);
+}
+
+void test_file_stats(void)
+{
+    FileStats a = {0}, b = {0};
+    filestats_add(&a, "movie.MKV", 4000);
+    filestats_add(&a, ".bashrc", 0);
+    for (int i = 0; i < 6; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "f.e%d", i);
+        filestats_add(&a, name, 100 + (uint64_t)i);
+    }
+    // Listed largest first; a small newcomer joins the rest
+    assert(strcmp(a.exts[0].name, "mkv") == 0 && a.exts[0].bytes == 4000);
+    assert(a.exts[5].bytes == 101 && a.other_files == 2 && a.other_bytes == 100);
+    assert(a.bins[0] == 1 && a.bins[filestats_bin(4000)] == 1);
+    assert(filestats_bin(1) == 1 && filestats_bin(4096) == 13);
+    assert(filestats_bin(UINT64_MAX) == FILESTATS_BINS - 1);
+
+    filestats_add(&b, "core", 9000);
+    filestats_add(&b, "x.mkv", 10);
+    filestats_merge(&a, &b);
+    assert(a.exts[0].name[0] == '\0' && a.exts[0].bytes == 9000);
+    assert(a.exts[1].files == 2 && a.exts[1].bytes == 4010);
+    FileStats copy = a;
+    assert(filestats_equal(&a, &copy) && !filestats_equal(&a, &b));
+
+    // Stats go with their nodes, whether removed or freed
+    TreeMemStats before, after;
+    tree_mem_stats(&before);
+    DirNode *root = tree_create("root");
+    tree_set_file_stats(root, &a);
+    DirNode *child = tree_add_child(root, "child");
+    tree_set_file_stats(child, &b);
+    tree_set_file_stats(child, &a);
+    tree_add_child(root, "other");
+    tree_remove_child(root, 0);
+    assert(tree_file_stats(root)->exts[0].bytes == 9000);
+    assert(tree_file_stats(tree_children(root)) == NULL);
+    tree_free(root);
+    tree_mem_stats(&after);
+    assert(after.used == before.used);
+}
+
 int main(void)
 {
     test_create();
@@ -66,6 +376,15 @@ int main(void)
     test_propagate_size();
     test_sort_children();
     test_dynamic_growth();
+    test_read_section();
+    test_names_follow_copies();
+    test_memory_per_dir();
+    test_repack();
+    test_order_while_scanning();
+    test_children_size();
+    test_parent_links();
+    test_file_stats();
+    test_take_children();
     printf("All tree tests passed.\n");
     return 0;
 }